@@ -0,0 +1,110 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Common utilities for the benchmarks.
+*/
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <unistd.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <poll.h>
+#include <sys/pidfd.h>
+
+/* monotonic time in nanoseconds */
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* CPU time (user + system) of the calling process in nanoseconds */
+static inline uint64_t bench_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline int bench_cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* sort the samples and print their percentiles in microseconds */
+static inline void bench_report(const char *name, uint64_t *samples, size_t n)
+{
+    if (n == 0)
+    {
+        printf("%-28s no samples\n", name);
+        return;
+    }
+
+    qsort(samples, n, sizeof(*samples), bench_cmp_u64);
+    printf("%-28s n=%-8zu min=%9.2f p50=%9.2f p90=%9.2f p99=%9.2f p99.9=%9.2f max=%9.2f us\n",
+           name, n,
+           samples[0] / 1e3,
+           samples[n / 2] / 1e3,
+           samples[n * 90 / 100] / 1e3,
+           samples[n * 99 / 100] / 1e3,
+           samples[n * 999 / 1000] / 1e3,
+           samples[n - 1] / 1e3);
+}
+
+/* wait for the readiness byte written by a daemon */
+static inline int bench_wait_ready(int fd)
+{
+    char b;
+    ssize_t n;
+
+    do
+    {
+        n = read(fd, &b, 1);
+    } while (n == -1 && errno == EINTR);
+
+    return n == 1 ? 0 : -1;
+}
+
+/* signal the process and wait for it to exit */
+static inline int bench_stop_process(pid_t pid, int signo)
+{
+    struct pollfd pfd;
+    int pidfd;
+
+    pidfd = pidfd_open(pid, 0);
+    if (pidfd == -1)
+    {
+        return errno == ESRCH ? 0 : -1;
+    }
+
+    if (pidfd_send_signal(pidfd, signo, NULL, 0) == -1 && errno != ESRCH)
+    {
+        close(pidfd);
+        return -1;
+    }
+
+    pfd.fd = pidfd;
+    pfd.events = POLLIN;
+    while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+        ;
+
+    close(pidfd);
+    return 0;
+}
+
+#endif /* _BENCH_H */
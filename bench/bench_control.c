@@ -0,0 +1,288 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Control socket round trip latency benchmark.
+
+A daemon is started with rundaemon() and serves its control socket
+from a poll() loop. The clients (one thread per connection) send
+requests with a payload and measure the time until the response arrives.
+
+Usage: bench_control [-n REQUESTS] [-c CLIENTS] [-s PAYLOAD] [-p PID-FILE]
+*/
+
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+
+#include "../daemonize.h"
+#include "../dmn_control.h"
+#include "bench.h"
+
+/* the command which is handled by the benchmark daemon */
+#define CMD_COUNT 1
+
+static const char *pid_file_path = "/tmp/bench_control.pid";
+static size_t requests = 100000;
+static size_t clients = 1;
+static size_t payload = 16;
+
+struct client_ctx {
+    pthread_t thread;
+    uint64_t *samples;
+    int failed;
+};
+
+/* counts the requests and echoes the data back */
+static int32_t count_command(void *udata,
+                             const void *request, size_t request_len,
+                             void *response, size_t *response_len)
+{
+    (*(uint64_t *)udata)++;
+    memcpy(response, request, request_len);
+    *response_len = request_len;
+    return 0;
+}
+
+/* the daemon body, udata points to the write end of the readiness pipe */
+static int bench_daemon(void *udata)
+{
+    int ready_fd = *(int *)udata;
+    struct dmn_control *ctl;
+    struct pollfd pfd[2];
+    uint64_t count = 0;
+    sigset_t mask;
+    int sfd;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1 ||
+        (sfd = signalfd(-1, &mask, SFD_CLOEXEC)) == -1)
+    {
+        return EXIT_FAILURE;
+    }
+
+    ctl = dmn_control_open(pid_file_path);
+    if (ctl == NULL || dmn_control_register(ctl, CMD_COUNT, count_command, &count) == -1)
+    {
+        close(sfd);
+        return EXIT_FAILURE;
+    }
+
+    /* notify the starting process */
+    write(ready_fd, "x", 1);
+    close(ready_fd);
+
+    pfd[0].fd = sfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = dmn_control_fd(ctl);
+    pfd[1].events = POLLIN;
+    pfd[0].revents = pfd[1].revents = 0;
+
+    /* the daemon loop: SIGTERM stops it */
+    while (!(pfd[0].revents & POLLIN))
+    {
+        if (poll(pfd, 2, -1) == -1 && errno != EINTR)
+        {
+            break;
+        }
+
+        if ((pfd[1].revents & POLLIN) && dmn_control_process(ctl) == -1)
+        {
+            break;
+        }
+    }
+
+    dmn_control_close(ctl);
+    close(sfd);
+    return EXIT_SUCCESS;
+}
+
+static void *client_thread(void *arg)
+{
+    struct client_ctx *ctx = arg;
+    char *request = malloc(payload + 1);
+    char *response = malloc(payload + 1);
+    size_t warmup = requests / 10;
+    size_t i;
+    int fd;
+
+    fd = dmn_control_connect(pid_file_path);
+    if (fd == -1 || request == NULL || response == NULL)
+    {
+        ctx->failed = 1;
+        goto out;
+    }
+    memset(request, 'x', payload);
+
+    for (i = 0; i < warmup + requests; i++)
+    {
+        size_t response_len = payload;
+        int32_t status = 0;
+        uint64_t start = bench_now_ns();
+
+        if (dmn_control_call(fd, CMD_COUNT, request, payload,
+                             response, &response_len, &status) == -1 ||
+            status != 0 || response_len != payload)
+        {
+            ctx->failed = 1;
+            break;
+        }
+
+        if (i >= warmup)
+        {
+            ctx->samples[i - warmup] = bench_now_ns() - start;
+        }
+    }
+    close(fd);
+
+out:
+    free(request);
+    free(response);
+    return NULL;
+}
+
+static int run_clients(void)
+{
+    struct client_ctx *ctx;
+    uint64_t *samples;
+    uint64_t start, elapsed;
+    char name[64];
+    size_t i;
+    int failed = 0;
+
+    ctx = calloc(clients, sizeof(*ctx));
+    samples = calloc(clients * requests, sizeof(*samples));
+    if (ctx == NULL || samples == NULL)
+    {
+        free(ctx);
+        free(samples);
+        return -1;
+    }
+
+    start = bench_now_ns();
+    for (i = 0; i < clients; i++)
+    {
+        ctx[i].samples = &samples[i * requests];
+        if (pthread_create(&ctx[i].thread, NULL, client_thread, &ctx[i]) != 0)
+        {
+            ctx[i].failed = 1;
+            ctx[i].thread = 0;
+        }
+    }
+    for (i = 0; i < clients; i++)
+    {
+        if (ctx[i].thread != 0)
+        {
+            pthread_join(ctx[i].thread, NULL);
+        }
+        failed |= ctx[i].failed;
+    }
+    elapsed = bench_now_ns() - start;
+
+    if (failed)
+    {
+        fprintf(stderr, "Some of the clients failed.\n");
+    }
+    else
+    {
+        snprintf(name, sizeof(name), "round trip (%zu B, %zu cl)", payload, clients);
+        bench_report(name, samples, clients * requests);
+        printf("%-28s %.0f requests/s\n", "throughput",
+               (double)clients * (requests + requests / 10) / (elapsed / 1e9));
+    }
+
+    free(ctx);
+    free(samples);
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int ready[2];
+    int exit_code = 0;
+    int result;
+    pid_t pid;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:s:p:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                requests = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                clients = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                payload = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                pid_file_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n REQUESTS] [-c CLIENTS] [-s PAYLOAD] [-p PID-FILE]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (requests == 0 || clients == 0 || payload > DMN_CONTROL_MAX_PAYLOAD)
+    {
+        fprintf(stderr, "Invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (pipe(ready) == -1)
+    {
+        perror("pipe");
+        return EXIT_FAILURE;
+    }
+
+    /* keep the readiness pipe open in the daemon */
+    fflush(stdout);
+    pid = rundaemon(DMN_NO_CLOSE, bench_daemon, &ready[1], &exit_code, pid_file_path);
+    switch (pid)
+    {
+        case -1:
+            perror("Cannot start daemon");
+            return EXIT_FAILURE;
+        case -2:
+            fprintf(stderr, "Daemon already running.\n");
+            return EXIT_FAILURE;
+        case 0:
+            return exit_code;
+    }
+
+    close(ready[1]);
+    if (bench_wait_ready(ready[0]) == -1)
+    {
+        fprintf(stderr, "Daemon failed to start.\n");
+        return EXIT_FAILURE;
+    }
+    close(ready[0]);
+
+    result = run_clients();
+
+    bench_stop_process(pid, SIGTERM);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#else
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "This program contains Linux specific code. Exiting...\n");
+    return EXIT_FAILURE;
+}
+#endif /* __linux__ */
@@ -0,0 +1,400 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Echo server benchmark: the coroutine layer (daemonize_coro.hpp)
+compared with a hand-written epoll(7) loop.
+
+Both servers run in a single thread and serve TCP connections on the
+loopback interface. The clients (one thread per connection) send a
+request and wait for the echoed data before sending the next one. The
+round trip latency, throughput and the CPU time the server thread spends
+per request are reported.
+
+Usage: bench_echo [-n REQUESTS] [-c CLIENTS] [-s PAYLOAD]
+*/
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "../daemonize_coro.hpp"
+#include "bench.h"
+
+using dmn::unique_fd;
+using dmn::coro::async_fd;
+using dmn::coro::executor;
+using dmn::coro::task;
+
+/* the server buffer size */
+#define BUFFER_SIZE 4096
+
+static size_t requests = 100000;
+static size_t clients = 1;
+static size_t payload = 64;
+
+/* CPU time of the calling thread in nanoseconds */
+static uint64_t thread_cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* a non-blocking listening socket on an ephemeral loopback port */
+static unique_fd listen_socket(uint16_t *port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    unique_fd fd(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (!fd ||
+        bind(fd.get(), (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(fd.get(), SOMAXCONN) == -1 ||
+        getsockname(fd.get(), (struct sockaddr *)&addr, &len) == -1)
+    {
+        return unique_fd();
+    }
+
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/*
+* The hand-written server
+*/
+
+/* echo the available data, returns false when the connection is closed */
+static bool raw_echo(int fd)
+{
+    char buf[BUFFER_SIZE];
+    ssize_t n = read(fd, buf, sizeof(buf));
+
+    if (n <= 0)
+    {
+        return n == -1 && errno == EAGAIN;
+    }
+
+    for (ssize_t off = 0; off < n; )
+    {
+        ssize_t w = write(fd, buf + off, n - off);
+        if (w == -1)
+        {
+            if (errno == EAGAIN)
+            {
+                continue; /* the clients wait for the response, so it is rare */
+            }
+            return false;
+        }
+        off += w;
+    }
+
+    return true;
+}
+
+static void raw_server(int lfd, int stopfd, uint64_t *cpu_ns)
+{
+    struct epoll_event events[64];
+    struct epoll_event ev;
+    uint64_t start = thread_cpu_ns();
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    bool stop = false;
+
+    ev.events = EPOLLIN;
+    ev.data.fd = lfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+    ev.data.fd = stopfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, stopfd, &ev);
+
+    while (!stop)
+    {
+        int n = epoll_wait(epfd, events, 64, -1);
+
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+
+            if (fd == stopfd)
+            {
+                stop = true;
+            }
+            else if (fd == lfd)
+            {
+                int conn;
+                while ((conn = accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+                {
+                    ev.events = EPOLLIN;
+                    ev.data.fd = conn;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, conn, &ev);
+                }
+            }
+            else if (!raw_echo(fd))
+            {
+                close(fd);
+            }
+        }
+    }
+
+    close(epfd);
+    *cpu_ns = thread_cpu_ns() - start;
+}
+
+/*
+* The coroutine server
+*/
+
+static task<> session(executor &ex, unique_fd fd)
+{
+    async_fd conn(ex, std::move(fd));
+    char buf[BUFFER_SIZE];
+
+    for (;;)
+    {
+        auto n = co_await conn.read(buf, sizeof(buf));
+        if (!n || *n == 0)
+        {
+            break;
+        }
+
+        for (size_t off = 0; off < *n; )
+        {
+            auto w = co_await conn.write(buf + off, *n - off);
+            if (!w)
+            {
+                co_return;
+            }
+            off += *w;
+        }
+    }
+}
+
+static task<> listener(executor &ex, unique_fd fd)
+{
+    async_fd l(ex, std::move(fd));
+
+    for (;;)
+    {
+        auto conn = co_await l.accept();
+        if (conn)
+        {
+            ex.spawn(session(ex, std::move(*conn)));
+        }
+    }
+}
+
+static void coro_server(unique_fd lfd, std::promise<executor *> *started, uint64_t *cpu_ns)
+{
+    uint64_t start = thread_cpu_ns();
+    executor ex;
+
+    ex.spawn(listener(ex, std::move(lfd)));
+    started->set_value(&ex);
+    ex.run();
+
+    *cpu_ns = thread_cpu_ns() - start;
+}
+
+/*
+* The clients
+*/
+
+struct client_ctx {
+    uint16_t port;
+    uint64_t *samples;
+    bool failed;
+};
+
+static bool read_full(int fd, char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = read(fd, buf, len);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void client(client_ctx *ctx)
+{
+    struct sockaddr_in addr;
+    std::vector<char> request(payload, 'x'), response(payload);
+    size_t warmup = requests / 10;
+    int one = 1;
+    unique_fd fd(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(ctx->port);
+    if (!fd || connect(fd.get(), (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        ctx->failed = true;
+        return;
+    }
+    setsockopt(fd.get(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    for (size_t i = 0; i < warmup + requests; i++)
+    {
+        uint64_t start = bench_now_ns();
+
+        if (write(fd.get(), request.data(), payload) != (ssize_t)payload ||
+            !read_full(fd.get(), response.data(), payload))
+        {
+            ctx->failed = true;
+            return;
+        }
+
+        if (i >= warmup)
+        {
+            ctx->samples[i - warmup] = bench_now_ns() - start;
+        }
+    }
+}
+
+/* run the clients against the server and print the results */
+static bool run_clients(const char *name, uint16_t port, uint64_t *elapsed)
+{
+    std::vector<uint64_t> samples(clients * requests);
+    std::vector<client_ctx> ctx(clients);
+    std::vector<std::thread> threads;
+    uint64_t start = bench_now_ns();
+    bool failed = false;
+    char title[64];
+
+    for (size_t i = 0; i < clients; i++)
+    {
+        ctx[i].port = port;
+        ctx[i].samples = &samples[i * requests];
+        ctx[i].failed = false;
+        threads.emplace_back(client, &ctx[i]);
+    }
+    for (size_t i = 0; i < clients; i++)
+    {
+        threads[i].join();
+        failed |= ctx[i].failed;
+    }
+    *elapsed = bench_now_ns() - start;
+
+    if (failed)
+    {
+        std::fprintf(stderr, "%s: some of the clients failed.\n", name);
+        return false;
+    }
+
+    std::snprintf(title, sizeof(title), "%s (%zu B, %zu cl)", name, payload, clients);
+    bench_report(title, samples.data(), samples.size());
+    std::printf("%-28s %.0f requests/s\n", "throughput",
+                (double)clients * (requests + requests / 10) / (*elapsed / 1e9));
+    return true;
+}
+
+static void report_cpu(uint64_t cpu_ns)
+{
+    std::printf("%-28s %.0f ns/request\n", "server cpu",
+                (double)cpu_ns / (clients * (requests + requests / 10)));
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t elapsed, cpu_ns = 0;
+    bool ok = true;
+    uint16_t port;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                requests = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'c':
+                clients = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 's':
+                payload = std::strtoul(optarg, nullptr, 10);
+                break;
+            default:
+                std::fprintf(stderr, "Usage: %s [-n REQUESTS] [-c CLIENTS] [-s PAYLOAD]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (requests == 0 || clients == 0 || payload == 0)
+    {
+        std::fprintf(stderr, "Invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+
+    /* the hand-written epoll loop */
+    {
+        unique_fd lfd = listen_socket(&port);
+        unique_fd stopfd(eventfd(0, EFD_CLOEXEC));
+        uint64_t one = 1;
+
+        if (!lfd || !stopfd)
+        {
+            perror("Initialization failed");
+            return EXIT_FAILURE;
+        }
+
+        std::thread server(raw_server, lfd.get(), stopfd.get(), &cpu_ns);
+        ok &= run_clients("raw epoll", port, &elapsed);
+        (void)!write(stopfd.get(), &one, sizeof(one));
+        server.join();
+        report_cpu(cpu_ns);
+    }
+
+    /* the coroutines */
+    {
+        unique_fd lfd = listen_socket(&port);
+        std::promise<executor *> started;
+
+        if (!lfd)
+        {
+            perror("Initialization failed");
+            return EXIT_FAILURE;
+        }
+
+        std::thread server(coro_server, std::move(lfd), &started, &cpu_ns);
+        executor *ex = started.get_future().get();
+        ok &= run_clients("coroutines", port, &elapsed);
+        ex->stop();
+        server.join();
+        report_cpu(cpu_ns);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#else
+int main(int argc, char **argv)
+{
+    std::fprintf(stderr, "This program contains Linux specific code. Exiting...\n");
+    return EXIT_FAILURE;
+}
+#endif /* __linux__ */
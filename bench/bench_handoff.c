@@ -0,0 +1,318 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Warm state handoff benchmark.
+
+A daemon builds its state (a table filled with computed values) in a
+dmn_handoff region. The benchmark restarts it repeatedly in two ways and
+measures the time from the restart request until the new instance has
+its state ready:
+
+cold - the daemon is stopped with SIGTERM and a new instance rebuilds
+       the state;
+warm - the daemon is sent SIGUSR2, offers its state and passes it to the
+       new instance, which verifies it instead of rebuilding.
+
+Usage: bench_handoff [-n RESTARTS] [-m MB] [-p PID-FILE]
+*/
+
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#ifdef __linux__
+#include <stdint.h>
+
+#include "../daemonize.h"
+#include "../dmn_handoff.h"
+#include "bench.h"
+
+#define STATE_VERSION 1
+#define STATE_LAYOUT 0x62656e6368ull
+
+/* the readiness notifications */
+#define READY_COLD 'C'
+#define READY_WARM 'W'
+#define OFFERED 'O'
+
+static const char *pid_file_path = "/tmp/bench_handoff.pid";
+static size_t restarts = 20;
+static size_t state_mb = 256;
+
+/* the value of the state word */
+static uint64_t state_value(uint64_t i)
+{
+    /* splitmix64 */
+    uint64_t z = i + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/* the daemon body, udata points to the write end of the readiness pipe */
+static int bench_daemon(void *udata)
+{
+    int ready_fd = *(int *)udata;
+    size_t words = (state_mb << 20) / sizeof(uint64_t);
+    struct dmn_handoff *h;
+    uint64_t *state;
+    sigset_t mask;
+    int warm = 0;
+    size_t i;
+    char b;
+    int sig;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR2);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+    {
+        return EXIT_FAILURE;
+    }
+
+    h = dmn_handoff_open(pid_file_path, STATE_VERSION, STATE_LAYOUT, 5000);
+    if (h == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    state = dmn_handoff_region(h, "state", words * sizeof(uint64_t), &warm);
+    if (state == NULL)
+    {
+        dmn_handoff_close(h);
+        return EXIT_FAILURE;
+    }
+
+    if (warm)
+    {
+        /* spot check the state of the predecessor */
+        for (i = 0; i < words; i += 4096)
+        {
+            if (state[i] != state_value(i))
+            {
+                warm = 0;
+                break;
+            }
+        }
+    }
+
+    if (!warm)
+    {
+        for (i = 0; i < words; i++)
+        {
+            state[i] = state_value(i);
+        }
+    }
+
+    /* notify the starting process */
+    b = warm ? READY_WARM : READY_COLD;
+    write(ready_fd, &b, 1);
+
+    while (sigwait(&mask, &sig) == 0 && sig != SIGTERM)
+    {
+        if (sig == SIGUSR2 && dmn_handoff_offer(h) == 0)
+        {
+            b = OFFERED;
+            write(ready_fd, &b, 1);
+            if (dmn_handoff_transfer(h, 5000) == -1)
+            {
+                continue; /* the PID-file is held again */
+            }
+            break;
+        }
+    }
+
+    close(ready_fd);
+    dmn_handoff_close(h);
+    return EXIT_SUCCESS;
+}
+
+/* start the daemon, returns its PID and the read end of its readiness pipe */
+static pid_t start_daemon(int *ready_fd)
+{
+    int ready[2];
+    int exit_code = 0;
+    pid_t pid;
+
+    if (pipe(ready) == -1)
+    {
+        perror("pipe");
+        return -1;
+    }
+
+    /* keep the readiness pipe open in the daemon */
+    fflush(stdout);
+    pid = rundaemon(DMN_NO_CLOSE, bench_daemon, &ready[1], &exit_code, pid_file_path);
+    switch (pid)
+    {
+        case -1:
+            perror("Cannot start daemon");
+            break;
+        case -2:
+            fprintf(stderr, "Daemon already running.\n");
+            pid = -1;
+            break;
+        case 0:
+            exit(exit_code);
+    }
+
+    close(ready[1]);
+    if (pid == -1)
+    {
+        close(ready[0]);
+        return -1;
+    }
+
+    *ready_fd = ready[0];
+    return pid;
+}
+
+/* read the next notification of the daemon */
+static int read_notification(int fd)
+{
+    char b;
+    ssize_t n;
+
+    do
+    {
+        n = read(fd, &b, 1);
+    } while (n == -1 && errno == EINTR);
+
+    return n == 1 ? b : -1;
+}
+
+/* restart the daemon, returns the readiness notification of the new instance */
+static int restart(int warm, pid_t *pid, int *ready_fd, uint64_t *sample)
+{
+    uint64_t start = bench_now_ns();
+    pid_t old_pid = *pid;
+    int old_fd = *ready_fd;
+    int result;
+
+    if (warm)
+    {
+        if (kill(old_pid, SIGUSR2) == -1 || read_notification(old_fd) != OFFERED)
+        {
+            fprintf(stderr, "The daemon has not offered its state.\n");
+            return -1;
+        }
+    }
+    else
+    {
+        bench_stop_process(old_pid, SIGTERM);
+    }
+
+    *pid = start_daemon(ready_fd);
+    if (*pid == -1)
+    {
+        close(old_fd);
+        return -1;
+    }
+    result = read_notification(*ready_fd);
+    *sample = bench_now_ns() - start;
+
+    /* the predecessor exits after the transfer */
+    bench_stop_process(old_pid, SIGTERM);
+    close(old_fd);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t *cold, *warm;
+    int result = EXIT_SUCCESS;
+    int ready_fd;
+    char name[64];
+    pid_t pid;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:m:p:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                restarts = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                state_mb = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                pid_file_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n RESTARTS] [-m MB] [-p PID-FILE]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (restarts == 0 || state_mb == 0)
+    {
+        fprintf(stderr, "Invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+
+    cold = calloc(restarts, sizeof(*cold));
+    warm = calloc(restarts, sizeof(*warm));
+    if (cold == NULL || warm == NULL)
+    {
+        perror("Initialization failed");
+        return EXIT_FAILURE;
+    }
+
+    pid = start_daemon(&ready_fd);
+    if (pid == -1 || read_notification(ready_fd) != READY_COLD)
+    {
+        fprintf(stderr, "Daemon failed to start.\n");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < restarts; i++)
+    {
+        if (restart(0, &pid, &ready_fd, &cold[i]) != READY_COLD)
+        {
+            fprintf(stderr, "Cold restart failed.\n");
+            result = EXIT_FAILURE;
+            break;
+        }
+
+        if (restart(1, &pid, &ready_fd, &warm[i]) != READY_WARM)
+        {
+            fprintf(stderr, "Warm restart failed: the state has not been passed.\n");
+            result = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    if (result == EXIT_SUCCESS)
+    {
+        snprintf(name, sizeof(name), "cold restart (%zu MB)", state_mb);
+        bench_report(name, cold, restarts);
+        snprintf(name, sizeof(name), "warm restart (%zu MB)", state_mb);
+        bench_report(name, warm, restarts);
+    }
+
+    if (pid != -1)
+    {
+        bench_stop_process(pid, SIGTERM);
+        close(ready_fd);
+    }
+    free(cold);
+    free(warm);
+    return result;
+}
+#else
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "This program contains Linux specific code. Exiting...\n");
+    return EXIT_FAILURE;
+}
+#endif /* __linux__ */
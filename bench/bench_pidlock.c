@@ -0,0 +1,365 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+PID-file locking stress test and benchmark.
+
+Every round starts a number of processes which call rundaemon() with
+the same PID-file at the same moment. Exactly one of them must start
+a daemon, all the others must get -2 (already running). The daemon
+bodies report themselves, so a daemon which runs without holding the
+lock is detected as well.
+
+The benchmark reports the rundaemon() latency under contention and the
+throughput of the uncontended start/stop cycles.
+
+Usage: bench_pidlock [-n LAUNCHERS] [-r ROUNDS] [-s CYCLES] [-p PID-FILE]
+*/
+
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "../daemonize.h"
+#include "bench.h"
+
+static const char *pid_file_path = "/tmp/bench_pidlock.pid";
+static int launchers = 200;
+static int rounds = 20;
+static int cycles = 200;
+
+/* the records written into the report pipe */
+enum {
+    REC_LAUNCHER = 1, /* a launcher returned from rundaemon() */
+    REC_DAEMON = 2    /* a daemon body has started */
+};
+
+struct record {
+    int type;
+    pid_t pid;        /* rundaemon() result or the daemon PID */
+    int err;          /* errno after rundaemon() */
+    uint64_t latency; /* rundaemon() call duration */
+};
+
+static int report_fd = -1;
+
+static void send_record(const struct record *rec)
+{
+    /* the records are smaller than PIPE_BUF, so the writes are atomic */
+    while (write(report_fd, rec, sizeof(*rec)) == -1 && errno == EINTR)
+        ;
+}
+
+/* the daemon body: report and wait for SIGTERM */
+static int stress_daemon(void *udata)
+{
+    struct record rec;
+    sigset_t mask;
+    int signo;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = REC_DAEMON;
+    rec.pid = getpid();
+    send_record(&rec);
+    close(report_fd);
+
+    sigwait(&mask, &signo);
+    return EXIT_SUCCESS;
+}
+
+/* a launcher process: wait for the start signal and call rundaemon() */
+static void launcher(int start_fd)
+{
+    struct record rec;
+    int exit_code = 0;
+    uint64_t start;
+    char b;
+
+    /* the start pipe is closed by the parent to release all the launchers at once */
+    while (read(start_fd, &b, 1) == -1 && errno == EINTR)
+        ;
+    close(start_fd);
+
+    memset(&rec, 0, sizeof(rec));
+    start = bench_now_ns();
+    rec.pid = rundaemon(DMN_NO_CLOSE, stress_daemon, NULL, &exit_code, pid_file_path);
+    rec.err = errno;
+    if (rec.pid == 0) /* daemon process */
+    {
+        exit(exit_code);
+    }
+    rec.latency = bench_now_ns() - start;
+    rec.type = REC_LAUNCHER;
+    send_record(&rec);
+
+    exit(EXIT_SUCCESS);
+}
+
+/* returns the number of the invariant violations in the round */
+static int stress_round(uint64_t *latencies, size_t *nlatencies)
+{
+    int start_pipe[2], report_pipe[2];
+    pid_t winners[16];
+    int nwinners = 0;
+    int ndaemons = 0;
+    int nrunning = 0;
+    int nerrors = 0;
+    struct record rec;
+    pid_t locked;
+    int violations = 0;
+    int i;
+
+    if (pipe(start_pipe) == -1 || pipe(report_pipe) == -1)
+    {
+        perror("pipe");
+        return -1;
+    }
+    report_fd = report_pipe[1];
+
+    fflush(stdout);
+    for (i = 0; i < launchers; i++)
+    {
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            perror("fork");
+            break;
+        }
+        else if (pid == 0)
+        {
+            close(start_pipe[1]);
+            close(report_pipe[0]);
+            launcher(start_pipe[0]);
+        }
+    }
+
+    /* release the launchers */
+    close(start_pipe[0]);
+    close(start_pipe[1]);
+    close(report_pipe[1]);
+
+    /* collect the launchers' reports */
+    while (nrunning + nerrors < launchers &&
+           read(report_pipe[0], &rec, sizeof(rec)) == sizeof(rec))
+    {
+        if (rec.type == REC_DAEMON)
+        {
+            ndaemons++;
+            continue;
+        }
+
+        latencies[(*nlatencies)++] = rec.latency;
+        if (rec.pid > 0)
+        {
+            if (nwinners < (int)(sizeof(winners) / sizeof(winners[0])))
+            {
+                winners[nwinners] = rec.pid;
+            }
+            nwinners++;
+            nrunning++;
+        }
+        else if (rec.pid == -2)
+        {
+            nrunning++;
+        }
+        else
+        {
+            fprintf(stderr, "rundaemon() failed: %s\n", strerror(rec.err));
+            nerrors++;
+        }
+    }
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+        ;
+
+    /* the PID-file must be locked by the winner */
+    locked = checkdaemon(pid_file_path);
+    if (nwinners != 1)
+    {
+        fprintf(stderr, "VIOLATION: %d launchers started a daemon.\n", nwinners);
+        violations++;
+    }
+    else if (locked != winners[0])
+    {
+        fprintf(stderr, "VIOLATION: PID-file points to %ld instead of %ld.\n",
+                (long)locked, (long)winners[0]);
+        violations++;
+    }
+
+    /* stop the daemons */
+    for (i = 0; i < nwinners && i < (int)(sizeof(winners) / sizeof(winners[0])); i++)
+    {
+        bench_stop_process(winners[i], SIGTERM);
+    }
+
+    /* read until all the launchers and daemons have closed the pipe */
+    while (read(report_pipe[0], &rec, sizeof(rec)) == sizeof(rec))
+    {
+        if (rec.type == REC_DAEMON)
+        {
+            ndaemons++;
+        }
+    }
+    close(report_pipe[0]);
+    while (waitpid(-1, NULL, 0) > 0)
+        ;
+
+    if (ndaemons != 1)
+    {
+        fprintf(stderr, "VIOLATION: %d daemon bodies have run.\n", ndaemons);
+        violations++;
+    }
+
+    return violations + nerrors;
+}
+
+/* uncontended start/stop cycles */
+static int start_stop_cycles(uint64_t *latencies)
+{
+    int report_pipe[2];
+    int i;
+
+    for (i = 0; i < cycles; i++)
+    {
+        struct record rec;
+        int exit_code = 0;
+        uint64_t start;
+        pid_t pid;
+
+        if (pipe(report_pipe) == -1)
+        {
+            perror("pipe");
+            return -1;
+        }
+        report_fd = report_pipe[1];
+
+        fflush(stdout);
+        start = bench_now_ns();
+        pid = rundaemon(DMN_NO_CLOSE, stress_daemon, NULL, &exit_code, pid_file_path);
+        if (pid == 0)
+        {
+            exit(exit_code);
+        }
+        else if (pid < 0)
+        {
+            fprintf(stderr, "rundaemon() failed: %ld\n", (long)pid);
+            close(report_pipe[0]);
+            close(report_pipe[1]);
+            return -1;
+        }
+        close(report_pipe[1]);
+
+        /* wait until the daemon is up, then stop it */
+        read(report_pipe[0], &rec, sizeof(rec));
+        latencies[i] = bench_now_ns() - start;
+        close(report_pipe[0]);
+        bench_stop_process(pid, SIGTERM);
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t *latencies;
+    size_t nlatencies = 0;
+    uint64_t start, elapsed;
+    int violations = 0;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "n:r:s:p:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                launchers = atoi(optarg);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            case 's':
+                cycles = atoi(optarg);
+                break;
+            case 'p':
+                pid_file_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n LAUNCHERS] [-r ROUNDS] [-s CYCLES] [-p PID-FILE]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (launchers <= 0 || rounds < 0 || cycles < 0)
+    {
+        fprintf(stderr, "Invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+
+    latencies = calloc((size_t)launchers * rounds + cycles + 1, sizeof(*latencies));
+    if (latencies == NULL)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    /* contended launches */
+    start = bench_now_ns();
+    for (i = 0; i < rounds; i++)
+    {
+        int result = stress_round(latencies, &nlatencies);
+        if (result == -1)
+        {
+            return EXIT_FAILURE;
+        }
+        violations += result;
+    }
+    elapsed = bench_now_ns() - start;
+
+    printf("%d rounds x %d concurrent launchers: %d violations\n", rounds, launchers, violations);
+    bench_report("contended rundaemon()", latencies, nlatencies);
+    if (rounds > 0)
+    {
+        printf("%-28s %.0f launches/s\n", "contended throughput",
+               (double)nlatencies / (elapsed / 1e9));
+    }
+
+    /* uncontended start/stop cycles */
+    if (cycles > 0)
+    {
+        start = bench_now_ns();
+        if (start_stop_cycles(latencies) == -1)
+        {
+            return EXIT_FAILURE;
+        }
+        elapsed = bench_now_ns() - start;
+
+        bench_report("start until daemon is up", latencies, cycles);
+        printf("%-28s %.0f cycles/s\n", "start/stop throughput",
+               (double)cycles / (elapsed / 1e9));
+    }
+
+    free(latencies);
+    return violations == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#else
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "This program contains Linux specific code. Exiting...\n");
+    return EXIT_FAILURE;
+}
+#endif /* __linux__ */
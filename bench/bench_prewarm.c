@@ -0,0 +1,277 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Page cache prewarming benchmark.
+
+A data file is created and evicted from the page cache with
+posix_fadvise(POSIX_FADV_DONTNEED). The benchmark measures:
+
+- the latency of random 4 KB reads from the cold file (the first
+  requests of a daemon which has not been prewarmed);
+- the time of dmn_prewarm() for a number of reading threads, with the
+  file evicted before every run;
+- the latency of random 4 KB reads after the prewarming.
+
+The file should be located on a disk file system (not tmpfs), and its
+size should exceed the disk cache of the device to get realistic
+results.
+
+Usage: bench_prewarm [-f FILE] [-m MB] [-j THREADS,...] [-r MB/s] [-n READS]
+*/
+
+#define _GNU_SOURCE
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "../dmn_prewarm.h"
+#include "bench.h"
+
+#define READ_SIZE 4096
+
+static const char *file_path = "/var/tmp/bench_prewarm.dat";
+static size_t file_mb = 512;
+static const char *thread_counts = "1,4,8";
+static uint64_t rate_mb = 0;
+static size_t reads = 1000;
+
+/* create the data file */
+static int create_file(void)
+{
+    size_t size = file_mb << 20;
+    uint64_t *buf;
+    size_t done, i;
+    int result = 0;
+    int fd;
+
+    buf = malloc(1u << 20);
+    if (buf == NULL)
+    {
+        return -1;
+    }
+
+    fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        free(buf);
+        return -1;
+    }
+
+    /* not compressible and not zero */
+    for (done = 0; done < size && result == 0; done += 1u << 20)
+    {
+        for (i = 0; i < (1u << 20) / sizeof(uint64_t); i++)
+        {
+            buf[i] = (done + i * sizeof(uint64_t)) * 0x9e3779b97f4a7c15ull;
+        }
+        if (write(fd, buf, 1u << 20) != (ssize_t)(1u << 20))
+        {
+            result = -1;
+        }
+    }
+
+    if (result == 0 && fsync(fd) == -1)
+    {
+        result = -1;
+    }
+    close(fd);
+    free(buf);
+    return result;
+}
+
+/* drop the file from the page cache */
+static int evict_file(void)
+{
+    int result;
+    int fd;
+
+    fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    result = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    if (result != 0)
+    {
+        errno = result;
+        return -1;
+    }
+    return 0;
+}
+
+/* measure the random reads */
+static int random_reads(const char *name)
+{
+    uint64_t blocks = (file_mb << 20) / READ_SIZE;
+    uint64_t x = 0x2545f4914f6cdd1dull;
+    uint64_t *samples;
+    char buf[READ_SIZE];
+    size_t i;
+    int fd;
+
+    samples = calloc(reads, sizeof(*samples));
+    fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if (samples == NULL || fd == -1)
+    {
+        free(samples);
+        return -1;
+    }
+    /* no readahead, like the requests of a daemon */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+    for (i = 0; i < reads; i++)
+    {
+        uint64_t start;
+
+        /* xorshift64 */
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+
+        start = bench_now_ns();
+        if (pread(fd, buf, READ_SIZE, (off_t)((x % blocks) * READ_SIZE)) != READ_SIZE)
+        {
+            close(fd);
+            free(samples);
+            return -1;
+        }
+        samples[i] = bench_now_ns() - start;
+    }
+
+    close(fd);
+    bench_report(name, samples, reads);
+    free(samples);
+    return 0;
+}
+
+static void print_progress(void *udata, const struct dmn_prewarm_progress *progress)
+{
+    (void)udata;
+
+    if (!progress->finished)
+    {
+        printf("  %6.1f s: %llu of %llu MB\n", progress->elapsed_ns / 1e9,
+               (unsigned long long)(progress->bytes_done >> 20),
+               (unsigned long long)(progress->bytes_total >> 20));
+    }
+}
+
+static int prewarm(unsigned threads)
+{
+    const char *patterns[] = { file_path, NULL };
+    struct dmn_prewarm_options options;
+    struct dmn_prewarm_progress progress;
+    char name[64];
+
+    memset(&options, 0, sizeof(options));
+    options.threads = threads;
+    options.rate = rate_mb << 20;
+    options.callback = print_progress;
+
+    if (evict_file() == -1 || dmn_prewarm(patterns, &options, &progress) == -1)
+    {
+        return -1;
+    }
+
+    snprintf(name, sizeof(name), "prewarm (%u threads)", threads);
+    printf("%-28s %llu MB in %.1f ms, %.1f MB/s\n", name,
+           (unsigned long long)(progress.bytes_done >> 20), progress.elapsed_ns / 1e6,
+           (progress.bytes_done / 1048576.0) / (progress.elapsed_ns / 1e9));
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *p;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:m:j:r:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+                file_path = optarg;
+                break;
+            case 'm':
+                file_mb = strtoul(optarg, NULL, 10);
+                break;
+            case 'j':
+                thread_counts = optarg;
+                break;
+            case 'r':
+                rate_mb = strtoull(optarg, NULL, 10);
+                break;
+            case 'n':
+                reads = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-f FILE] [-m MB] [-j THREADS,...] [-r MB/s] [-n READS]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (file_mb == 0 || reads == 0)
+    {
+        fprintf(stderr, "Invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (create_file() == -1)
+    {
+        perror("Cannot create the data file");
+        unlink(file_path);
+        return EXIT_FAILURE;
+    }
+
+    if (evict_file() == -1 || random_reads("cold 4K reads") == -1)
+    {
+        perror("Cold reads failed");
+        unlink(file_path);
+        return EXIT_FAILURE;
+    }
+
+    for (p = thread_counts; *p != '\0'; )
+    {
+        char *end;
+        unsigned threads = (unsigned)strtoul(p, &end, 10);
+
+        if (end == p || threads == 0 || prewarm(threads) == -1)
+        {
+            perror("Prewarming failed");
+            unlink(file_path);
+            return EXIT_FAILURE;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    if (random_reads("prewarmed 4K reads") == -1)
+    {
+        perror("Prewarmed reads failed");
+        unlink(file_path);
+        return EXIT_FAILURE;
+    }
+
+    unlink(file_path);
+    return EXIT_SUCCESS;
+}
+#else
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "This program contains Linux specific code. Exiting...\n");
+    return EXIT_FAILURE;
+}
+#endif /* __linux__ */
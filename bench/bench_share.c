@@ -0,0 +1,411 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Memory sharing benchmark.
+
+A number of instances of a daemon are started, every one of them needs
+the same read-only table of computed values. The total PSS of the
+instances is measured in three modes:
+
+private - every instance builds its own copy of the table;
+shared  - the table is a shared dataset (see dmn_shared.h) built by the
+          first instance, the other instances map it;
+ksm     - every instance builds its own copy and marks it as mergeable,
+          the benchmark waits for ksmd to merge the copies. This mode
+          is skipped if KSM is not running ("/sys/kernel/mm/ksm/run").
+
+Usage: bench_share [-n INSTANCES] [-m MB] [-d DATASET] [-t KSM-TIMEOUT]
+*/
+
+#define _GNU_SOURCE /* pipe2() */
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#ifdef __linux__
+#include <stdint.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "../daemonize.h"
+#include "../dmn_shared.h"
+#include "bench.h"
+
+enum {
+    MODE_PRIVATE,
+    MODE_SHARED,
+    MODE_KSM
+};
+
+static const char *mode_names[] = { "private", "shared", "ksm" };
+
+static size_t instances = 8;
+static size_t table_mb = 32;
+static const char *dataset_path = "/dev/shm/bench_share.dataset";
+static unsigned ksm_timeout = 120; /* seconds */
+
+/* the value of the table word */
+static uint64_t table_value(uint64_t i)
+{
+    /* splitmix64 */
+    uint64_t z = i + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/* the expensive initialization, also the dataset initializer */
+static int build_table(void *udata, void *data, size_t size)
+{
+    uint64_t *table = data;
+    size_t i;
+
+    (void)udata;
+    for (i = 0; i < size / sizeof(uint64_t); i++)
+    {
+        table[i] = table_value(i);
+    }
+    return 0;
+}
+
+/* read all of the table like a daemon which uses it */
+static uint64_t checksum(const uint64_t *table, size_t size)
+{
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < size / sizeof(uint64_t); i++)
+    {
+        sum += table[i];
+    }
+    return sum;
+}
+
+/* the instance body, udata points to the readiness pipe and the mode */
+struct instance_args {
+    int ready_fd;
+    int mode;
+};
+
+static int instance_daemon(void *udata)
+{
+    struct instance_args *args = udata;
+    size_t size = table_mb << 20;
+    const uint64_t *table;
+    struct dmn_shared *s = NULL;
+    void *mem;
+    sigset_t mask;
+    char b;
+    int sig;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    if (args->mode == MODE_SHARED)
+    {
+        s = dmn_shared_open(dataset_path, size, 1, size, build_table, NULL);
+        if (s == NULL)
+        {
+            return EXIT_FAILURE;
+        }
+        table = dmn_shared_data(s);
+    }
+    else
+    {
+        /* page aligned, so that KSM can merge all of it */
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+        {
+            return EXIT_FAILURE;
+        }
+        if (args->mode == MODE_KSM && dmn_shared_merge(mem, size) == -1)
+        {
+            return EXIT_FAILURE;
+        }
+        build_table(NULL, mem, size);
+        table = mem;
+    }
+
+    /* the table is used to produce the byte */
+    b = (char)('A' + checksum(table, size) % 26);
+    write(args->ready_fd, &b, 1);
+    close(args->ready_fd);
+
+    sigwait(&mask, &sig);
+    dmn_shared_close(s);
+    return EXIT_SUCCESS;
+}
+
+/* start an instance, returns its PID or -1 */
+static pid_t start_instance(int mode, size_t i)
+{
+    struct instance_args args;
+    char pid_file_path[PATH_MAX];
+    int exit_code = 0;
+    int ready[2];
+    pid_t pid;
+
+    if (pipe2(ready, O_CLOEXEC) == -1)
+    {
+        return -1;
+    }
+    snprintf(pid_file_path, sizeof(pid_file_path), "/tmp/bench_share.%zu.pid", i);
+
+    args.ready_fd = ready[1];
+    args.mode = mode;
+    fflush(stdout);
+    pid = rundaemon(DMN_NO_CLOSE, instance_daemon, &args, &exit_code, pid_file_path);
+    if (pid == 0)
+    {
+        exit(exit_code);
+    }
+    close(ready[1]);
+
+    if (pid == -2)
+    {
+        errno = EBUSY;
+        pid = -1;
+    }
+    if (pid > 0 && bench_wait_ready(ready[0]) == -1)
+    {
+        bench_stop_process(pid, SIGTERM);
+        errno = EIO;
+        pid = -1;
+    }
+    close(ready[0]);
+    return pid;
+}
+
+/* get a "Name: N kB" value of /proc/PID/smaps_rollup in kilobytes */
+static unsigned long long rollup_kb(pid_t pid, const char *name)
+{
+    char path[64];
+    char buf[2048];
+    unsigned long long kb = 0;
+    const char *p;
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/%ld/smaps_rollup", (long)pid);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+    {
+        return 0;
+    }
+    buf[n] = '\0';
+
+    p = strstr(buf, name);
+    if (p != NULL)
+    {
+        sscanf(p + strlen(name), "%llu", &kb);
+    }
+    return kb;
+}
+
+/* sum of the values over the instances */
+static unsigned long long total_kb(const pid_t *pids, const char *name)
+{
+    unsigned long long total = 0;
+    size_t i;
+
+    for (i = 0; i < instances; i++)
+    {
+        total += rollup_kb(pids[i], name);
+    }
+    return total;
+}
+
+/* read a number from a KSM control file */
+static long ksm_value(const char *name)
+{
+    char path[128];
+    long value = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/sys/kernel/mm/ksm/%s", name);
+    f = fopen(path, "r");
+    if (f != NULL)
+    {
+        if (fscanf(f, "%ld", &value) != 1)
+        {
+            value = -1;
+        }
+        fclose(f);
+    }
+    return value;
+}
+
+/* wait until ksmd stops merging more pages, returns the wait time in milliseconds */
+static uint64_t wait_ksm(void)
+{
+    uint64_t start = bench_now_ns();
+    uint64_t deadline = start + (uint64_t)ksm_timeout * 1000000000ull;
+    long sharing = -1, last;
+
+    /* a page is merged on the second scan at the earliest, so the
+       merging is over when two full scans have not changed anything */
+    do
+    {
+        long scans = ksm_value("full_scans");
+
+        last = sharing;
+        sharing = ksm_value("pages_sharing");
+        while (ksm_value("full_scans") < scans + 2)
+        {
+            struct timespec ts = { 0, 100000000L };
+
+            if (bench_now_ns() > deadline)
+            {
+                printf("ksm: merging has not finished in %u seconds\n", ksm_timeout);
+                return (bench_now_ns() - start) / 1000000;
+            }
+            nanosleep(&ts, NULL);
+        }
+    } while (sharing != last);
+
+    return (bench_now_ns() - start) / 1000000;
+}
+
+static int run_mode(int mode)
+{
+    unsigned long long pss, rss;
+    uint64_t start, elapsed, ksm_ms = 0;
+    int result = 0;
+    pid_t *pids;
+    size_t i, started;
+
+    pids = calloc(instances, sizeof(*pids));
+    if (pids == NULL)
+    {
+        return -1;
+    }
+
+    if (mode == MODE_SHARED)
+    {
+        unlink(dataset_path); /* the first instance builds it */
+    }
+
+    start = bench_now_ns();
+    for (started = 0; started < instances; started++)
+    {
+        pids[started] = start_instance(mode, started);
+        if (pids[started] == -1)
+        {
+            fprintf(stderr, "%s: cannot start instance: %s\n", mode_names[mode], strerror(errno));
+            result = -1;
+            break;
+        }
+    }
+    elapsed = bench_now_ns() - start;
+
+    if (result == 0)
+    {
+        if (mode == MODE_KSM)
+        {
+            ksm_ms = wait_ksm();
+        }
+
+        pss = total_kb(pids, "\nPss:");
+        rss = total_kb(pids, "\nRss:");
+        printf("%-8s instances=%-4zu total PSS=%9.1f MB  per instance=%7.1f MB  total RSS=%9.1f MB  start=%8.1f ms",
+               mode_names[mode], instances, pss / 1024.0, pss / 1024.0 / instances,
+               rss / 1024.0, elapsed / 1e6);
+        if (mode == MODE_KSM)
+        {
+            printf("  merged in %llu ms", (unsigned long long)ksm_ms);
+        }
+        printf("\n");
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        bench_stop_process(pids[i], SIGTERM);
+    }
+
+    if (mode == MODE_SHARED)
+    {
+        char lock_path[PATH_MAX];
+
+        snprintf(lock_path, sizeof(lock_path), "%s.lock", dataset_path);
+        unlink(dataset_path);
+        unlink(lock_path);
+    }
+
+    free(pids);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int result = EXIT_SUCCESS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:m:d:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                instances = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                table_mb = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                dataset_path = optarg;
+                break;
+            case 't':
+                ksm_timeout = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n INSTANCES] [-m MB] [-d DATASET] [-t KSM-TIMEOUT]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (instances == 0 || table_mb == 0)
+    {
+        fprintf(stderr, "Invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu instances with a %zu MB table\n", instances, table_mb);
+    if (run_mode(MODE_PRIVATE) == -1 || run_mode(MODE_SHARED) == -1)
+    {
+        result = EXIT_FAILURE;
+    }
+
+    if (ksm_value("run") != 1)
+    {
+        printf("ksm      skipped: KSM is not running (/sys/kernel/mm/ksm/run)\n");
+    }
+    else if (run_mode(MODE_KSM) == -1)
+    {
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
+#else
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "This program contains Linux specific code. Exiting...\n");
+    return EXIT_FAILURE;
+}
+#endif /* __linux__ */
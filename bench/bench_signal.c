@@ -0,0 +1,664 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Signal delivery benchmark.
+
+A daemon started with rundaemon() receives signals in one of the
+following ways:
+
+signalfd      - SIGUSR1 is read from a signalfd(2) in a poll() loop
+                (as in example_linux.c);
+selfpipe-1    - a SIGUSR1 handler writes a byte into a pipe which is read
+                one byte per read() in a poll() loop (as in
+                example_portable.c);
+selfpipe-bulk - the same, but the pipe is drained with large reads;
+sigwaitinfo   - SIGUSR1 is received by sigwaitinfo() in a dedicated thread;
+sigqueue-rt   - a real-time signal with a payload is sent with sigqueue()
+                and read from a signalfd;
+pidfd-rt      - the same, but sent with pidfd_send_signal().
+
+For every mechanism the benchmark measures:
+
+- the delivery latency: a single sender sends a signal and waits until
+  the daemon observes it, the time from sending until the observation
+  is reported;
+- a flood: a number of sender processes send signals as fast as they
+  can. The share of the signals which have not been observed
+  (coalesced standard signals or self-pipe bytes which did not fit into
+  the pipe), the number of the system calls made by the daemon per
+  observed signal (counted by the daemon, including the handler's write()
+  and rt_sigreturn()), and the daemon CPU time per observed signal are
+  reported. The real-time signals are not coalesced; the senders retry
+  when the receiver's queue is full.
+
+Usage: bench_signal [-n SIGNALS] [-p SENDERS] [-l SAMPLES] [-m MODE]
+*/
+
+#define _GNU_SOURCE /* pipe2() */
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#ifdef __linux__
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+
+#include "../daemonize.h"
+#include "bench.h"
+
+#define MAX_SENDERS 64
+
+/* the mechanisms */
+enum {
+    MODE_SIGNALFD,
+    MODE_SELFPIPE_1,
+    MODE_SELFPIPE_BULK,
+    MODE_SIGWAITINFO,
+    MODE_SIGQUEUE_RT,
+    MODE_PIDFD_RT,
+    MODE_COUNT
+};
+
+static const char *mode_names[MODE_COUNT] = {
+    "signalfd",
+    "selfpipe-1",
+    "selfpipe-bulk",
+    "sigwaitinfo",
+    "sigqueue-rt",
+    "pidfd-rt"
+};
+
+/* the state shared by the benchmark, the senders and the daemon */
+struct shared {
+    int mode;
+    int wake;          /* wake up the latency sender on every observation */
+    uint32_t seen_seq; /* futex word, changes on every observation */
+    uint64_t seen;     /* number of the observed signals */
+    uint64_t seen_ns;  /* time of the last observation */
+    uint64_t syscalls; /* number of the system calls made by the daemon */
+    uint64_t sent[MAX_SENDERS];
+    uint64_t retries[MAX_SENDERS];
+};
+
+static const char *pid_file_path = "/tmp/bench_signal.pid";
+static const char *only_mode = NULL;
+static long signals = 100000; /* per sender */
+static int senders = 4;
+static int samples = 10000;
+
+static struct shared *sh;
+static int pipe_fds[2] = { -1, -1 }; /* the self-pipe */
+
+static int is_rt(int mode)
+{
+    return mode == MODE_SIGQUEUE_RT || mode == MODE_PIDFD_RT;
+}
+
+static int signal_of(int mode)
+{
+    return is_rt(mode) ? SIGRTMIN : SIGUSR1;
+}
+
+static void count_syscalls(uint64_t n)
+{
+    __atomic_fetch_add(&sh->syscalls, n, __ATOMIC_RELAXED);
+}
+
+/* the daemon has observed n signals */
+static void observe(uint64_t n)
+{
+    __atomic_store_n(&sh->seen_ns, bench_now_ns(), __ATOMIC_RELAXED);
+    __atomic_store_n(&sh->seen, sh->seen + n, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sh->seen_seq, 1, __ATOMIC_RELEASE);
+
+    if (__atomic_load_n(&sh->wake, __ATOMIC_RELAXED))
+    {
+        syscall(SYS_futex, &sh->seen_seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+/*
+* The receivers
+*/
+
+static void selfpipe_handler(int signo)
+{
+    int saved_errno = errno;
+
+    /* the byte is lost if the pipe is full */
+    write(pipe_fds[1], "x", 1);
+    count_syscalls(2); /* write() and rt_sigreturn() */
+    errno = saved_errno;
+}
+
+/* the same loop as read_bytes_selfpipe() in example_portable.c */
+static void drain_selfpipe_1(void)
+{
+    unsigned char b;
+    uint64_t count = 0;
+
+    for (;;)
+    {
+        count_syscalls(1);
+        if (read(pipe_fds[0], &b, 1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break; /* EAGAIN */
+        }
+        count++;
+    }
+
+    if (count > 0)
+    {
+        observe(count);
+    }
+}
+
+static void drain_selfpipe_bulk(void)
+{
+    unsigned char buf[4096];
+    uint64_t count = 0;
+    ssize_t n;
+
+    for (;;)
+    {
+        count_syscalls(1);
+        n = read(pipe_fds[0], buf, sizeof(buf));
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        count += n;
+        if ((size_t)n < sizeof(buf)) /* drained */
+        {
+            break;
+        }
+    }
+
+    if (count > 0)
+    {
+        observe(count);
+    }
+}
+
+static void drain_signalfd(int sfd)
+{
+    struct signalfd_siginfo info[64];
+    ssize_t n;
+
+    for (;;)
+    {
+        count_syscalls(1);
+        n = read(sfd, info, sizeof(info));
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        observe((uint64_t)n / sizeof(info[0]));
+        if ((size_t)n < sizeof(info))
+        {
+            break;
+        }
+    }
+}
+
+static void *sigwaitinfo_thread(void *arg)
+{
+    sigset_t *mask = arg;
+    siginfo_t info;
+
+    for (;;)
+    {
+        count_syscalls(1);
+        if (sigwaitinfo(mask, &info) > 0)
+        {
+            observe(1);
+        }
+    }
+
+    return NULL;
+}
+
+/* the daemon body, udata points to the write end of the readiness pipe */
+static int bench_daemon(void *udata)
+{
+    int ready_fd = *(int *)udata;
+    int mode = sh->mode;
+    struct pollfd pfd;
+    sigset_t mask;
+    int fd;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, signal_of(mode));
+
+    if (mode == MODE_SELFPIPE_1 || mode == MODE_SELFPIPE_BULK)
+    {
+        struct sigaction act;
+
+        if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) == -1)
+        {
+            return EXIT_FAILURE;
+        }
+
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = selfpipe_handler;
+        act.sa_flags = SA_RESTART;
+        sigemptyset(&act.sa_mask);
+        if (sigaction(SIGUSR1, &act, NULL) == -1)
+        {
+            return EXIT_FAILURE;
+        }
+        fd = pipe_fds[0];
+    }
+    else
+    {
+        /* the signal is blocked in all the threads */
+        if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+        {
+            return EXIT_FAILURE;
+        }
+
+        if (mode == MODE_SIGWAITINFO)
+        {
+            static sigset_t thread_mask;
+            pthread_t thread;
+
+            thread_mask = mask;
+            if (pthread_create(&thread, NULL, sigwaitinfo_thread, &thread_mask) != 0)
+            {
+                return EXIT_FAILURE;
+            }
+            fd = -1;
+        }
+        else
+        {
+            fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+            if (fd == -1)
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    /* notify the starting process */
+    write(ready_fd, "x", 1);
+    close(ready_fd);
+
+    if (fd == -1)
+    {
+        for (;;)
+        {
+            pause(); /* the signals are handled by the thread */
+        }
+    }
+
+    /* the daemon loop, it is stopped with SIGKILL */
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (;;)
+    {
+        count_syscalls(1);
+        if (poll(&pfd, 1, -1) <= 0)
+        {
+            continue; /* EINTR */
+        }
+
+        switch (mode)
+        {
+            case MODE_SELFPIPE_1:
+                drain_selfpipe_1();
+                break;
+            case MODE_SELFPIPE_BULK:
+                drain_selfpipe_bulk();
+                break;
+            default:
+                drain_signalfd(fd);
+                break;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+* The senders
+*/
+
+/* send a signal, returns 0 on success or -1 if the receiver queue is full */
+static int send_signal(int mode, pid_t pid, int pidfd, uint64_t payload)
+{
+    union sigval value;
+    siginfo_t info;
+
+    switch (mode)
+    {
+        case MODE_SIGQUEUE_RT:
+            value.sival_ptr = (void *)(uintptr_t)payload;
+            return sigqueue(pid, SIGRTMIN, value);
+        case MODE_PIDFD_RT:
+            memset(&info, 0, sizeof(info));
+            info.si_signo = SIGRTMIN;
+            info.si_code = SI_QUEUE;
+            info.si_pid = getpid();
+            info.si_uid = getuid();
+            info.si_value.sival_ptr = (void *)(uintptr_t)payload;
+            return pidfd_send_signal(pidfd, SIGRTMIN, &info, 0);
+        default:
+            return kill(pid, SIGUSR1);
+    }
+}
+
+static void sender(int index, pid_t pid, int start_fd)
+{
+    int pidfd = pidfd_open(pid, 0);
+    int mode = sh->mode;
+    long i;
+
+    /* wait for the start */
+    bench_wait_ready(start_fd);
+
+    for (i = 0; i < signals; i++)
+    {
+        while (send_signal(mode, pid, pidfd, ((uint64_t)index << 32) | (uint64_t)i) == -1)
+        {
+            if (errno != EAGAIN)
+            {
+                _exit(EXIT_FAILURE);
+            }
+            /* the real-time signal queue is full */
+            sh->retries[index]++;
+            sched_yield();
+        }
+        sh->sent[index]++;
+    }
+
+    _exit(EXIT_SUCCESS);
+}
+
+/* wait until the observation counter changes */
+static void wait_seen(uint32_t seq)
+{
+    while (__atomic_load_n(&sh->seen_seq, __ATOMIC_ACQUIRE) == seq)
+    {
+        syscall(SYS_futex, &sh->seen_seq, FUTEX_WAIT, seq, NULL, NULL, 0);
+    }
+}
+
+static int measure_latency(int mode, pid_t pid, int pidfd)
+{
+    uint64_t *lat = calloc(samples, sizeof(*lat));
+    char name[64];
+    int i;
+
+    if (lat == NULL)
+    {
+        return -1;
+    }
+
+    __atomic_store_n(&sh->wake, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < samples; i++)
+    {
+        uint32_t seq = __atomic_load_n(&sh->seen_seq, __ATOMIC_ACQUIRE);
+        uint64_t start = bench_now_ns();
+
+        if (send_signal(mode, pid, pidfd, (uint64_t)i) == -1)
+        {
+            perror("Cannot send signal");
+            free(lat);
+            return -1;
+        }
+        wait_seen(seq);
+        lat[i] = __atomic_load_n(&sh->seen_ns, __ATOMIC_RELAXED) - start;
+    }
+    __atomic_store_n(&sh->wake, 0, __ATOMIC_RELAXED);
+
+    snprintf(name, sizeof(name), "%s latency", mode_names[mode]);
+    bench_report(name, lat, samples);
+    free(lat);
+    return 0;
+}
+
+static int measure_flood(int mode, pid_t pid)
+{
+    struct timespec ts = { 0, 200 * 1000000L };
+    pid_t children[MAX_SENDERS];
+    uint64_t sent = 0, retries = 0, seen, calls;
+    uint64_t cpu_start, cpu_end, start;
+    clockid_t cpu_clock;
+    struct timespec cpu;
+    int start_pipe[2];
+    int failed = 0;
+    int i;
+
+    if (clock_getcpuclockid(pid, &cpu_clock) != 0 || pipe(start_pipe) == -1)
+    {
+        return -1;
+    }
+
+    /* reset the counters, the daemon is idle */
+    __atomic_store_n(&sh->seen, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&sh->syscalls, 0, __ATOMIC_RELAXED);
+    memset(sh->sent, 0, sizeof(sh->sent));
+    memset(sh->retries, 0, sizeof(sh->retries));
+
+    fflush(stdout);
+    for (i = 0; i < senders; i++)
+    {
+        children[i] = fork();
+        if (children[i] == 0)
+        {
+            close(start_pipe[1]);
+            sender(i, pid, start_pipe[0]);
+        }
+    }
+    close(start_pipe[0]);
+
+    clock_gettime(cpu_clock, &cpu);
+    cpu_start = (uint64_t)cpu.tv_sec * 1000000000ull + cpu.tv_nsec;
+    start = bench_now_ns();
+    close(start_pipe[1]); /* go */
+
+    for (i = 0; i < senders; i++)
+    {
+        int status;
+
+        if (children[i] == -1 || waitpid(children[i], &status, 0) == -1 ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            failed = 1;
+        }
+        sent += sh->sent[i];
+        retries += sh->retries[i];
+    }
+    if (failed)
+    {
+        fprintf(stderr, "Some of the senders failed.\n");
+        return -1;
+    }
+
+    /* wait until the daemon has handled everything */
+    do
+    {
+        seen = __atomic_load_n(&sh->seen, __ATOMIC_RELAXED);
+        nanosleep(&ts, NULL);
+    } while (seen != __atomic_load_n(&sh->seen, __ATOMIC_RELAXED));
+
+    clock_gettime(cpu_clock, &cpu);
+    cpu_end = (uint64_t)cpu.tv_sec * 1000000000ull + cpu.tv_nsec;
+    calls = __atomic_load_n(&sh->syscalls, __ATOMIC_RELAXED);
+
+    printf("%-28s sent=%llu observed=%llu not observed=%.2f%% sender retries=%llu\n",
+           "", (unsigned long long)sent, (unsigned long long)seen,
+           sent > 0 ? 100.0 * (double)(sent - seen) / sent : 0.0,
+           (unsigned long long)retries);
+    if (seen > 0)
+    {
+        printf("%-28s %.0f observed/s, %.2f syscalls/signal, %.0f ns cpu/signal\n",
+               "",
+               seen / ((sh->seen_ns - start) / 1e9),
+               (double)calls / seen,
+               (double)(cpu_end - cpu_start) / seen);
+    }
+
+    return 0;
+}
+
+static int run_mode(int mode)
+{
+    char name[64];
+    int ready[2];
+    int exit_code = 0;
+    int result;
+    int pidfd;
+    pid_t pid;
+
+    memset(sh, 0, sizeof(*sh));
+    sh->mode = mode;
+
+    if (pipe(ready) == -1)
+    {
+        perror("pipe");
+        return -1;
+    }
+
+    /* keep the readiness pipe open in the daemon */
+    fflush(stdout);
+    pid = rundaemon(DMN_NO_CLOSE, bench_daemon, &ready[1], &exit_code, pid_file_path);
+    switch (pid)
+    {
+        case -1:
+            perror("Cannot start daemon");
+            return -1;
+        case -2:
+            fprintf(stderr, "Daemon already running.\n");
+            return -1;
+        case 0:
+            exit(exit_code);
+    }
+
+    close(ready[1]);
+    if (bench_wait_ready(ready[0]) == -1)
+    {
+        fprintf(stderr, "Daemon failed to start.\n");
+        close(ready[0]);
+        return -1;
+    }
+    close(ready[0]);
+
+    pidfd = pidfd_open(pid, 0);
+    result = pidfd == -1 ? -1 : measure_latency(mode, pid, pidfd);
+    if (result == 0)
+    {
+        snprintf(name, sizeof(name), "%s flood", mode_names[mode]);
+        printf("%s (%d senders x %ld)\n", name, senders, signals);
+        result = measure_flood(mode, pid);
+    }
+
+    if (pidfd != -1)
+    {
+        close(pidfd);
+    }
+    bench_stop_process(pid, SIGKILL);
+    unlink(pid_file_path); /* the daemon has been killed */
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int result = EXIT_SUCCESS;
+    int found = 0;
+    int mode;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:p:l:m:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                signals = atol(optarg);
+                break;
+            case 'p':
+                senders = atoi(optarg);
+                break;
+            case 'l':
+                samples = atoi(optarg);
+                break;
+            case 'm':
+                only_mode = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n SIGNALS] [-p SENDERS] [-l SAMPLES] [-m MODE]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (signals <= 0 || senders <= 0 || senders > MAX_SENDERS || samples <= 0)
+    {
+        fprintf(stderr, "Invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+
+    sh = mmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sh == MAP_FAILED)
+    {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    for (mode = 0; mode < MODE_COUNT; mode++)
+    {
+        if (only_mode != NULL && strcmp(only_mode, mode_names[mode]) != 0)
+        {
+            continue;
+        }
+        found = 1;
+
+        if (run_mode(mode) == -1)
+        {
+            result = EXIT_FAILURE;
+        }
+    }
+
+    if (!found)
+    {
+        fprintf(stderr, "Unknown mode: %s\n", only_mode);
+        return EXIT_FAILURE;
+    }
+
+    return result;
+}
+#else
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "This program contains Linux specific code. Exiting...\n");
+    return EXIT_FAILURE;
+}
+#endif /* __linux__ */
@@ -0,0 +1,207 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Helper process spawn latency benchmark.
+
+Compares the time the calling (daemon) process is stalled by fork()
+followed by exec() in the child with the time dmn_spawn() takes, for
+increasing resident set sizes of the caller. The memory is allocated and
+touched before the measurements.
+
+Usage: bench_spawn [-n SPAWNS] [-m MB[,MB...]] [-e PROGRAM]
+*/
+
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "../dmn_spawn.h"
+#include "bench.h"
+
+static int spawns = 200;
+static const char *sizes = "0,256,1024";
+static char *program = "/bin/true";
+
+static int exited;
+
+static void on_exit_callback(void *udata, pid_t pid, int status)
+{
+    exited++;
+}
+
+/* the time fork() stalls the caller */
+static int bench_fork(uint64_t *samples)
+{
+    char *argv[] = { program, NULL };
+    int i;
+
+    for (i = 0; i < spawns; i++)
+    {
+        uint64_t start = bench_now_ns();
+        pid_t pid = fork();
+
+        if (pid == -1)
+        {
+            perror("fork");
+            return -1;
+        }
+        else if (pid == 0)
+        {
+            execv(program, argv);
+            _exit(127);
+        }
+        samples[i] = bench_now_ns() - start;
+
+        waitpid(pid, NULL, 0);
+    }
+
+    return 0;
+}
+
+/* the time dmn_spawn() stalls the caller */
+static int bench_dmn_spawn(struct dmn_spawner *sp, uint64_t *samples)
+{
+    char *argv[] = { program, NULL };
+    int i;
+
+    exited = 0;
+    for (i = 0; i < spawns; i++)
+    {
+        struct pollfd pfd;
+        uint64_t start = bench_now_ns();
+
+        if (dmn_spawn(sp, program, argv, NULL, NULL, on_exit_callback, NULL) == -1)
+        {
+            perror("dmn_spawn");
+            return -1;
+        }
+        samples[i] = bench_now_ns() - start;
+
+        /* wait for the exit the same way a daemon's event loop would */
+        pfd.fd = dmn_spawner_fd(sp);
+        pfd.events = POLLIN;
+        while (exited <= i)
+        {
+            if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            {
+                perror("poll");
+                return -1;
+            }
+            if (dmn_spawner_process(sp) == -1)
+            {
+                perror("dmn_spawner_process");
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct dmn_spawner *sp;
+    uint64_t *samples;
+    char *list, *tok, *save = NULL;
+    int result = EXIT_SUCCESS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:m:e:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                spawns = atoi(optarg);
+                break;
+            case 'm':
+                sizes = optarg;
+                break;
+            case 'e':
+                program = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n SPAWNS] [-m MB[,MB...]] [-e PROGRAM]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (spawns <= 0)
+    {
+        fprintf(stderr, "Invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+
+    samples = calloc(spawns, sizeof(*samples));
+    list = strdup(sizes);
+    sp = dmn_spawner_open(DMN_SPAWN_DEFAULT);
+    if (samples == NULL || list == NULL || sp == NULL)
+    {
+        perror("Initialization failed");
+        return EXIT_FAILURE;
+    }
+
+    for (tok = strtok_r(list, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        size_t size = strtoul(tok, NULL, 10) << 20;
+        char *mem = NULL;
+        char name[64];
+
+        /* grow the resident set */
+        if (size > 0)
+        {
+            mem = malloc(size);
+            if (mem == NULL)
+            {
+                fprintf(stderr, "Cannot allocate %s MB.\n", tok);
+                result = EXIT_FAILURE;
+                break;
+            }
+            memset(mem, 1, size);
+        }
+
+        fflush(stdout);
+        if (bench_fork(samples) == -1)
+        {
+            result = EXIT_FAILURE;
+            free(mem);
+            break;
+        }
+        snprintf(name, sizeof(name), "fork+exec %s MB", tok);
+        bench_report(name, samples, spawns);
+
+        if (bench_dmn_spawn(sp, samples) == -1)
+        {
+            result = EXIT_FAILURE;
+            free(mem);
+            break;
+        }
+        snprintf(name, sizeof(name), "dmn_spawn %s MB", tok);
+        bench_report(name, samples, spawns);
+
+        free(mem);
+    }
+
+    dmn_spawner_close(sp);
+    free(list);
+    free(samples);
+    return result;
+}
+#else
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "This program contains Linux specific code. Exiting...\n");
+    return EXIT_FAILURE;
+}
+#endif /* __linux__ */
@@ -0,0 +1,155 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Resource usage sampler overhead benchmark.
+
+The benchmark process holds a PID-file and a number of resident
+megabytes, like a daemon, and runs the sampler (see dmn_usage.h) for a
+list of sampling periods, without and with PSS. For every run it
+reports the CPU time consumed by the sampler thread
+(dmn_usage_overhead()) as a share of one CPU and per sample.
+
+Usage: bench_usage [-p PERIOD_MS,...] [-d SECONDS] [-m MB] [-f PID-FILE]
+*/
+
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <stdint.h>
+
+#include <sys/mman.h>
+
+#include "../daemonize.h"
+#include "../dmn_usage.h"
+#include "bench.h"
+
+static const char *periods = "20,100,1000";
+static unsigned duration = 10; /* seconds */
+static size_t resident_mb = 256;
+static const char *pid_file_path = "/tmp/bench_usage.pid";
+
+static int run_sampler(unsigned period_ms, int flags)
+{
+    struct dmn_usage_sample sample;
+    struct dmn_usage *u;
+    struct timespec ts;
+    uint64_t start, elapsed, overhead, samples = 0;
+    char name[64];
+
+    start = bench_now_ns();
+    u = dmn_usage_open(pid_file_path, 16, period_ms, flags);
+    if (u == NULL)
+    {
+        return -1;
+    }
+
+    ts.tv_sec = (time_t)duration;
+    ts.tv_nsec = 0;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+
+    /* count the samples, the older ones are overwritten */
+    while (dmn_usage_read(u, &samples, &sample, 1) == 1);
+    overhead = dmn_usage_overhead(u);
+    elapsed = bench_now_ns() - start;
+    dmn_usage_close(u);
+
+    snprintf(name, sizeof(name), "%u ms%s", period_ms, flags & DMN_USAGE_PSS ? " (PSS)" : "");
+    printf("%-28s samples=%-8llu cpu=%8.3f%%  per sample=%8.2f us\n", name,
+           (unsigned long long)samples, overhead * 100.0 / elapsed,
+           samples > 0 ? overhead / 1e3 / samples : 0.0);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t size;
+    char *mem;
+    const char *p;
+    int result;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:d:m:f:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p':
+                periods = optarg;
+                break;
+            case 'd':
+                duration = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                resident_mb = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                pid_file_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-p PERIOD_MS,...] [-d SECONDS] [-m MB] [-f PID-FILE]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (duration == 0)
+    {
+        fprintf(stderr, "Invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+
+    /* the resident memory of the "daemon", PSS costs more for more pages */
+    size = resident_mb << 20;
+    if (size > 0)
+    {
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+        {
+            perror("mmap");
+            return EXIT_FAILURE;
+        }
+        memset(mem, 1, size);
+    }
+
+    /* the sampler files are created by the process which holds the PID-file */
+    result = acquirepidfile(pid_file_path);
+    if (result != 0)
+    {
+        fprintf(stderr, "Cannot lock the PID-file: %s\n", result == -2 ? "locked" : strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu MB resident, %u seconds per run\n", resident_mb, duration);
+    for (p = periods; *p != '\0'; )
+    {
+        char *end;
+        unsigned period_ms = (unsigned)strtoul(p, &end, 10);
+
+        if (end == p || period_ms == 0 ||
+            run_sampler(period_ms, DMN_USAGE_DEFAULT) == -1 ||
+            run_sampler(period_ms, DMN_USAGE_PSS) == -1)
+        {
+            perror("Sampling failed");
+            releasepidfile();
+            return EXIT_FAILURE;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    releasepidfile();
+    return EXIT_SUCCESS;
+}
+#else
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "This program contains Linux specific code. Exiting...\n");
+    return EXIT_FAILURE;
+}
+#endif /* __linux__ */
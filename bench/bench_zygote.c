@@ -0,0 +1,407 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Fork-server (zygote) benchmark.
+
+The instance initialization consists of the program loading and the
+warmup of a table filled with computed values. The benchmark measures
+the time from the launch request until the instance is ready in two
+ways:
+
+cold   - the instance is started with rundaemon() and executes the
+         program, which builds the table;
+zygote - the instance is forked by a template daemon (see dmn_zygote.h)
+         which has built the table once, the instance shares it
+         copy-on-write.
+
+In both cases the instance receives the write end of a pipe and writes
+a byte to it when it is ready, then it runs until SIGTERM arrives.
+
+Usage: bench_zygote [-n LAUNCHES] [-m MB] [-p PID-FILE]
+*/
+
+#define _GNU_SOURCE /* pipe2() */
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#ifdef __linux__
+#include <stdint.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+
+#include "../daemonize.h"
+#include "../dmn_zygote.h"
+#include "bench.h"
+
+static const char *pid_file_path = "/tmp/bench_zygote.pid";
+static char instance_pid_file_path[PATH_MAX];
+static size_t launches = 50;
+static size_t state_mb = 64;
+
+/* the warmed state */
+static uint64_t *state;
+
+/* the value of the state word */
+static uint64_t state_value(uint64_t i)
+{
+    /* splitmix64 */
+    uint64_t z = i + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/* the expensive initialization */
+static int init_state(void)
+{
+    size_t words = (state_mb << 20) / sizeof(uint64_t);
+    size_t i;
+
+    state = malloc(words * sizeof(uint64_t));
+    if (state == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < words; i++)
+    {
+        state[i] = state_value(i);
+    }
+    return 0;
+}
+
+/* notify the starting process (the state is used to produce the byte) and wait for SIGTERM */
+static void serve(int ready_fd)
+{
+    char b = (char)('A' + state[state_mb] % 26);
+    sigset_t mask;
+    int sig;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    write(ready_fd, &b, 1);
+    close(ready_fd);
+    sigwait(&mask, &sig);
+}
+
+/*
+* Cold launch
+*/
+
+/* the executed program (-I option) */
+static int cold_instance(int ready_fd)
+{
+    if (init_state() == -1)
+    {
+        return EXIT_FAILURE;
+    }
+
+    serve(ready_fd);
+    return EXIT_SUCCESS;
+}
+
+/* the daemon body, udata points to the write end of the readiness pipe */
+static int cold_daemon(void *udata)
+{
+    int ready_fd = *(int *)udata;
+    char fd_str[32], mb_str[32];
+    char *argv[] = {"bench_zygote", "-I", fd_str, "-m", mb_str, NULL};
+
+    snprintf(fd_str, sizeof(fd_str), "%d", ready_fd);
+    snprintf(mb_str, sizeof(mb_str), "%zu", state_mb);
+
+    /* the pipe is passed to the executed program */
+    fcntl(ready_fd, F_SETFD, 0);
+    execv("/proc/self/exe", argv);
+    return 127;
+}
+
+static int cold_launch(uint64_t *sample)
+{
+    uint64_t start = bench_now_ns();
+    int exit_code = 0;
+    int ready[2];
+    int result;
+    pid_t pid;
+
+    if (pipe2(ready, O_CLOEXEC) == -1)
+    {
+        return -1;
+    }
+
+    fflush(stdout);
+    pid = rundaemon(DMN_NO_CLOSE | DMN_KEEP_PID_FILE_ON_EXEC, cold_daemon, &ready[1],
+                    &exit_code, instance_pid_file_path);
+    if (pid == 0)
+    {
+        exit(exit_code); /* exec() has failed */
+    }
+    close(ready[1]);
+
+    result = pid > 0 ? bench_wait_ready(ready[0]) : -1;
+    *sample = bench_now_ns() - start;
+    close(ready[0]);
+
+    if (pid > 0)
+    {
+        /* the executed program does not remove the PID-file */
+        bench_stop_process(pid, SIGTERM);
+        unlink(instance_pid_file_path);
+    }
+    return result;
+}
+
+/*
+* Zygote launch
+*/
+
+/* the instance body, the first passed descriptor is the readiness pipe */
+static int zygote_instance(void *udata, const struct dmn_zygote_instance *inst)
+{
+    (void)udata;
+
+    if (inst->nfds < 1)
+    {
+        return EXIT_FAILURE;
+    }
+
+    serve(inst->fds[0]);
+    return EXIT_SUCCESS;
+}
+
+/* the template daemon body, udata points to the write end of the readiness pipe */
+static int template_daemon(void *udata)
+{
+    int ready_fd = *(int *)udata;
+    struct dmn_zygote *z;
+    struct pollfd pfd[2];
+    sigset_t mask;
+    int sigfd;
+    char b;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1 ||
+        (sigfd = signalfd(-1, &mask, SFD_CLOEXEC)) == -1)
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (init_state() == -1 ||
+        (z = dmn_zygote_open(pid_file_path, DMN_ZYGOTE_DEFAULT, zygote_instance, NULL)) == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    b = 'R';
+    write(ready_fd, &b, 1);
+    close(ready_fd);
+
+    pfd[0].fd = sigfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = dmn_zygote_fd(z);
+    pfd[1].events = POLLIN;
+    for (;;)
+    {
+        if (poll(pfd, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        if (pfd[0].revents != 0) /* SIGTERM */
+        {
+            break;
+        }
+
+        if (pfd[1].revents != 0 && dmn_zygote_process(z) == -1)
+        {
+            break;
+        }
+    }
+
+    dmn_zygote_close(z);
+    close(sigfd);
+    return EXIT_SUCCESS;
+}
+
+static pid_t start_template(void)
+{
+    int exit_code = 0;
+    int ready[2];
+    pid_t pid;
+
+    if (pipe2(ready, O_CLOEXEC) == -1)
+    {
+        perror("pipe");
+        return -1;
+    }
+
+    fflush(stdout);
+    pid = rundaemon(DMN_NO_CLOSE, template_daemon, &ready[1], &exit_code, pid_file_path);
+    switch (pid)
+    {
+        case -1:
+            perror("Cannot start the template");
+            break;
+        case -2:
+            fprintf(stderr, "The template is already running.\n");
+            pid = -1;
+            break;
+        case 0:
+            exit(exit_code);
+    }
+
+    close(ready[1]);
+    if (pid != -1 && bench_wait_ready(ready[0]) == -1)
+    {
+        fprintf(stderr, "The template has failed to start.\n");
+        bench_stop_process(pid, SIGTERM);
+        pid = -1;
+    }
+    close(ready[0]);
+    return pid;
+}
+
+static int zygote_launch(uint64_t *sample)
+{
+    uint64_t start = bench_now_ns();
+    int ready[2];
+    int result;
+    pid_t pid;
+
+    if (pipe2(ready, O_CLOEXEC) == -1)
+    {
+        return -1;
+    }
+
+    pid = dmn_zygote_spawn(pid_file_path, instance_pid_file_path, &ready[1], 1, NULL, 0);
+    close(ready[1]);
+
+    result = pid > 0 ? bench_wait_ready(ready[0]) : -1;
+    *sample = bench_now_ns() - start;
+    close(ready[0]);
+
+    if (pid > 0)
+    {
+        bench_stop_process(pid, SIGTERM);
+    }
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t *cold, *zygote;
+    int result = EXIT_SUCCESS;
+    int ready_fd = -1;
+    char name[64];
+    pid_t pid;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:m:p:I:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                launches = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                state_mb = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                pid_file_path = optarg;
+                break;
+            case 'I': /* internal: run as a cold instance */
+                ready_fd = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n LAUNCHES] [-m MB] [-p PID-FILE]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (ready_fd != -1)
+    {
+        return cold_instance(ready_fd);
+    }
+
+    if (launches == 0 || state_mb == 0)
+    {
+        fprintf(stderr, "Invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(instance_pid_file_path, sizeof(instance_pid_file_path),
+             "%s.instance", pid_file_path);
+
+    cold = calloc(launches, sizeof(*cold));
+    zygote = calloc(launches, sizeof(*zygote));
+    if (cold == NULL || zygote == NULL)
+    {
+        perror("Initialization failed");
+        return EXIT_FAILURE;
+    }
+
+    pid = start_template();
+    if (pid == -1)
+    {
+        return EXIT_FAILURE;
+    }
+
+    /* the series are not interleaved: the teardown of the cold
+       instances (done by init) would disturb the zygote launches */
+    for (i = 0; i < launches && result == EXIT_SUCCESS; i++)
+    {
+        if (cold_launch(&cold[i]) == -1)
+        {
+            perror("Cold launch failed");
+            result = EXIT_FAILURE;
+        }
+    }
+
+    for (i = 0; i < launches && result == EXIT_SUCCESS; i++)
+    {
+        if (zygote_launch(&zygote[i]) == -1)
+        {
+            perror("Zygote launch failed");
+            result = EXIT_FAILURE;
+        }
+    }
+
+    if (result == EXIT_SUCCESS)
+    {
+        snprintf(name, sizeof(name), "cold rundaemon (%zu MB)", state_mb);
+        bench_report(name, cold, launches);
+        snprintf(name, sizeof(name), "zygote (%zu MB)", state_mb);
+        bench_report(name, zygote, launches);
+    }
+
+    bench_stop_process(pid, SIGTERM);
+    free(cold);
+    free(zygote);
+    return result;
+}
+#else
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "This program contains Linux specific code. Exiting...\n");
+    return EXIT_FAILURE;
+}
+#endif /* __linux__ */
@@ -35,7 +35,7 @@ LD = $(CXX)
 else
 LD = $(CC)
 endif
-LDFLAGS_COMMON = -Wl,--gc-sections
+LDFLAGS_COMMON = -pthread -Wl,--gc-sections
 # assembler
 AS = as
 # lib archiever
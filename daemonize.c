@@ -7,6 +7,9 @@ See the LICENSE.txt for details about the terms of use.
 */
 
 #ifndef _WIN32
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* F_OFD_SETLK */
+#endif
 #include <unistd.h>
 
 #include <stddef.h>
@@ -15,16 +18,35 @@ See the LICENSE.txt for details about the terms of use.
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
-
+#include <time.h>
 
 #include <fcntl.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <dirent.h>
+
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <linux/sched.h> /* struct clone_args, CLONE_INTO_CGROUP */
+#if defined(SYS_clone3) && defined(CLONE_INTO_CGROUP)
+#define HAVE_CLONE_INTO_CGROUP
+#endif
+#endif /* __linux__ */
 
 #include "daemonize.h"
 
+/* the cgroup placement state, see rundaemon_cgroup() */
+struct placement {
+    int cgroup_fd;
+    int required;
+#ifdef __linux__
+    struct dmn_cgroup_placement result;
+#endif
+};
+
 
 /* utilities to write and read error code from pipe */
 static void write_code(int fd, int code)
@@ -52,8 +74,93 @@ static pid_t read_pid(int fd)
     return pid;
 }
 
+#ifdef __linux__
+/* utilities to write and read the cgroup placement from pipe */
+static void write_placement(int fd, const struct dmn_cgroup_placement *result)
+{
+    write(fd, (const void *)result, sizeof(*result));
+}
+
+static void read_placement(int fd, struct dmn_cgroup_placement *result)
+{
+    if (read(fd, (void *)result, sizeof(*result)) != sizeof(*result))
+    {
+        result->result = DMN_CGROUP_NONE;
+        result->error = EPROTO;
+    }
+}
+
+/*
+  Put the first child into the cgroup, so that the daemon is born there.
+  Returns -1 if the placement is required but it has failed.
+*/
+static int enter_cgroup(struct placement *pl)
+{
+    int saved_errno;
+    int fd;
+#ifdef HAVE_CLONE_INTO_CGROUP
+    struct clone_args args;
+    pid_t pid;
+    int status;
+
+    memset(&args, 0, sizeof(args));
+    args.flags = CLONE_INTO_CGROUP;
+    args.exit_signal = SIGCHLD;
+    args.cgroup = (uint64_t)pl->cgroup_fd;
+
+    /* The created process replaces the first child. The C library is
+       not aware of the processes created by the raw clone3() (e.g. the
+       cached thread ID is not updated), so the process only makes the
+       plain system calls: setsid(), fork(), write(), close() and _exit().
+       The daemon is created by fork(), which sets the thread ID of the
+       new process, so it is a complete process as usual.
+
+       The first child reaps the created process before it exits.
+       Otherwise the created process would be reparented to the
+       subreaper (e.g. the caller is a dmn_spawn.h spawner) or to init,
+       and become a zombie which nobody waits for. */
+    pid = (pid_t)syscall(SYS_clone3, &args, sizeof(args));
+    if (pid == 0)
+    {
+        pl->result.result = DMN_CGROUP_CLONED;
+        return 0;
+    }
+    else if (pid > 0)
+    {
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+        _exit(0);
+    }
+    pl->result.error = errno;
+#endif
+
+    /* Move the first child, the migration is more expensive, but it
+       still happens before the daemon is created. */
+    fd = openat(pl->cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    if (fd != -1)
+    {
+        if (write(fd, "0", 1) == 1)
+        {
+            close(fd);
+            pl->result.result = DMN_CGROUP_ATTACHED;
+            return 0;
+        }
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+    pl->result.error = errno;
+
+    if (pl->required)
+    {
+        errno = pl->result.error;
+        return -1;
+    }
+    return 0;
+}
+#endif /* __linux__ */
+
 /* the actual function which performs forking */
-static pid_t doublefork(int *pipefd)
+static pid_t doublefork(int *pipefd, struct placement *pl)
 {
     pid_t pid;
 
@@ -67,6 +174,16 @@ static pid_t doublefork(int *pipefd)
         case 0:  /* first  child */
             close(pipefd[0]); /* close read side of the pipe */
 
+#ifdef __linux__
+            /* enter the cgroup, the daemon inherits it */
+            if (pl != NULL && enter_cgroup(pl) == -1)
+            {
+                write_code(pipefd[1], errno);
+                close(pipefd[1]);
+                return -1;
+            }
+#endif
+
             /* create session */
             if (setsid() == -1) /* error */
             {
@@ -88,11 +205,20 @@ static pid_t doublefork(int *pipefd)
                     write_code(pipefd[1], 0);
                     /* write daemon process PID back to the first parent */
                     write_pid(pipefd[1], getpid());
+#ifdef __linux__
+                    if (pl != NULL)
+                    {
+                        write_placement(pipefd[1], &pl->result);
+                        close(pl->cgroup_fd);
+                    }
+#endif
                     close(pipefd[1]);
                     return 0;
                     break;
                 default: /* second parent */
-                    exit(0);
+                    /* do not run the atexit() handlers and do not flush
+                       the stdio buffers of the starting process twice */
+                    _exit(0);
                     break;
             }
             break;
@@ -111,6 +237,12 @@ static pid_t doublefork(int *pipefd)
             if (code == 0)
             {
                 pid = read_pid(pipefd[0]);
+#ifdef __linux__
+                if (pl != NULL)
+                {
+                    read_placement(pipefd[0], &pl->result);
+                }
+#endif
             }
 
             /* close read end of the pipe */
@@ -162,7 +294,8 @@ static int redirect_fds(void)
     return 0;
 }
 
-pid_t daemonize(int flags)
+/* daemonize process, keep_fd is not closed, pl might be NULL */
+static pid_t daemonize_keep_fd(int flags, int keep_fd, struct placement *pl)
 {
     pid_t pid = -1;
     int pipefd[2] = {0};
@@ -170,7 +303,7 @@ pid_t daemonize(int flags)
     sigset_t sigset;
     int i;
 
-    /* close all open files, except stdin, stdout, stderr */
+    /* close all open files, except stdin, stdout, stderr and keep_fd */
     if (!(flags & DMN_NO_CLOSE))
     {
         memset(&rl, 0, sizeof(rl));
@@ -181,7 +314,10 @@ pid_t daemonize(int flags)
 
         for (i = 3; i < rl.rlim_cur; i++)
         {
-            close(i);
+            if (i != keep_fd && (pl == NULL || i != pl->cgroup_fd))
+            {
+                close(i);
+            }
         }
     }
 
@@ -222,7 +358,7 @@ pid_t daemonize(int flags)
 
     /* make double fork - daemonize */
     /* it will also close pipes when appropriately */
-    if ((pid = doublefork(pipefd)) < 0)
+    if ((pid = doublefork(pipefd, pl)) < 0)
     {
         return -1;
     }
@@ -266,63 +402,193 @@ pid_t daemonize(int flags)
     return pid;
 }
 
-/* check if daemon already running */
-static int check_pid_file(const char *pid_file_path)
+pid_t daemonize(int flags)
+{
+    return daemonize_keep_fd(flags, -1, NULL);
+}
+
+/*
+  Open file description locks are associated with the open file rather
+  than with the process, so they are inherited over fork() and survive
+  the double fork. Thus, the PID-file might be locked before
+  daemonization and there is no window in which two daemons could
+  start simultaneously. Traditional record locks are used on the systems
+  which do not support them.
+*/
+#ifdef F_OFD_SETLK
+#define PID_FILE_SETLK F_OFD_SETLK
+#else
+#define PID_FILE_SETLK F_SETLK
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+/*
+  Open and lock PID file. Returns the file descriptor, -2 if the file is
+  locked by another process, or -1 on error.
+*/
+static int lock_pid_file(const char *pid_file_path)
 {
     struct flock fl;
+    struct stat fd_st, path_st;
+    mode_t mask = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH; /* -rw-r--r-- */
+    int saved_errno;
     int fd = -1;
 
-    /* try to open file */
-    fd = open(pid_file_path, O_RDWR);
-    if (fd == -1)
+    for (;;)
     {
-        if (errno == ENOENT) /* file does not exist */
+        /* open or create file */
+        fd = open(pid_file_path, O_RDWR | O_CREAT | O_CLOEXEC, mask);
+        if (fd == -1)
         {
-            errno = 0;
-            return 0;
+            return -1;
         }
-        return 1;
-    }
 
-    /* set locking parameters */
-    memset(&fl, 0, sizeof(fl));
-    fl.l_type = F_WRLCK;
-    fl.l_whence = SEEK_SET;
-    fl.l_start = 0;
-    fl.l_len = 0;
-    fl.l_pid = getpid();
+        /* set locking parameters */
+        memset(&fl, 0, sizeof(fl));
+        fl.l_type = F_WRLCK;
+        fl.l_whence = SEEK_SET;
+        fl.l_start = 0;
+        fl.l_len = 0;
+        fl.l_pid = 0; /* must be 0 for open file description locks */
 
-    if (fcntl(fd, F_SETLK, &fl) == -1)
-    {
-        close(fd);
+        if (fcntl(fd, PID_FILE_SETLK, &fl) == -1)
+        {
+            saved_errno = errno;
+            close(fd);
 
-        /* file is locked by another process */
-        if (errno == EAGAIN || errno == EACCES)
+            /* file is locked by another process */
+            if (saved_errno == EAGAIN || saved_errno == EACCES)
+            {
+                return -2;
+            }
+            errno = saved_errno;
+            return -1;
+        }
+
+        /* The exiting daemon removes the file before releasing the
+           lock, so make sure that the locked file is still the one
+           which is reachable by the path, otherwise try again. */
+        if (fstat(fd, &fd_st) == -1)
         {
+            saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
             return -1;
         }
-        return 1;
+
+        if (stat(pid_file_path, &path_st) == 0)
+        {
+            if (fd_st.st_dev == path_st.st_dev && fd_st.st_ino == path_st.st_ino)
+            {
+                break;
+            }
+        }
+        else if (errno != ENOENT)
+        {
+            saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+
+        close(fd);
+    }
+
+    /* remove the PID of the previous instance */
+    if (ftruncate(fd, 0) == -1)
+    {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
     }
 
-    /* unlock */
+    return fd;
+}
+
+/* the PID-file held by the daemon process, see releasepidfile() */
+static int daemon_pid_file_fd = -1;
+static char *daemon_pid_file_path = NULL; /* a copy */
+static pid_t daemon_pid_file_owner = -1; /* the process which has locked it */
+
+/* write PID into the locked PID file */
+static int write_pid_file(int fd, pid_t pid)
+{
+    char pid_str[64] = {0};
+    int pid_str_len;
+
+    /* get PID as string */
+    pid_str_len = snprintf(pid_str, sizeof(pid_str), "%ld", (long)pid);
+
+    /* The PID is written by both the starting process and the daemon,
+       the data are the same, so the order does not matter. */
+    if (pwrite(fd, &pid_str[0], pid_str_len, 0) != pid_str_len)
+    {
+        return -1;
+    }
+
+    /* the file might contain a longer PID */
+    return ftruncate(fd, pid_str_len);
+}
+
+/*
+  Make the PID-file lock survive exec() in the daemon.
+  Returns 0 on success or -1 on error.
+*/
+static int keep_pid_file_on_exec(int fd)
+{
+#ifdef F_OFD_SETLK
+    /*
+      The open file description is shared with the children of the
+      executed program, which could keep the file locked after the daemon
+      exits. Replace the lock with a record lock which belongs to the
+      daemon process only. The first byte stays locked until the rest of
+      the file is locked again, so the file is never unlocked in between.
+      Note that the record locks are released when any descriptor of the
+      file is closed, so the same descriptor is used.
+    */
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
     fl.l_type = F_UNLCK;
-    if (fcntl(fd, F_SETLK, &fl) == -1)
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 1;
+    fl.l_len = 0;
+    fl.l_pid = 0;
+    if (fcntl(fd, F_OFD_SETLK, &fl) == -1)
     {
-        return 1;
+        return -1;
     }
 
-    /* close  file */
-    close(fd);
+    fl.l_type = F_WRLCK;
+    if (fcntl(fd, F_SETLK, &fl) == -1)
+    {
+        return -1;
+    }
 
-    return 0;
+    fl.l_type = F_UNLCK;
+    fl.l_start = 0;
+    fl.l_len = 1;
+    if (fcntl(fd, F_OFD_SETLK, &fl) == -1)
+    {
+        return -1;
+    }
+#endif
+    /* record locks belong to the process and are kept over exec() */
+    return fcntl(fd, F_SETFD, 0);
 }
 
-pid_t rundaemon(int flags, int (*daemon_func)(void *), void *udata, int *exit_code, const char *pid_file_path)
+/* rundaemon() with optional cgroup placement, pl might be NULL */
+static pid_t run_daemon(int flags, int (*daemon_func)(void *), void *udata, int *exit_code,
+                        const char *pid_file_path, struct placement *pl)
 {
     pid_t pid;
     int pid_file_fd = -1;
-    struct flock fl;
     int daemon_exit_code;
+    int saved_errno;
 
     /* validate arguments */
     if (daemon_func == NULL)
@@ -331,78 +597,95 @@ pid_t rundaemon(int flags, int (*daemon_func)(void *), void *udata, int *exit_co
         return -1;
     }
 
-    /* check PID file */
+    /* lock PID file */
     if (pid_file_path != NULL && *pid_file_path)
     {
-        int status = check_pid_file(pid_file_path);
-        if (status == -1)
+        pid_file_fd = lock_pid_file(pid_file_path);
+        if (pid_file_fd == -2)
         {
             errno = 0;
             return -2; /* the daemon instance seems to be running */
         }
-        else if (status == 1)
+        else if (pid_file_fd == -1)
         {
             return -1; /* internal error */
         }
     }
 
+#ifndef F_OFD_SETLK
+    /* The lock is not inherited by the daemon: release
+       it and lock the file again in the daemon process. */
+    if (pid_file_fd != -1)
+    {
+        close(pid_file_fd);
+        pid_file_fd = -1;
+    }
+#endif
+
     /* daemonize process */
-    pid = daemonize(flags);
+    pid = daemonize_keep_fd(flags, pid_file_fd, pl);
     if (pid == -1) /* error during process daemonization */
     {
+        if (pid_file_fd != -1)
+        {
+            saved_errno = errno;
+            close(pid_file_fd);
+            errno = saved_errno;
+        }
         return -1;
     }
 
     if (pid != 0) /* return - this is the process which starts daemon */
     {
+        if (pid_file_fd != -1)
+        {
+            /* The PID-file is complete when rundaemon() returns. It is
+               written by the daemon too, so an error is not fatal here. */
+            write_pid_file(pid_file_fd, pid);
+            /* the lock is held by the daemon's descriptor */
+            close(pid_file_fd);
+        }
         return pid;
     }
 
-    /* create PID file */
+    /* finish PID file creation */
     if (pid_file_path != NULL && *pid_file_path)
     {
-        char pid_str[64] = {0};
-        int pid_str_len;
-        mode_t mask;
-
-        /* get PID as string */
-        pid_str_len = snprintf(pid_str, sizeof(pid_str), "%ld", (long)getpid());
-
-        /* remove old PID file */
-        if (access(pid_file_path, F_OK) != -1)
+#ifndef F_OFD_SETLK
+        pid_file_fd = lock_pid_file(pid_file_path);
+        if (pid_file_fd == -2)
         {
-            unlink(pid_file_path);
-            errno = 0;
+            errno = EAGAIN;
+            return -1;
         }
-
-        /* create new PID file */
-        mask = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH; /* -rw-r--r-- */
-        pid_file_fd = open(pid_file_path, O_RDWR | O_CREAT, mask);
-        if (pid_file_fd == -1)
+        else if (pid_file_fd == -1)
         {
             return -1;
         }
-
+#endif
         /* write PID */
-        if (write(pid_file_fd, &pid_str[0], pid_str_len) == -1)
+        if (write_pid_file(pid_file_fd, getpid()) == -1)
         {
+            close(pid_file_fd);
             return -1;
         }
 
-        /* set locking parameters */
-        memset(&fl, 0, sizeof(fl));
-        fl.l_type = F_WRLCK;
-        fl.l_whence = SEEK_SET;
-        fl.l_start = 0;
-        fl.l_len = 0;
-        fl.l_pid = getpid();
+        /* let the program which the daemon executes hold the lock */
+        if ((flags & DMN_KEEP_PID_FILE_ON_EXEC) &&
+            keep_pid_file_on_exec(pid_file_fd) == -1)
+        {
+            close(pid_file_fd);
+            return -1;
+        }
 
-        /* lock file */
-        if (fcntl(pid_file_fd, F_SETLK, &fl) == -1)
+        daemon_pid_file_path = strdup(pid_file_path);
+        if (daemon_pid_file_path == NULL)
         {
             close(pid_file_fd);
             return -1;
         }
+        daemon_pid_file_fd = pid_file_fd;
+        daemon_pid_file_owner = getpid();
     }
 
     /* run daemon code */
@@ -412,20 +695,298 @@ pid_t rundaemon(int flags, int (*daemon_func)(void *), void *udata, int *exit_co
         *exit_code = daemon_exit_code; /* save exit code */
     }
 
-    /* remove PID file */
-    if (pid_file_path != NULL && *pid_file_path)
-    {
-        /* unlock */
-        fl.l_type = F_UNLCK;
-        fcntl(pid_file_fd, F_SETLK, &fl);
+    /* remove PID file (unless it has been released by the daemon) */
+    releasepidfile();
 
-        /* close PID-file */
-        close(pid_file_fd);
-        /* remove file */
-        unlink(pid_file_path);
+    return pid;
+}
+
+pid_t rundaemon(int flags, int (*daemon_func)(void *), void *udata, int *exit_code, const char *pid_file_path)
+{
+    return run_daemon(flags, daemon_func, udata, exit_code, pid_file_path, NULL);
+}
+
+#ifdef __linux__
+pid_t rundaemon_cgroup(int flags, int (*daemon_func)(void *), void *udata, int *exit_code,
+                       const char *pid_file_path, int cgroup_fd,
+                       struct dmn_cgroup_placement *placement)
+{
+    struct placement pl;
+    pid_t pid;
+
+    memset(&pl, 0, sizeof(pl));
+    pl.cgroup_fd = cgroup_fd;
+    pl.required = (flags & DMN_CGROUP_REQUIRED) != 0;
+    pl.result.result = DMN_CGROUP_NONE;
+    pl.result.error = 0;
+
+    if (cgroup_fd == -1)
+    {
+        if (pl.required)
+        {
+            errno = EBADF;
+            return -1;
+        }
+        pid = run_daemon(flags, daemon_func, udata, exit_code, pid_file_path, NULL);
+    }
+    else
+    {
+        pid = run_daemon(flags, daemon_func, udata, exit_code, pid_file_path, &pl);
     }
 
+    if (placement != NULL)
+    {
+        *placement = pl.result;
+    }
     return pid;
 }
+#endif /* __linux__ */
+
+int releasepidfile(void)
+{
+    if (daemon_pid_file_fd == -1)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    /* remove file while it is still locked */
+    unlink(daemon_pid_file_path);
+    /* close PID-file, this releases the lock */
+    close(daemon_pid_file_fd);
+
+    free(daemon_pid_file_path);
+
+    daemon_pid_file_fd = -1;
+    daemon_pid_file_path = NULL;
+    return 0;
+}
+
+#ifdef __linux__
+#define FD_DIR_PATH "/proc/self/fd"
+#else
+#define FD_DIR_PATH "/dev/fd"
+#endif
+
+/*
+  Find the PID-file descriptor inherited over exec() (see
+  keep_pid_file_on_exec()) and make sure that the calling process holds
+  the lock. Returns the descriptor, -2 if the file is locked by another
+  process, or -1 if there is no such descriptor.
+*/
+static int adopt_pid_file(const char *pid_file_path)
+{
+    struct stat path_st, fd_st;
+    struct dirent *entry;
+    struct flock fl;
+    DIR *dir;
+    int found = -1;
+
+    if (stat(pid_file_path, &path_st) == -1 || (dir = opendir(FD_DIR_PATH)) == NULL)
+    {
+        return -1;
+    }
+
+    while (found == -1 && (entry = readdir(dir)) != NULL)
+    {
+        int fd = atoi(entry->d_name);
+
+        if (entry->d_name[0] != '.' && fd != dirfd(dir) && fstat(fd, &fd_st) == 0 &&
+            fd_st.st_dev == path_st.st_dev && fd_st.st_ino == path_st.st_ino)
+        {
+            found = fd;
+        }
+    }
+    closedir(dir);
+
+    if (found == -1)
+    {
+        return -1;
+    }
+
+    /* Record locks of the process do not conflict with each other, so
+       this succeeds if the process already holds the lock. Note that
+       closing any other descriptor of the file would release it. */
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 0;
+    fl.l_len = 0;
+    if (fcntl(found, F_SETLK, &fl) == -1)
+    {
+        return -2;
+    }
+
+    return found;
+}
+
+int acquirepidfile(const char *pid_file_path)
+{
+    char *path;
+    int fd = -1;
+
+    /* validate arguments */
+    if (pid_file_path == NULL || *pid_file_path == '\0')
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Only one PID-file is held by a process. Taking another one would
+       leave the first file unlocked, but still on the disk. */
+    if (daemon_pid_file_fd != -1 && daemon_pid_file_owner == getpid())
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    /* the program executed by the daemon (see DMN_KEEP_PID_FILE_ON_EXEC) */
+    if (daemon_pid_file_fd == -1)
+    {
+        fd = adopt_pid_file(pid_file_path);
+    }
+
+    if (fd == -1)
+    {
+        fd = lock_pid_file(pid_file_path);
+    }
+
+    if (fd == -2)
+    {
+        errno = 0;
+        return -2; /* the file is held by another process */
+    }
+    else if (fd == -1)
+    {
+        return -1;
+    }
+
+    path = strdup(pid_file_path);
+    if (path == NULL || write_pid_file(fd, getpid()) == -1)
+    {
+        int saved_errno = errno;
+        free(path);
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    /* The PID-file inherited from the parent (which is forked from a
+       daemon) is closed, not removed: the lock belongs to the parent. */
+    if (daemon_pid_file_fd != -1)
+    {
+        close(daemon_pid_file_fd);
+        free(daemon_pid_file_path);
+    }
+
+    daemon_pid_file_fd = fd;
+    daemon_pid_file_path = path;
+    daemon_pid_file_owner = getpid();
+    return 0;
+}
+
+/*
+  Read the PID of the daemon which holds the PID-file. Returns the PID,
+  0 if the file is not locked, or -1 on error (EAGAIN if the file is
+  locked, but the PID has not been written yet).
+*/
+static pid_t read_pid_file(const char *pid_file_path)
+{
+    char pid_str[64] = {0};
+    struct flock fl;
+    ssize_t len;
+    long pid;
+    int fd = -1;
+
+    /* try to open file */
+    fd = open(pid_file_path, O_RDONLY);
+    if (fd == -1)
+    {
+        if (errno == ENOENT) /* file does not exist */
+        {
+            errno = 0;
+            return 0;
+        }
+        return -1;
+    }
+
+    /* test if the file is locked without taking the lock */
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 0;
+    fl.l_len = 0;
+
+    if (fcntl(fd, F_GETLK, &fl) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (fl.l_type == F_UNLCK) /* stale PID file */
+    {
+        close(fd);
+        errno = 0;
+        return 0;
+    }
+
+    /* read PID */
+    len = read(fd, &pid_str[0], sizeof(pid_str) - 1);
+    close(fd);
+    if (len == -1)
+    {
+        return -1;
+    }
+
+    pid = strtol(&pid_str[0], NULL, 10);
+    if (pid <= 0)
+    {
+        /* the PID has not been written yet, ask the lock owner */
+        if (fl.l_pid <= 0)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        pid = fl.l_pid;
+    }
+
+    errno = 0;
+    return (pid_t)pid;
+}
+
+/* how long to wait for the PID of a starting daemon */
+#define PID_WAIT_ATTEMPTS 100
+#define PID_WAIT_INTERVAL_NS 1000000 /* 1 ms */
+
+pid_t checkdaemon(const char *pid_file_path)
+{
+    struct timespec ts;
+    pid_t pid;
+    int attempt;
+
+    /* validate arguments */
+    if (pid_file_path == NULL || *pid_file_path == '\0')
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* The PID-file is empty from the moment it is locked until the PID
+       is written. For rundaemon() it takes two fork() calls, and the
+       owner of an open file description lock is not reported (l_pid is
+       -1), so wait for the PID a little. */
+    for (attempt = 0; ; attempt++)
+    {
+        pid = read_pid_file(pid_file_path);
+        if (pid != -1 || errno != EAGAIN || attempt == PID_WAIT_ATTEMPTS)
+        {
+            return pid;
+        }
+
+        ts.tv_sec = 0;
+        ts.tv_nsec = PID_WAIT_INTERVAL_NS;
+        nanosleep(&ts, NULL);
+    }
+}
 
 #endif /* _WIN32 */
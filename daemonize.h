@@ -16,9 +16,26 @@ enum {
     DMN_NO_CLOSE = 1,     /* Do not close existing file descriptors and do not redirect standard file descriptors to '/dev/null'.  */
     DMN_KEEP_SIGNAL_HANDLERS = 2, /* Do not reset signal handlers to their defaults. */
     DMN_NO_CHDIR = 4,     /* Do not change the current directory of the daemon to '/'. */
-    DMN_NO_UMASK = 8      /* Do not set umask to 0. */
+    DMN_NO_UMASK = 8,     /* Do not set umask to 0. */
+    DMN_KEEP_PID_FILE_ON_EXEC = 16, /* Keep the PID-file descriptor (and the lock) open across exec() in the daemon. */
+    DMN_CGROUP_REQUIRED = 32 /* Fail instead of starting the daemon outside of the cgroup (see rundaemon_cgroup()). */
 };
 
+#ifdef __linux__
+/* The ways the daemon is placed into a cgroup, see rundaemon_cgroup(). */
+enum {
+    DMN_CGROUP_NONE = 0,    /* The daemon is started in the cgroup of the starting process. */
+    DMN_CGROUP_CLONED = 1,  /* The process which forks the daemon is created in the cgroup with clone3(CLONE_INTO_CGROUP). */
+    DMN_CGROUP_ATTACHED = 2 /* The process which forks the daemon is moved into the cgroup via "cgroup.procs". */
+};
+
+/* The cgroup placement reported by the daemon. */
+struct dmn_cgroup_placement {
+    int result; /* see above */
+    int error;  /* errno value of the last failed placement attempt or 0 */
+};
+#endif /* __linux__ */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -63,7 +80,10 @@ udata - pointer to be passed as the value in a call to daemon_func;
 exit_code - pointer to variable to receive value returned by daemon_func;
 pid_file_path - full pathname to the PID file. This file will be
 used for checking if the daemon is not already running (by checking if
-the file exists and locked) and will be created if not exists. On daemon exit
+the file exists and locked) and will be created if not exists. The file
+is locked before daemonization, so only one of the simultaneously started
+instances becomes a daemon, and it contains the daemon PID by the time
+rundaemon() returns to the starting process. On daemon exit
 this file will be removed under normal conditions.
 This value might be NULL, in this case no any checks performed and
 no file will be created.
@@ -76,6 +96,101 @@ return -2 to the process which starts the daemon. No daemonization
 will be performed in this case.
 */
 
+#ifdef __linux__
+extern pid_t rundaemon_cgroup(int flags,
+                              int (*daemon_func)(void *udata),
+                              void *udata,
+                              int *exit_code,
+                              const char *pid_file_path,
+                              int cgroup_fd,
+                              struct dmn_cgroup_placement *placement);
+/*
+* Description
+rundaemon_cgroup() - the same as rundaemon(), but the daemon is born in
+the given cgroup v2, so it never runs outside of the resource limits of
+the cgroup. The process which forks the daemon is created in the cgroup
+with clone3(CLONE_INTO_CGROUP). If it is not supported, that process
+moves itself into the cgroup before it forks the daemon. If both fail
+(e.g. the cgroup is not writable), the daemon is started in the cgroup
+of the starting process, unless DMN_CGROUP_REQUIRED is specified. The
+daemon reports the result to the starting process along with its PID.
+This function is Linux specific.
+
+* Arguments:
+flags, daemon_func, udata, exit_code, pid_file_path - see rundaemon();
+cgroup_fd - descriptor of the cgroup directory (see dmn_cgroup_open()
+in dmn_cgroup.h) or -1, in the latter case the function is equivalent
+to rundaemon(). The descriptor is closed in the daemon;
+placement - pointer to the structure to receive the placement result
+in the starting process, might be NULL.
+
+* Return value
+See rundaemon(). If DMN_CGROUP_REQUIRED is specified and the daemon
+cannot be placed into the cgroup, -1 is returned to the starting process
+and errno is set accordingly.
+*/
+#endif /* __linux__ */
+
+extern int releasepidfile(void);
+/*
+* Description
+releasepidfile() - remove and unlock the PID-file of the daemon before
+the daemon function returns. It should be called from the daemon
+process started with rundaemon(). After that another instance of the
+daemon (e.g. a successor which takes over the state of the daemon
+during a restart) might be started while this one is still running.
+rundaemon() does not touch the PID-file on the daemon exit in this case.
+
+* Return value
+0 on success or -1 if the daemon does not hold a PID-file. In the latter
+case errno will be set accordingly.
+*/
+
+extern int acquirepidfile(const char *pid_file_path);
+/*
+* Description
+acquirepidfile() - lock the PID-file and write the PID of the calling
+process into it, the same way rundaemon() does for the daemon. It is
+intended for the processes which are not started by rundaemon() (e.g.
+the instances forked by a daemon, see dmn_zygote.h). The file is held
+until releasepidfile() is called or the process exits; the latter
+leaves the (unlocked) file behind. If the calling process has inherited
+the PID-file of the daemon it is forked from, the inherited descriptor
+is closed, but the daemon's file is neither removed nor unlocked. The
+program executed by a daemon started with DMN_KEEP_PID_FILE_ON_EXEC
+adopts the inherited descriptor and the lock instead, so that it can
+release the file (e.g. during a handoff, see dmn_handoff.h). A process
+holds at most one PID-file: the function fails if the calling process
+holds one already (e.g. it is a daemon started with a PID-file).
+
+* Arguments:
+pid_file_path - full pathname to the PID-file.
+
+* Return value
+0 on success, -2 if the file is locked by another process or -1 on
+error (EBUSY if the calling process holds a PID-file already). In the
+latter case errno will be set accordingly.
+*/
+
+extern pid_t checkdaemon(const char *pid_file_path);
+/*
+* Description
+checkdaemon() - check if a daemon started by rundaemon() is running
+by examining its PID-file. The daemon is considered running only while
+the PID-file is locked, so a stale PID-file left after a crash is never
+reported as a running daemon. The PID of a daemon which is being
+started might not be written yet, in this case the function waits for
+it for up to 100 milliseconds.
+
+* Arguments:
+pid_file_path - full pathname to the PID-file (see rundaemon()).
+
+* Return value
+PID of the running daemon, 0 if the daemon is not running or -1 on
+error (EAGAIN if the PID has not been written in time). In the latter
+case errno will be set accordingly.
+*/
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,416 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+A header-only C++11 interface on top of daemonize() and rundaemon().
+*/
+
+#ifndef _DAEMONIZE_HPP
+#define _DAEMONIZE_HPP
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include "daemonize.h"
+
+namespace dmn {
+
+/*
+* Daemon creation policies
+
+Each policy corresponds to one of the DMN_* flags. The flags are
+combined and checked at compile time (an unknown or a repeated policy
+does not compile), e.g.:
+
+    dmn::run<dmn::no_chdir, dmn::no_umask>(body, "/tmp/example.pid");
+
+The resulting flags are passed to daemonize() and rundaemon() as a
+constant, the steps are still selected at run time by the library.
+*/
+struct no_close              { static constexpr int flag = DMN_NO_CLOSE; };
+struct keep_signal_handlers  { static constexpr int flag = DMN_KEEP_SIGNAL_HANDLERS; };
+struct no_chdir              { static constexpr int flag = DMN_NO_CHDIR; };
+struct no_umask              { static constexpr int flag = DMN_NO_UMASK; };
+struct keep_pid_file_on_exec { static constexpr int flag = DMN_KEEP_PID_FILE_ON_EXEC; };
+
+template <typename... Policies>
+struct flags;
+
+template <>
+struct flags<> {
+    static constexpr int value = DMN_DEFAULT;
+};
+
+template <typename Policy, typename... Policies>
+struct flags<Policy, Policies...> {
+    static_assert((Policy::flag & flags<Policies...>::value) == 0,
+                  "daemon creation policy is given twice");
+    static constexpr int value = Policy::flag | flags<Policies...>::value;
+};
+
+/*
+* Errors
+
+Errors are reported as std::error_code. System errors belong to
+std::system_category(), the library specific conditions are described
+by dmn::errc.
+*/
+enum class errc {
+    already_running = 1 /* the daemon instance seems to be running */
+};
+
+class error_category_impl : public std::error_category {
+public:
+    const char *name() const noexcept override
+    {
+        return "daemonize";
+    }
+
+    std::string message(int code) const override
+    {
+        switch (static_cast<errc>(code))
+        {
+            case errc::already_running:
+                return "daemon already running";
+        }
+        return "unknown error";
+    }
+};
+
+inline const std::error_category &error_category() noexcept
+{
+    static const error_category_impl category;
+    return category;
+}
+
+inline std::error_code make_error_code(errc e) noexcept
+{
+    return std::error_code(static_cast<int>(e), error_category());
+}
+
+inline std::error_code last_error() noexcept
+{
+    return std::error_code(errno, std::system_category());
+}
+
+} /* namespace dmn */
+
+namespace std {
+template <>
+struct is_error_code_enum<dmn::errc> : true_type {};
+} /* namespace std */
+
+namespace dmn {
+
+/*
+* result<T>
+
+An expected-style return value: either holds a value of T or an
+error code. T must be default constructible and movable.
+*/
+template <typename T>
+class result {
+public:
+    result(T value) : value_(std::move(value)) {}
+    result(std::error_code error) : error_(error) {}
+    result(errc error) : error_(make_error_code(error)) {}
+
+    bool has_value() const noexcept { return !error_; }
+    explicit operator bool() const noexcept { return has_value(); }
+
+    const std::error_code &error() const noexcept { return error_; }
+
+    /* throws std::system_error if there is no value */
+    T &value() &
+    {
+        check();
+        return value_;
+    }
+
+    const T &value() const &
+    {
+        check();
+        return value_;
+    }
+
+    T &&value() &&
+    {
+        check();
+        return std::move(value_);
+    }
+
+    T &operator*() & noexcept { return value_; }
+    const T &operator*() const & noexcept { return value_; }
+    T &&operator*() && noexcept { return std::move(value_); }
+    T *operator->() noexcept { return &value_; }
+    const T *operator->() const noexcept { return &value_; }
+
+private:
+    void check() const
+    {
+        if (error_)
+        {
+            throw std::system_error(error_);
+        }
+    }
+
+    T value_{};
+    std::error_code error_{};
+};
+
+/*
+* unique_fd
+
+A move-only owner of a file descriptor. The descriptor is closed on
+destruction.
+*/
+class unique_fd {
+public:
+    unique_fd() noexcept = default;
+    explicit unique_fd(int fd) noexcept : fd_(fd) {}
+    unique_fd(unique_fd &&other) noexcept : fd_(other.release()) {}
+    unique_fd(const unique_fd &) = delete;
+    unique_fd &operator=(const unique_fd &) = delete;
+    ~unique_fd() { reset(); }
+
+    unique_fd &operator=(unique_fd &&other) noexcept
+    {
+        reset(other.release());
+        return *this;
+    }
+
+    int get() const noexcept { return fd_; }
+    explicit operator bool() const noexcept { return fd_ != -1; }
+
+    int release() noexcept
+    {
+        int fd = fd_;
+        fd_ = -1;
+        return fd;
+    }
+
+    void reset(int fd = -1) noexcept
+    {
+        if (fd_ != -1)
+        {
+            ::close(fd_);
+        }
+        fd_ = fd;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+/* the read (first) and write (second) ends of a pipe */
+struct pipe_fds {
+    unique_fd read;
+    unique_fd write;
+};
+
+/* create a pipe, fd_flags (e.g. FD_CLOEXEC) are set on both ends */
+inline result<pipe_fds> make_pipe(int fd_flags = 0)
+{
+    int fds[2];
+    pipe_fds p;
+
+    if (::pipe(fds) == -1)
+    {
+        return last_error();
+    }
+    p.read.reset(fds[0]);
+    p.write.reset(fds[1]);
+
+    if (fd_flags != 0 &&
+        (::fcntl(fds[0], F_SETFD, fd_flags) == -1 ||
+         ::fcntl(fds[1], F_SETFD, fd_flags) == -1))
+    {
+        return last_error();
+    }
+
+    return p;
+}
+
+/*
+* pid_file
+
+A move-only owner of a locked PID-file for the daemons created with
+dmn::daemonize(). It is a handle of the PID-file acquired with
+acquirepidfile(), so a process holds at most one PID-file: create()
+fails with EBUSY while another pid_file object exists, or in a daemon
+started by dmn::run() with a PID-file, which manages it by itself. The
+file is unlocked and removed on destruction (see releasepidfile()).
+*/
+class pid_file {
+public:
+    pid_file() noexcept = default;
+    pid_file(pid_file &&other) noexcept : path_(std::move(other.path_))
+    {
+        other.path_.clear();
+    }
+    pid_file(const pid_file &) = delete;
+    pid_file &operator=(const pid_file &) = delete;
+    ~pid_file() { reset(); }
+
+    pid_file &operator=(pid_file &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            path_ = std::move(other.path_);
+            other.path_.clear();
+        }
+        return *this;
+    }
+
+    /* create, lock and write the current PID to the file, see acquirepidfile();
+       fails with EBUSY if the process holds a PID-file already */
+    static result<pid_file> create(const std::string &path)
+    {
+        pid_file file;
+
+        switch (::acquirepidfile(path.c_str()))
+        {
+            case -1:
+                return last_error();
+            case -2:
+                return errc::already_running;
+        }
+        /* the file belongs to us from now on */
+        file.path_ = path;
+        return file;
+    }
+
+    const std::string &path() const noexcept { return path_; }
+    explicit operator bool() const noexcept { return !path_.empty(); }
+
+    void reset() noexcept
+    {
+        if (!path_.empty())
+        {
+            ::releasepidfile();
+            path_.clear();
+        }
+    }
+
+private:
+    std::string path_;
+};
+
+/* the outcome of a successful dmn::run() */
+struct launch {
+    pid_t pid = -1;    /* daemon PID in the starting process, 0 in the daemon */
+    int exit_code = 0; /* value returned by the daemon body (in the daemon) */
+
+    bool is_daemon() const noexcept { return pid == 0; }
+};
+
+namespace detail {
+
+/* the daemon body may return int (exit code) or nothing */
+template <typename Func>
+int invoke(Func &func, std::true_type /* returns void */)
+{
+    func();
+    return 0;
+}
+
+template <typename Func>
+int invoke(Func &func, std::false_type /* returns int */)
+{
+    return static_cast<int>(func());
+}
+
+/* Adapts any callable to the rundaemon() interface without allocation.
+   An exception must not leave rundaemon(): the PID-file would not be
+   released, and the handler of the starting process would run in the
+   daemon. So the exception ends the daemon body with EXIT_FAILURE. */
+template <typename Func>
+int trampoline(void *udata) noexcept
+{
+    Func &func = *static_cast<Func *>(udata);
+    try
+    {
+        return invoke(func, std::is_void<decltype(func())>());
+    }
+    catch (...)
+    {
+        return EXIT_FAILURE;
+    }
+}
+
+} /* namespace detail */
+
+/*
+* daemonize<Policies...>()
+
+See daemonize(). Returns PID of the daemon to the starting process
+and 0 to the daemon.
+*/
+template <typename... Policies>
+inline result<pid_t> daemonize()
+{
+    pid_t pid = ::daemonize(flags<Policies...>::value);
+    if (pid == -1)
+    {
+        return last_error();
+    }
+    return pid;
+}
+
+/*
+* run<Policies...>(func, pid_file_path)
+
+See rundaemon(). The callable is invoked by reference in the daemon
+process, it should take no arguments and return int or void.
+The errc::already_running error is returned if the PID-file is locked.
+An exception thrown by the callable does not propagate out of run():
+it is caught in the daemon, and run() returns there with
+EXIT_FAILURE as the exit code, so the PID-file is still released. The
+callable should handle the exceptions it wants to report by itself.
+*/
+template <typename... Policies, typename Func>
+inline result<launch> run(Func &&func, const char *pid_file_path = nullptr)
+{
+    typedef typename std::remove_reference<Func>::type func_type;
+    launch l;
+
+    l.pid = ::rundaemon(flags<Policies...>::value,
+                        &detail::trampoline<func_type>,
+                        const_cast<void *>(static_cast<const void *>(std::addressof(func))),
+                        &l.exit_code,
+                        pid_file_path);
+    switch (l.pid)
+    {
+        case -1:
+            return last_error();
+        case -2:
+            return errc::already_running;
+    }
+
+    return l;
+}
+
+template <typename... Policies, typename Func>
+inline result<launch> run(Func &&func, const std::string &pid_file_path)
+{
+    return run<Policies...>(std::forward<Func>(func), pid_file_path.c_str());
+}
+
+} /* namespace dmn */
+
+#endif /* _WIN32 */
+
+#endif /* _DAEMONIZE_HPP */
@@ -0,0 +1,989 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+An optional header-only C++20 coroutine layer for writing daemon
+bodies: a single-threaded epoll(7) executor, awaitable file descriptor
+readiness, timers and signals. This header is Linux specific and
+requires -std=c++20, unlike daemonize.hpp.
+*/
+
+#ifndef _DAEMONIZE_CORO_HPP
+#define _DAEMONIZE_CORO_HPP
+
+#ifdef __linux__
+
+#if __cplusplus < 202002L
+#error "daemonize_coro.hpp requires C++20"
+#endif
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <new>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "daemonize.hpp"
+
+namespace dmn {
+namespace coro {
+
+/*
+* frame_pool
+
+Per-thread free lists of coroutine frames. The frame sizes are rounded
+up to the granularity; the frames up to max_pooled_size are kept after
+the coroutine finishes and reused by the next coroutine of the same
+size class, so a server in the steady state does not allocate memory
+for its coroutines. Larger frames are allocated with operator new.
+*/
+class frame_pool {
+public:
+    static constexpr std::size_t granularity = 64;
+    static constexpr std::size_t max_pooled_size = 16384;
+
+    static void *allocate(std::size_t size)
+    {
+        std::size_t cls = size_class(size);
+
+        if (cls >= classes)
+        {
+            return ::operator new(size);
+        }
+
+        frame_pool &pool = instance();
+        node *n = pool.free_[cls];
+        if (n != nullptr)
+        {
+            pool.free_[cls] = n->next;
+            return n;
+        }
+
+        return ::operator new((cls + 1) * granularity);
+    }
+
+    static void deallocate(void *ptr, std::size_t size) noexcept
+    {
+        std::size_t cls = size_class(size);
+
+        if (cls >= classes)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+
+        frame_pool &pool = instance();
+        node *n = static_cast<node *>(ptr);
+        n->next = pool.free_[cls];
+        pool.free_[cls] = n;
+    }
+
+    frame_pool(const frame_pool &) = delete;
+    frame_pool &operator=(const frame_pool &) = delete;
+
+private:
+    struct node {
+        node *next;
+    };
+
+    static constexpr std::size_t classes = max_pooled_size / granularity;
+
+    frame_pool() noexcept = default;
+
+    ~frame_pool()
+    {
+        for (node *&head : free_)
+        {
+            while (head != nullptr)
+            {
+                node *n = head;
+                head = n->next;
+                ::operator delete(n);
+            }
+        }
+    }
+
+    static std::size_t size_class(std::size_t size) noexcept
+    {
+        return size == 0 ? 0 : (size - 1) / granularity;
+    }
+
+    static frame_pool &instance() noexcept
+    {
+        thread_local frame_pool pool;
+        return pool;
+    }
+
+    node *free_[classes] = {};
+};
+
+template <typename T = void>
+class task;
+
+class executor;
+
+namespace detail {
+
+/* a link in the list of the tasks owned by an executor */
+struct task_node {
+    task_node *prev = nullptr;
+    task_node *next = nullptr;
+    std::coroutine_handle<> handle;
+
+    void link(task_node &head) noexcept
+    {
+        prev = &head;
+        next = head.next;
+        head.next->prev = this;
+        head.next = this;
+    }
+
+    void unlink() noexcept
+    {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = nullptr;
+    }
+};
+
+struct promise_base {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+    task_node node; /* linked if the task is owned by an executor */
+
+    /* the frames are taken from the pool */
+    static void *operator new(std::size_t size)
+    {
+        return frame_pool::allocate(size);
+    }
+
+    static void operator delete(void *ptr, std::size_t size) noexcept
+    {
+        frame_pool::deallocate(ptr, size);
+    }
+
+    /* the tasks are lazy: they start when awaited or spawned */
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            promise_base &p = h.promise();
+
+            /* resume the awaiting coroutine */
+            if (p.continuation)
+            {
+                return p.continuation;
+            }
+
+            /* a spawned task frees itself, like a detached thread */
+            if (p.node.next != nullptr)
+            {
+                if (p.exception)
+                {
+                    std::terminate();
+                }
+                p.node.unlink();
+                h.destroy();
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() noexcept
+    {
+        exception = std::current_exception();
+    }
+
+    void rethrow()
+    {
+        if (exception)
+        {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+template <typename T>
+struct promise : promise_base {
+    std::optional<T> value;
+
+    task<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U &&v)
+    {
+        value.emplace(std::forward<U>(v));
+    }
+
+    T result()
+    {
+        rethrow();
+        return std::move(*value);
+    }
+};
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result()
+    {
+        rethrow();
+    }
+};
+
+} /* namespace detail */
+
+/*
+* task<T>
+
+A lazily started coroutine which produces a value of T. It is started
+by co_await (the awaiting coroutine is resumed when the task finishes)
+or by executor::spawn().
+*/
+template <typename T>
+class [[nodiscard]] task {
+public:
+    typedef detail::promise<T> promise_type;
+
+    task() noexcept = default;
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+    task(task &&other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+    ~task() { reset(); }
+
+    task &operator=(task &&other) noexcept
+    {
+        reset();
+        h_ = std::exchange(other.h_, nullptr);
+        return *this;
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct awaiter {
+            std::coroutine_handle<promise_type> h;
+
+            bool await_ready() noexcept { return !h || h.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+            {
+                h.promise().continuation = caller;
+                return h; /* symmetric transfer, no stack growth */
+            }
+
+            T await_resume() { return h.promise().result(); }
+        };
+
+        return awaiter{h_};
+    }
+
+    std::coroutine_handle<promise_type> release() noexcept
+    {
+        return std::exchange(h_, nullptr);
+    }
+
+private:
+    void reset() noexcept
+    {
+        if (h_)
+        {
+            h_.destroy();
+            h_ = nullptr;
+        }
+    }
+
+    std::coroutine_handle<promise_type> h_;
+};
+
+namespace detail {
+
+template <typename T>
+task<T> promise<T>::get_return_object() noexcept
+{
+    return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() noexcept
+{
+    return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+/* a coroutine waiting for an I/O operation */
+struct io_waiter {
+    /* perform the operation, returns false if it would block */
+    bool (*perform)(io_waiter *self) = nullptr;
+    std::coroutine_handle<> handle;
+};
+
+/* a descriptor registered in the executor (edge-triggered) */
+struct io_state {
+    int fd = -1;
+    bool readable = true; /* false after the operation would block */
+    bool writable = true;
+    io_waiter *reader = nullptr;
+    io_waiter *writer = nullptr;
+};
+
+inline std::system_error system_error(const char *what)
+{
+    return std::system_error(last_error(), what);
+}
+
+} /* namespace detail */
+
+/*
+* executor
+
+A single-threaded event loop. The tasks spawned in it run in the thread
+which calls run(). The constructor throws std::system_error if the
+epoll(7) descriptor cannot be created.
+*/
+class executor {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    executor()
+    {
+        struct epoll_event ev;
+
+        tasks_.next = tasks_.prev = &tasks_;
+
+        epfd_.reset(::epoll_create1(EPOLL_CLOEXEC));
+        wakefd_.reset(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+        if (!epfd_ || !wakefd_)
+        {
+            throw detail::system_error("executor");
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr; /* the wake up descriptor */
+        if (::epoll_ctl(epfd_.get(), EPOLL_CTL_ADD, wakefd_.get(), &ev) == -1)
+        {
+            throw detail::system_error("executor");
+        }
+    }
+
+    executor(const executor &) = delete;
+    executor &operator=(const executor &) = delete;
+
+    /* destroys the unfinished tasks */
+    ~executor()
+    {
+        while (tasks_.next != &tasks_)
+        {
+            detail::task_node *n = tasks_.next;
+            n->unlink();
+            n->handle.destroy();
+        }
+    }
+
+    /* start the task, the executor owns it from now on */
+    void spawn(task<void> t)
+    {
+        std::coroutine_handle<task<void>::promise_type> h = t.release();
+
+        if (h)
+        {
+            h.promise().node.handle = h;
+            h.promise().node.link(tasks_);
+            ready_.push_back(h);
+        }
+    }
+
+    /* run until all the spawned tasks finish or stop() is called */
+    void run()
+    {
+        struct epoll_event events[events_per_wait];
+
+        stopped_.store(false, std::memory_order_relaxed);
+        while (!stopped_.load(std::memory_order_relaxed))
+        {
+            resume_ready();
+            if (tasks_.next == &tasks_ || stopped_.load(std::memory_order_relaxed))
+            {
+                break;
+            }
+
+            int n = ::epoll_wait(epfd_.get(), events, events_per_wait, wait_timeout());
+            if (n == -1 && errno != EINTR)
+            {
+                throw detail::system_error("epoll_wait");
+            }
+
+            /* the coroutines are resumed after all the events are
+               dispatched, so they cannot destroy a descriptor which
+               has a pending event */
+            for (int i = 0; i < n; i++)
+            {
+                dispatch(static_cast<detail::io_state *>(events[i].data.ptr), events[i].events);
+            }
+            expire_timers();
+        }
+    }
+
+    /* make run() return, might be called from any thread */
+    void stop() noexcept
+    {
+        std::uint64_t one = 1;
+
+        stopped_.store(true, std::memory_order_relaxed);
+        (void)!::write(wakefd_.get(), &one, sizeof(one));
+    }
+
+    /* resume the calling coroutine on the next iteration */
+    auto yield() noexcept
+    {
+        struct awaiter {
+            executor &ex;
+
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) { ex.ready_.push_back(h); }
+            void await_resume() noexcept {}
+        };
+
+        return awaiter{*this};
+    }
+
+    auto sleep_until(clock::time_point when) noexcept
+    {
+        struct awaiter {
+            executor &ex;
+            clock::time_point when;
+
+            bool await_ready() noexcept { return when <= clock::now(); }
+            void await_suspend(std::coroutine_handle<> h) { ex.add_timer(when, h); }
+            void await_resume() noexcept {}
+        };
+
+        return awaiter{*this, when};
+    }
+
+    template <typename Rep, typename Period>
+    auto sleep_for(std::chrono::duration<Rep, Period> duration) noexcept
+    {
+        return sleep_until(clock::now() + std::chrono::duration_cast<clock::duration>(duration));
+    }
+
+private:
+    friend class async_fd;
+
+    static constexpr int events_per_wait = 64;
+
+    struct timer {
+        clock::time_point when;
+        std::uint64_t seq; /* keeps the order of the timers with the same deadline */
+        std::coroutine_handle<> handle;
+
+        bool operator>(const timer &other) const noexcept
+        {
+            return when != other.when ? when > other.when : seq > other.seq;
+        }
+    };
+
+    void add_timer(clock::time_point when, std::coroutine_handle<> h)
+    {
+        timers_.push_back(timer{when, timer_seq_++, h});
+        std::push_heap(timers_.begin(), timers_.end(), std::greater<timer>());
+    }
+
+    void expire_timers()
+    {
+        clock::time_point now = clock::now();
+
+        while (!timers_.empty() && timers_.front().when <= now)
+        {
+            std::pop_heap(timers_.begin(), timers_.end(), std::greater<timer>());
+            ready_.push_back(timers_.back().handle);
+            timers_.pop_back();
+        }
+    }
+
+    /* epoll_wait() timeout until the nearest timer, rounded up */
+    int wait_timeout() const noexcept
+    {
+        if (!ready_.empty())
+        {
+            return 0;
+        }
+        if (timers_.empty())
+        {
+            return -1;
+        }
+
+        clock::duration left = timers_.front().when - clock::now();
+        if (left <= clock::duration::zero())
+        {
+            return 0;
+        }
+
+        auto ms = std::chrono::ceil<std::chrono::milliseconds>(left).count();
+        return ms > INT32_MAX ? INT32_MAX : static_cast<int>(ms);
+    }
+
+    void resume_ready()
+    {
+        /* the coroutines might schedule more coroutines */
+        while (!ready_.empty())
+        {
+            running_.swap(ready_);
+            for (std::coroutine_handle<> h : running_)
+            {
+                h.resume();
+            }
+            running_.clear();
+        }
+    }
+
+    void dispatch(detail::io_state *s, std::uint32_t events) noexcept
+    {
+        if (s == nullptr) /* woken up by stop() */
+        {
+            std::uint64_t value;
+            (void)!::read(wakefd_.get(), &value, sizeof(value));
+            return;
+        }
+
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        {
+            s->readable = true;
+            complete(s->reader, s->readable);
+        }
+        if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+        {
+            s->writable = true;
+            complete(s->writer, s->writable);
+        }
+    }
+
+    /* perform the operation of the waiting coroutine */
+    void complete(detail::io_waiter *&waiter, bool &ready)
+    {
+        if (waiter == nullptr)
+        {
+            return;
+        }
+
+        if (waiter->perform(waiter))
+        {
+            ready_.push_back(waiter->handle);
+            waiter = nullptr;
+        }
+        else
+        {
+            ready = false; /* spurious wake up */
+        }
+    }
+
+    unique_fd epfd_;
+    unique_fd wakefd_;
+    std::atomic<bool> stopped_{false};
+    detail::task_node tasks_; /* the list head */
+    std::vector<std::coroutine_handle<>> ready_;
+    std::vector<std::coroutine_handle<>> running_;
+    std::vector<timer> timers_;
+    std::uint64_t timer_seq_ = 0;
+};
+
+namespace detail {
+
+/*
+An awaitable I/O operation. The operation is tried at once; if it would
+block, the coroutine is suspended and the operation is performed by the
+executor when the descriptor becomes ready.
+*/
+template <typename Op>
+class io_awaiter : public io_waiter {
+public:
+    io_awaiter(io_state &s, bool write, Op op) noexcept
+        : state_(s), write_(write), op_(op)
+    {
+        perform = &io_awaiter::perform_op;
+    }
+
+    bool await_ready()
+    {
+        bool &ready = write_ ? state_.writable : state_.readable;
+
+        if (ready && attempt())
+        {
+            return true;
+        }
+        ready = false;
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) noexcept
+    {
+        handle = h;
+        (write_ ? state_.writer : state_.reader) = this;
+    }
+
+    result<std::size_t> await_resume() const noexcept
+    {
+        if (error_ != 0)
+        {
+            return std::error_code(error_, std::system_category());
+        }
+        return static_cast<std::size_t>(value_);
+    }
+
+protected:
+    ssize_t value_ = 0;
+    int error_ = 0;
+
+private:
+    bool attempt()
+    {
+        for (;;)
+        {
+            value_ = op_();
+            if (value_ >= 0)
+            {
+                /* A short read (write) of a stream drains (fills) its
+                   buffer, the next operation would block. */
+                if constexpr (requires { op_.exhausted(value_); })
+                {
+                    if (op_.exhausted(value_))
+                    {
+                        (write_ ? state_.writable : state_.readable) = false;
+                    }
+                }
+                error_ = 0;
+                return true;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return false;
+            }
+            if (errno != EINTR)
+            {
+                error_ = errno;
+                return true;
+            }
+        }
+    }
+
+    static bool perform_op(io_waiter *self)
+    {
+        return static_cast<io_awaiter *>(self)->attempt();
+    }
+
+    io_state &state_;
+    bool write_;
+    Op op_;
+};
+
+struct read_op {
+    int fd;
+    void *buf;
+    std::size_t len;
+
+    ssize_t operator()() const { return ::read(fd, buf, len); }
+    bool exhausted(ssize_t n) const { return n > 0 && static_cast<std::size_t>(n) < len; }
+};
+
+struct write_op {
+    int fd;
+    const void *buf;
+    std::size_t len;
+
+    ssize_t operator()() const { return ::write(fd, buf, len); }
+    bool exhausted(ssize_t n) const { return static_cast<std::size_t>(n) < len; }
+};
+
+struct accept_op {
+    int fd;
+
+    ssize_t operator()() const
+    {
+        return ::accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    }
+};
+
+class accept_awaiter : public io_awaiter<accept_op> {
+public:
+    using io_awaiter<accept_op>::io_awaiter;
+
+    result<unique_fd> await_resume() noexcept
+    {
+        if (error_ != 0)
+        {
+            return std::error_code(error_, std::system_category());
+        }
+        return unique_fd(static_cast<int>(value_));
+    }
+};
+
+} /* namespace detail */
+
+/*
+* async_fd
+
+A non-blocking descriptor registered in the executor. Its read(),
+write() and accept() operations are awaitable and return dmn::result.
+At most one coroutine might read and one might write at a time, and the
+object must not be destroyed while they are waiting. The constructor
+throws std::system_error if the descriptor cannot be registered.
+*/
+class async_fd {
+public:
+    async_fd(executor &ex, unique_fd fd) : fd_(std::move(fd))
+    {
+        struct epoll_event ev;
+        int fl;
+
+        state_.fd = fd_.get();
+        fl = ::fcntl(state_.fd, F_GETFL);
+        if (fl == -1 || ::fcntl(state_.fd, F_SETFL, fl | O_NONBLOCK) == -1)
+        {
+            throw detail::system_error("async_fd");
+        }
+
+        /* registered once, the readiness is tracked in state_ */
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = &state_;
+        if (::epoll_ctl(ex.epfd_.get(), EPOLL_CTL_ADD, state_.fd, &ev) == -1)
+        {
+            throw detail::system_error("async_fd");
+        }
+    }
+
+    async_fd(const async_fd &) = delete;
+    async_fd &operator=(const async_fd &) = delete;
+
+    /* closing the descriptor removes it from the epoll set */
+    ~async_fd() = default;
+
+    int get() const noexcept { return fd_.get(); }
+
+    /* co_await returns result<std::size_t>, 0 means end of file. The
+       descriptor is assumed to be a stream (socket, pipe, terminal). */
+    auto read(void *buf, std::size_t len) noexcept
+    {
+        return detail::io_awaiter<detail::read_op>(state_, false, detail::read_op{get(), buf, len});
+    }
+
+    /* co_await returns result<std::size_t>, the write might be partial */
+    auto write(const void *buf, std::size_t len) noexcept
+    {
+        return detail::io_awaiter<detail::write_op>(state_, true, detail::write_op{get(), buf, len});
+    }
+
+    /* co_await returns result<unique_fd> with a non-blocking connection */
+    auto accept() noexcept
+    {
+        return detail::accept_awaiter(state_, false, detail::accept_op{get()});
+    }
+
+    /*
+    Perform an arbitrary operation (e.g. recvfrom(2)) when the descriptor
+    is readable (writable). The callable returns ssize_t and sets errno
+    like a system call. co_await returns result<std::size_t>.
+    */
+    template <typename Op>
+    auto when_readable(Op op) noexcept
+    {
+        return detail::io_awaiter<Op>(state_, false, op);
+    }
+
+    template <typename Op>
+    auto when_writable(Op op) noexcept
+    {
+        return detail::io_awaiter<Op>(state_, true, op);
+    }
+
+private:
+    friend class signal_set;
+
+    unique_fd fd_;
+    detail::io_state state_;
+};
+
+/*
+* signal_set
+
+Awaitable signals. The signals are blocked in the calling thread and
+received through signalfd(2), so
+
+    signal_set signals(ex, {SIGTERM, SIGHUP});
+    auto signo = co_await signals.wait();
+
+replaces the signal handling loop of the C examples. The signals should
+also be blocked in the other threads of the process. The constructor
+throws std::system_error on failure.
+*/
+class signal_set {
+public:
+    signal_set(executor &ex, std::initializer_list<int> signals)
+        : mask_(block(signals)), fd_(ex, open_signalfd(mask_))
+    {
+    }
+
+    /* co_await returns result<int> with the signal number */
+    auto wait() noexcept
+    {
+        struct siginfo_op {
+            int fd;
+            struct signalfd_siginfo *info;
+
+            ssize_t operator()() const { return ::read(fd, info, sizeof(*info)); }
+        };
+
+        struct awaiter : detail::io_awaiter<siginfo_op> {
+            using detail::io_awaiter<siginfo_op>::io_awaiter;
+            const struct signalfd_siginfo *info = nullptr;
+
+            result<int> await_resume() const noexcept
+            {
+                if (error_ != 0)
+                {
+                    return std::error_code(error_, std::system_category());
+                }
+                return static_cast<int>(info->ssi_signo);
+            }
+        };
+
+        awaiter a(fd_.state_, false, siginfo_op{fd_.get(), &info_});
+        a.info = &info_;
+        return a;
+    }
+
+private:
+    static sigset_t block(std::initializer_list<int> signals)
+    {
+        sigset_t mask;
+
+        ::sigemptyset(&mask);
+        for (int signo : signals)
+        {
+            ::sigaddset(&mask, signo);
+        }
+
+        if (::pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0)
+        {
+            throw std::system_error(std::error_code(EINVAL, std::system_category()), "signal_set");
+        }
+        return mask;
+    }
+
+    static unique_fd open_signalfd(const sigset_t &mask)
+    {
+        unique_fd fd(::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC));
+
+        if (!fd)
+        {
+            throw detail::system_error("signalfd");
+        }
+        return fd;
+    }
+
+    sigset_t mask_;
+    async_fd fd_;
+    struct signalfd_siginfo info_;
+};
+
+/*
+* run_per_core(threads, func)
+
+Run an executor per CPU core. The calling thread and threads - 1 new
+threads are pinned to the CPUs which the process might use (0 - one
+thread per CPU); func(executor &, unsigned index) is called in each of
+them to spawn the tasks, then the executors run. The function returns
+when all the executors have returned. The threads inherit the signal
+mask of the caller.
+*/
+template <typename Func>
+void run_per_core(unsigned threads, Func func)
+{
+    cpu_set_t allowed, saved;
+    std::vector<int> cpus;
+    std::vector<std::thread> workers;
+
+    CPU_ZERO(&allowed);
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    if (threads == 0)
+    {
+        threads = cpus.empty() ? 1 : static_cast<unsigned>(cpus.size());
+    }
+    saved = allowed;
+
+    auto body = [&func, &cpus](unsigned index) {
+        if (!cpus.empty())
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[index % cpus.size()], &set);
+            ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+        }
+
+        executor ex;
+        func(ex, index);
+        ex.run();
+    };
+
+    for (unsigned i = 1; i < threads; i++)
+    {
+        workers.emplace_back(body, i);
+    }
+    body(0);
+    for (std::thread &t : workers)
+    {
+        t.join();
+    }
+
+    if (!cpus.empty())
+    {
+        ::pthread_setaffinity_np(::pthread_self(), sizeof(saved), &saved);
+    }
+}
+
+} /* namespace coro */
+} /* namespace dmn */
+
+#endif /* __linux__ */
+
+#endif /* _DAEMONIZE_CORO_HPP */
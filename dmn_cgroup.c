@@ -0,0 +1,233 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+cgroup v2 resource controls. This implementation is Linux specific.
+*/
+
+#ifdef __linux__
+#include <unistd.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+
+#include "dmn_cgroup.h"
+
+/* write the value into the control file of the cgroup */
+static int write_control(int dirfd, const char *name, const char *value)
+{
+    size_t len = strlen(value);
+    ssize_t n;
+    int saved_errno;
+    int fd;
+
+    fd = openat(dirfd, name, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    /* the value is parsed as a whole, so it is written at once */
+    n = write(fd, value, len);
+    saved_errno = errno;
+    close(fd);
+    if (n != (ssize_t)len)
+    {
+        errno = n == -1 ? saved_errno : EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/* check if the word is in the space separated list */
+static int has_word(const char *list, const char *word)
+{
+    size_t len = strlen(word);
+    const char *p = list;
+
+    while ((p = strstr(p, word)) != NULL)
+    {
+        if ((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\n' || p[len] == '\0'))
+        {
+            return 1;
+        }
+        p += len;
+    }
+    return 0;
+}
+
+/* enable the controller for the children of the parent cgroup */
+static int enable_controller(int parentfd, const char *controller)
+{
+    char enabled[256] = {0};
+    char value[64];
+    ssize_t n;
+    int fd;
+
+    fd = openat(parentfd, "cgroup.subtree_control", O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    n = read(fd, enabled, sizeof(enabled) - 1);
+    close(fd);
+    if (n == -1)
+    {
+        return -1;
+    }
+
+    if (has_word(enabled, controller))
+    {
+        return 0;
+    }
+
+    snprintf(value, sizeof(value), "+%s", controller);
+    return write_control(parentfd, "cgroup.subtree_control", value);
+}
+
+/* enable the controllers and set the limits */
+static int apply_limits(int fd, const struct dmn_cgroup_limits *limits)
+{
+    char value[64];
+    int parentfd;
+    int result = 0;
+    int saved_errno;
+
+    parentfd = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (parentfd == -1)
+    {
+        return -1;
+    }
+
+    if ((limits->cpu_max != NULL || limits->cpu_weight != 0) &&
+        enable_controller(parentfd, "cpu") == -1)
+    {
+        result = -1;
+    }
+    else if ((limits->memory_high != NULL || limits->memory_max != NULL) &&
+             enable_controller(parentfd, "memory") == -1)
+    {
+        result = -1;
+    }
+    else if (limits->io_weight != 0 && enable_controller(parentfd, "io") == -1)
+    {
+        result = -1;
+    }
+    saved_errno = errno;
+    close(parentfd);
+    if (result == -1)
+    {
+        errno = saved_errno;
+        return -1;
+    }
+
+    if (limits->cpu_max != NULL && write_control(fd, "cpu.max", limits->cpu_max) == -1)
+    {
+        return -1;
+    }
+
+    if (limits->cpu_weight != 0)
+    {
+        snprintf(value, sizeof(value), "%u", limits->cpu_weight);
+        if (write_control(fd, "cpu.weight", value) == -1)
+        {
+            return -1;
+        }
+    }
+
+    /* memory.high is lowered first: the usage above it is reclaimed
+       gradually, while lowering memory.max below the usage invokes
+       the OOM killer if the memory cannot be reclaimed at once */
+    if (limits->memory_high != NULL && write_control(fd, "memory.high", limits->memory_high) == -1)
+    {
+        return -1;
+    }
+
+    if (limits->memory_max != NULL && write_control(fd, "memory.max", limits->memory_max) == -1)
+    {
+        return -1;
+    }
+
+    if (limits->io_weight != 0)
+    {
+        snprintf(value, sizeof(value), "default %u", limits->io_weight);
+        if (write_control(fd, "io.weight", value) == -1)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int dmn_cgroup_open(const char *path, const struct dmn_cgroup_limits *limits)
+{
+    struct statfs st;
+    int created = 0;
+    int saved_errno;
+    int fd = -1;
+
+    if (path == NULL || path[0] != '/')
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0)
+    {
+        created = 1;
+    }
+    else if (errno != EEXIST)
+    {
+        return -1;
+    }
+
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        goto error;
+    }
+
+    if (fstatfs(fd, &st) == -1)
+    {
+        goto error;
+    }
+    if (st.f_type != CGROUP2_SUPER_MAGIC)
+    {
+        errno = ENOTSUP;
+        goto error;
+    }
+
+    if (limits != NULL && apply_limits(fd, limits) == -1)
+    {
+        goto error;
+    }
+
+    return fd;
+
+error:
+    saved_errno = errno;
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    if (created)
+    {
+        rmdir(path);
+    }
+    errno = saved_errno;
+    return -1;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,67 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+*/
+
+#ifndef _DMN_CGROUP_H
+#define _DMN_CGROUP_H
+
+#ifdef __linux__
+
+/*
+cgroup v2 resource controls for daemons. dmn_cgroup_open() creates (or
+joins) a cgroup and sets its limits, rundaemon_cgroup() (see
+daemonize.h) starts the daemon inside of it.
+
+The cgroup should be located in a subtree delegated to the user which
+starts the daemon (e.g. by systemd with "Delegate=yes" or by the
+administrator), so that the directory and the "cgroup.procs" file of
+the cgroup, as well as the "cgroup.subtree_control" file of its parent,
+are writable. The cgroup should not have child cgroups with enabled
+controllers, as processes cannot be placed into such cgroups.
+*/
+
+/* The limits, the fields which are NULL or 0 are left untouched. */
+struct dmn_cgroup_limits {
+    const char *cpu_max;     /* "cpu.max": "QUOTA PERIOD" in microseconds (e.g. "50000 100000" for a half of a CPU) or "max" */
+    unsigned cpu_weight;     /* "cpu.weight": 1-10000, 100 is the default */
+    const char *memory_high; /* "memory.high": the throttling limit in bytes (K, M and G suffixes are accepted) or "max" */
+    const char *memory_max;  /* "memory.max": the hard limit (the OOM killer is invoked above it) */
+    unsigned io_weight;      /* "io.weight": 1-10000, 100 is the default */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int dmn_cgroup_open(const char *path, const struct dmn_cgroup_limits *limits);
+/*
+* Description
+dmn_cgroup_open() - create the cgroup (or use the existing one), enable
+the controllers needed for the limits in its parent and set the limits.
+If the cgroup has been created by this function and an error occurs, it
+is removed.
+
+* Arguments:
+path - full pathname to the cgroup directory, e.g.
+"/sys/fs/cgroup/daemons.slice/mydaemon";
+limits - the limits or NULL.
+
+* Return value
+File descriptor of the cgroup directory to be passed to
+rundaemon_cgroup() or -1 on error. In the latter case errno will be set
+accordingly: e.g. EACCES or EROFS if the cgroup file system is not
+writable, ENOENT if a controller is not available, or ENOTSUP if the
+path does not belong to a cgroup v2 file system.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __linux__ */
+
+#endif /* _DMN_CGROUP_H */
@@ -0,0 +1,738 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+The daemon control socket. This implementation is Linux specific
+because it uses epoll(7) to expose a single file descriptor to the event
+loop of the daemon.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE /* accept4() */
+#include <unistd.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "dmn_control.h"
+#include "dmn_internal.h"
+
+/* frame header size */
+#define HEADER_SIZE (2 * sizeof(uint32_t))
+/* maximal number of the simultaneously connected clients */
+#define MAX_CLIENTS 1024
+/* maximal number of the events handled by a dmn_control_process() call */
+#define EVENTS_PER_CALL 64
+
+struct command {
+    uint32_t id;
+    dmn_control_handler handler;
+    void *udata;
+};
+
+struct client {
+    int fd;
+    struct client *prev;
+    struct client *next;
+    size_t in_len;   /* bytes in the input buffer */
+    size_t out_len;  /* bytes in the output buffer */
+    size_t out_sent; /* bytes of the output buffer which have been sent */
+    unsigned char in[HEADER_SIZE + DMN_CONTROL_MAX_PAYLOAD];
+    unsigned char out[HEADER_SIZE + DMN_CONTROL_MAX_PAYLOAD];
+};
+
+struct dmn_control {
+    int epfd;
+    int listen_fd;
+    struct sockaddr_un addr;
+    struct command *commands;
+    size_t ncommands;
+    struct client *clients;
+    size_t nclients;
+    int spare_fd; /* reserved to reject the clients when out of descriptors */
+    int paused;   /* the listening socket is not watched */
+};
+
+/* the built-in ping command */
+static int32_t ping_command(void *udata,
+                            const void *request, size_t request_len,
+                            void *response, size_t *response_len)
+{
+    memcpy(response, request, request_len);
+    *response_len = request_len;
+    return 0;
+}
+
+static struct command *find_command(struct dmn_control *ctl, uint32_t id)
+{
+    size_t i;
+
+    for (i = 0; i < ctl->ncommands; i++)
+    {
+        if (ctl->commands[i].id == id)
+        {
+            return &ctl->commands[i];
+        }
+    }
+    return NULL;
+}
+
+/* watch the listening socket again */
+static void resume_accepting(struct dmn_control *ctl)
+{
+    struct epoll_event ev;
+
+    if (ctl->spare_fd == -1)
+    {
+        ctl->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* the listening socket */
+    if (epoll_ctl(ctl->epfd, EPOLL_CTL_ADD, ctl->listen_fd, &ev) == 0)
+    {
+        ctl->paused = 0;
+    }
+}
+
+static void drop_client(struct dmn_control *ctl, struct client *c)
+{
+    /* closing the socket removes it from the epoll set */
+    close(c->fd);
+
+    if (c->prev != NULL)
+    {
+        c->prev->next = c->next;
+    }
+    else
+    {
+        ctl->clients = c->next;
+    }
+    if (c->next != NULL)
+    {
+        c->next->prev = c->prev;
+    }
+
+    ctl->nclients--;
+    free(c);
+
+    /* a descriptor is available now */
+    if (ctl->paused)
+    {
+        resume_accepting(ctl);
+    }
+}
+
+/*
+  Reject a pending client when the process is out of descriptors. The
+  listening socket stays readable otherwise, and the event loop of the
+  daemon would spin. Returns 0 if a client has been rejected.
+*/
+static int reject_client(struct dmn_control *ctl)
+{
+    int saved_errno = EMFILE;
+    int fd = -1;
+
+    if (ctl->spare_fd != -1)
+    {
+        close(ctl->spare_fd);
+        fd = accept4(ctl->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        saved_errno = errno;
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        ctl->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    if (ctl->spare_fd != -1)
+    {
+        if (fd != -1)
+        {
+            return 0;
+        }
+        /* accept4() fails with EMFILE even if there are no clients */
+        else if (saved_errno == EAGAIN)
+        {
+            return -1;
+        }
+    }
+
+    /* stop watching the socket until a client is dropped */
+    if (epoll_ctl(ctl->epfd, EPOLL_CTL_DEL, ctl->listen_fd, NULL) == 0)
+    {
+        ctl->paused = 1;
+    }
+    return -1;
+}
+
+static void accept_clients(struct dmn_control *ctl)
+{
+    for (;;)
+    {
+        struct epoll_event ev;
+        struct client *c;
+        int fd;
+
+        fd = accept4(ctl->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            if ((errno == EMFILE || errno == ENFILE) && reject_client(ctl) == 0)
+            {
+                continue;
+            }
+            /* EAGAIN - no more pending clients, the other errors
+               relate to the particular client */
+            return;
+        }
+
+        /* the socket file mode is the first line of defence */
+        if (dmn_check_peer(fd) == -1 ||
+            ctl->nclients >= MAX_CLIENTS ||
+            (c = calloc(1, sizeof(*c))) == NULL)
+        {
+            close(fd);
+            continue;
+        }
+
+        c->fd = fd;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(ctl->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            close(fd);
+            free(c);
+            continue;
+        }
+
+        c->next = ctl->clients;
+        if (ctl->clients != NULL)
+        {
+            ctl->clients->prev = c;
+        }
+        ctl->clients = c;
+        ctl->nclients++;
+    }
+}
+
+/* wait for readability (when the output is sent) or writability */
+static int watch_client(struct dmn_control *ctl, struct client *c, uint32_t events)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = c;
+    return epoll_ctl(ctl->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/* send the pending response, returns 1 when all the data are sent */
+static int flush_client(struct client *c)
+{
+    while (c->out_sent < c->out_len)
+    {
+        ssize_t n = send(c->fd, &c->out[c->out_sent], c->out_len - c->out_sent,
+                         MSG_NOSIGNAL);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return errno == EAGAIN ? 0 : -1;
+        }
+        c->out_sent += (size_t)n;
+    }
+
+    c->out_len = c->out_sent = 0;
+    return 1;
+}
+
+/* handle the complete requests in the input buffer */
+static int handle_requests(struct dmn_control *ctl, struct client *c)
+{
+    int handled = 0;
+
+    while (c->out_len == 0 && c->in_len >= HEADER_SIZE)
+    {
+        uint32_t header[2];
+        uint32_t response_header[2];
+        size_t frame_len;
+        size_t response_len = 0;
+        int32_t status;
+        struct command *cmd;
+        int result;
+
+        memcpy(header, c->in, sizeof(header));
+        if (header[0] > DMN_CONTROL_MAX_PAYLOAD) /* protocol violation */
+        {
+            return -1;
+        }
+
+        frame_len = HEADER_SIZE + header[0];
+        if (c->in_len < frame_len) /* incomplete request */
+        {
+            break;
+        }
+
+        /* call the handler */
+        cmd = find_command(ctl, header[1]);
+        if (cmd == NULL)
+        {
+            status = -ENOSYS;
+        }
+        else
+        {
+            status = cmd->handler(cmd->udata, &c->in[HEADER_SIZE], header[0],
+                                  &c->out[HEADER_SIZE], &response_len);
+            if (response_len > DMN_CONTROL_MAX_PAYLOAD)
+            {
+                response_len = DMN_CONTROL_MAX_PAYLOAD;
+            }
+        }
+        handled++;
+
+        response_header[0] = (uint32_t)response_len;
+        memcpy(&response_header[1], &status, sizeof(status));
+        memcpy(c->out, response_header, sizeof(response_header));
+        c->out_len = HEADER_SIZE + response_len;
+        c->out_sent = 0;
+
+        /* remove the request from the input buffer */
+        c->in_len -= frame_len;
+        if (c->in_len > 0)
+        {
+            memmove(c->in, &c->in[frame_len], c->in_len);
+        }
+
+        result = flush_client(c);
+        if (result == -1)
+        {
+            return -1;
+        }
+        else if (result == 0) /* wait until the client reads the response */
+        {
+            if (watch_client(ctl, c, EPOLLOUT) == -1)
+            {
+                return -1;
+            }
+            break;
+        }
+    }
+
+    return handled;
+}
+
+static int process_client(struct dmn_control *ctl, struct client *c, uint32_t events)
+{
+    int handled = 0;
+    int result;
+
+    if (events & EPOLLOUT)
+    {
+        result = flush_client(c);
+        if (result != 1)
+        {
+            return result;
+        }
+        if (watch_client(ctl, c, EPOLLIN) == -1)
+        {
+            return -1;
+        }
+
+        /* requests which arrived while the response was being sent */
+        if ((result = handle_requests(ctl, c)) == -1)
+        {
+            return -1;
+        }
+        handled += result;
+    }
+
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && c->out_len == 0)
+    {
+        ssize_t n;
+
+        do
+        {
+            n = read(c->fd, &c->in[c->in_len], sizeof(c->in) - c->in_len);
+        } while (n == -1 && errno == EINTR);
+
+        if (n == 0) /* disconnected */
+        {
+            return -1;
+        }
+        else if (n == -1)
+        {
+            return errno == EAGAIN ? handled : -1;
+        }
+        c->in_len += (size_t)n;
+
+        if ((result = handle_requests(ctl, c)) == -1)
+        {
+            return -1;
+        }
+        handled += result;
+    }
+
+    return handled;
+}
+
+struct dmn_control *dmn_control_open(const char *pid_file_path)
+{
+    struct dmn_control *ctl;
+    struct epoll_event ev;
+    int saved_errno;
+
+    ctl = calloc(1, sizeof(*ctl));
+    if (ctl == NULL)
+    {
+        return NULL;
+    }
+    ctl->epfd = ctl->listen_fd = -1;
+    ctl->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (ctl->spare_fd == -1)
+    {
+        free(ctl);
+        return NULL;
+    }
+
+    if (dmn_socket_address(&ctl->addr, pid_file_path, DMN_CONTROL_SUFFIX) == -1 ||
+        dmn_control_register(ctl, DMN_CONTROL_PING, ping_command, NULL) == -1)
+    {
+        goto error;
+    }
+
+    ctl->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ctl->listen_fd == -1)
+    {
+        goto error;
+    }
+
+    /* the socket file (if any) is left by a previous instance */
+    if (dmn_unlink_stale(pid_file_path, ctl->addr.sun_path) == -1)
+    {
+        goto error;
+    }
+
+    /* the socket is accessible by the owner only */
+    if (dmn_listen_unix(ctl->listen_fd, &ctl->addr, SOMAXCONN) == -1)
+    {
+        goto error;
+    }
+
+    ctl->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ctl->epfd == -1)
+    {
+        unlink(ctl->addr.sun_path);
+        goto error;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* the listening socket */
+    if (epoll_ctl(ctl->epfd, EPOLL_CTL_ADD, ctl->listen_fd, &ev) == -1)
+    {
+        unlink(ctl->addr.sun_path);
+        goto error;
+    }
+
+    return ctl;
+
+error:
+    saved_errno = errno;
+    if (ctl->epfd != -1)
+    {
+        close(ctl->epfd);
+    }
+    if (ctl->listen_fd != -1)
+    {
+        close(ctl->listen_fd);
+    }
+    close(ctl->spare_fd);
+    free(ctl->commands);
+    free(ctl);
+    errno = saved_errno;
+    return NULL;
+}
+
+void dmn_control_close(struct dmn_control *ctl)
+{
+    if (ctl == NULL)
+    {
+        return;
+    }
+
+    /* do not watch the listening socket again while dropping */
+    ctl->paused = 0;
+    while (ctl->clients != NULL)
+    {
+        drop_client(ctl, ctl->clients);
+    }
+
+    close(ctl->epfd);
+    close(ctl->listen_fd);
+    if (ctl->spare_fd != -1)
+    {
+        close(ctl->spare_fd);
+    }
+    unlink(ctl->addr.sun_path);
+    free(ctl->commands);
+    free(ctl);
+}
+
+int dmn_control_register(struct dmn_control *ctl, uint32_t command,
+                         dmn_control_handler handler, void *udata)
+{
+    struct command *cmd;
+
+    if (ctl == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    cmd = find_command(ctl, command);
+    if (handler == NULL) /* remove */
+    {
+        if (cmd != NULL)
+        {
+            *cmd = ctl->commands[--ctl->ncommands];
+        }
+        return 0;
+    }
+
+    if (cmd == NULL) /* add */
+    {
+        cmd = realloc(ctl->commands, (ctl->ncommands + 1) * sizeof(*cmd));
+        if (cmd == NULL)
+        {
+            return -1;
+        }
+        ctl->commands = cmd;
+        cmd = &ctl->commands[ctl->ncommands++];
+        cmd->id = command;
+    }
+
+    cmd->handler = handler;
+    cmd->udata = udata;
+    return 0;
+}
+
+int dmn_control_fd(const struct dmn_control *ctl)
+{
+    return ctl->epfd;
+}
+
+int dmn_control_process(struct dmn_control *ctl)
+{
+    struct epoll_event events[EVENTS_PER_CALL];
+    int handled = 0;
+    int n;
+    int i;
+
+    do
+    {
+        n = epoll_wait(ctl->epfd, events, EVENTS_PER_CALL, 0);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        struct client *c = events[i].data.ptr;
+        int result;
+
+        if (c == NULL)
+        {
+            accept_clients(ctl);
+            continue;
+        }
+
+        result = process_client(ctl, c, events[i].events);
+        if (result == -1) /* disconnected or failed */
+        {
+            drop_client(ctl, c);
+            continue;
+        }
+        handled += result;
+    }
+
+    return handled;
+}
+
+int dmn_control_connect(const char *pid_file_path)
+{
+    struct sockaddr_un addr;
+    int saved_errno;
+    int fd;
+
+    if (dmn_socket_address(&addr, pid_file_path, DMN_CONTROL_SUFFIX) == -1)
+    {
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    return fd;
+}
+
+/* read exactly len bytes */
+static int read_all(int fd, void *buf, size_t len)
+{
+    unsigned char *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        else if (n == 0)
+        {
+            errno = ECONNRESET;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+int dmn_control_call(int fd, uint32_t command,
+                     const void *request, size_t request_len,
+                     void *response, size_t *response_len,
+                     int32_t *status)
+{
+    unsigned char discard[256];
+    uint32_t header[2];
+    struct iovec iov[2];
+    struct msghdr msg;
+    size_t capacity;
+    size_t len;
+
+    if (request_len > DMN_CONTROL_MAX_PAYLOAD || (request_len > 0 && request == NULL))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* send the request */
+    header[0] = (uint32_t)request_len;
+    header[1] = command;
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)request;
+    iov[1].iov_len = request_len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    while (iov[0].iov_len + iov[1].iov_len > 0)
+    {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        size_t sent;
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        /* advance past the sent data */
+        sent = (size_t)n;
+        if (sent >= iov[0].iov_len)
+        {
+            sent -= iov[0].iov_len;
+            iov[0].iov_len = 0;
+            iov[1].iov_base = (unsigned char *)iov[1].iov_base + sent;
+            iov[1].iov_len -= sent;
+        }
+        else
+        {
+            iov[0].iov_base = (unsigned char *)iov[0].iov_base + sent;
+            iov[0].iov_len -= sent;
+        }
+    }
+
+    /* read the response */
+    if (read_all(fd, header, sizeof(header)) == -1)
+    {
+        return -1;
+    }
+
+    len = header[0];
+    capacity = response_len != NULL ? *response_len : 0;
+    if (response == NULL)
+    {
+        capacity = 0;
+    }
+    if (read_all(fd, response, len < capacity ? len : capacity) == -1)
+    {
+        return -1;
+    }
+
+    /* discard the data which do not fit */
+    while (len > capacity)
+    {
+        size_t chunk = len - capacity < sizeof(discard) ? len - capacity : sizeof(discard);
+        if (read_all(fd, discard, chunk) == -1)
+        {
+            return -1;
+        }
+        len -= chunk;
+    }
+
+    if (response_len != NULL)
+    {
+        *response_len = len;
+    }
+    if (status != NULL)
+    {
+        memcpy(status, &header[1], sizeof(*status));
+    }
+
+    return 0;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,153 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+*/
+
+#ifndef _DMN_CONTROL_H
+#define _DMN_CONTROL_H
+
+#ifdef __linux__
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+The control socket is a Unix domain stream socket created next to the
+PID-file ("<pid_file_path>.sock"). Every request and response is a
+frame which starts with a fixed header in the host byte order:
+
+    request:  uint32_t length, uint32_t command, <length bytes of data>
+    response: uint32_t length, int32_t status,   <length bytes of data>
+
+The status is 0 on success and a negated errno value on failure.
+*/
+
+/* maximal size of the data in a request or a response frame */
+#define DMN_CONTROL_MAX_PAYLOAD 4096
+
+/* suffix which is appended to the PID-file path to get the socket path */
+#define DMN_CONTROL_SUFFIX ".sock"
+
+/* built-in commands */
+enum {
+    DMN_CONTROL_PING = 0 /* returns the request data back */
+};
+
+struct dmn_control;
+
+/*
+Command handler. The request data is passed in the request and
+request_len arguments. The response data (up to DMN_CONTROL_MAX_PAYLOAD
+bytes) should be written into the response buffer, its size into
+*response_len (it is 0 on entry). The returned value is sent to
+the client as the response status.
+*/
+typedef int32_t (*dmn_control_handler)(void *udata,
+                                       const void *request, size_t request_len,
+                                       void *response, size_t *response_len);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern struct dmn_control *dmn_control_open(const char *pid_file_path);
+/*
+* Description
+dmn_control_open() - create the control socket of the daemon. Should be
+called by the daemon process (e.g. from the daemon_func passed to
+rundaemon()) after it has locked the PID-file. The socket is
+accessible only by the owner of the daemon, and the clients which run
+as another user are disconnected. A descriptor is reserved to reject
+the clients when the daemon runs out of descriptors.
+
+* Arguments:
+pid_file_path - full pathname to the PID-file of the daemon.
+
+* Return value
+Control socket object or NULL on error. In the latter case errno will
+be set accordingly.
+*/
+
+extern void dmn_control_close(struct dmn_control *ctl);
+/*
+* Description
+dmn_control_close() - close all the client connections, close and remove
+the control socket.
+*/
+
+extern int dmn_control_register(struct dmn_control *ctl, uint32_t command,
+                                dmn_control_handler handler, void *udata);
+/*
+* Description
+dmn_control_register() - register (or replace) a command handler.
+Passing NULL as the handler removes the command.
+
+* Return value
+0 on success or -1 on error. In the latter case errno will be set
+accordingly.
+*/
+
+extern int dmn_control_fd(const struct dmn_control *ctl);
+/*
+* Description
+dmn_control_fd() - get the file descriptor which becomes readable when
+the control socket needs attention. It should be added to the event loop
+of the daemon (select(), poll(), epoll, etc.); dmn_control_process()
+should be called when it is readable.
+*/
+
+extern int dmn_control_process(struct dmn_control *ctl);
+/*
+* Description
+dmn_control_process() - accept new clients, read requests, call the
+handlers and send the responses. It never blocks and handles a bounded
+amount of events per call, so it might be called from the main loop of
+the daemon.
+
+* Return value
+Number of the handled requests or -1 on a fatal error. In the latter case
+errno will be set accordingly.
+*/
+
+extern int dmn_control_connect(const char *pid_file_path);
+/*
+* Description
+dmn_control_connect() - connect to the control socket of the daemon.
+
+* Return value
+Connected socket or -1 on error. In the latter case errno will be set
+accordingly.
+*/
+
+extern int dmn_control_call(int fd, uint32_t command,
+                            const void *request, size_t request_len,
+                            void *response, size_t *response_len,
+                            int32_t *status);
+/*
+* Description
+dmn_control_call() - send a request and wait for the response.
+
+* Arguments:
+fd - socket returned by dmn_control_connect();
+command - command to execute;
+request, request_len - request data;
+response - buffer to receive the response data;
+response_len - size of the response buffer on entry, size of the
+received response data on return (the data which do not fit into the
+buffer are discarded);
+status - pointer to a variable to receive the response status.
+
+* Return value
+0 on success or -1 on error. In the latter case errno will be set
+accordingly.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __linux__ */
+
+#endif /* _DMN_CONTROL_H */
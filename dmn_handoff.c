@@ -0,0 +1,553 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Warm state handoff between daemon instances. This implementation is
+Linux specific because it uses memfd_create(2).
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE /* memfd_create(), accept4() */
+#include <unistd.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "daemonize.h"
+#include "dmn_handoff.h"
+#include "dmn_internal.h"
+
+/* "DMNSTATE" */
+#define REGION_MAGIC 0x45544154534e4d44ull
+
+/* the header in the first page of every region */
+struct region_header {
+    uint64_t magic;
+    uint64_t layout;
+    uint64_t size;    /* size of the data which follow the header page */
+    uint32_t version;
+    uint32_t reserved;
+    char name[DMN_HANDOFF_NAME_MAX];
+};
+
+struct region {
+    int fd;
+    size_t size;
+    int warm; /* the data are passed by the predecessor */
+    struct region_header *header; /* the mapping starts with the header */
+};
+
+struct dmn_handoff {
+    uint32_t version;
+    uint64_t layout;
+    size_t page_size;
+    char *pid_file_path;
+    struct sockaddr_un addr;
+    int listen_fd;
+    /* the regions in use */
+    struct region regions[DMN_HANDOFF_MAX_REGIONS];
+    size_t nregions;
+    /* the regions received from the predecessor which are not used yet */
+    struct region received[DMN_HANDOFF_MAX_REGIONS];
+    size_t nreceived;
+};
+
+/* wait for the events on the descriptor until the deadline (-1 - forever) */
+static int wait_fd(int fd, short events, long long deadline)
+{
+    for (;;)
+    {
+        struct pollfd pfd;
+        int timeout = -1;
+        int result;
+
+        if (deadline >= 0)
+        {
+            long long left = deadline - dmn_now_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+
+        pfd.fd = fd;
+        pfd.events = events;
+        pfd.revents = 0;
+        result = poll(&pfd, 1, timeout);
+        if (result == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        else if (result == 0)
+        {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        return 0;
+    }
+}
+
+static void unmap_region(struct dmn_handoff *h, struct region *r)
+{
+    munmap(r->header, h->page_size + r->size);
+    close(r->fd);
+}
+
+/* validate a region received from the predecessor */
+static int accept_region(struct dmn_handoff *h, int fd)
+{
+    struct region_header *header;
+    struct region *r;
+    struct stat st;
+
+    if (h->nreceived >= DMN_HANDOFF_MAX_REGIONS ||
+        fstat(fd, &st) == -1 || (size_t)st.st_size < h->page_size)
+    {
+        return -1;
+    }
+
+    header = mmap(NULL, h->page_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    if (header->magic != REGION_MAGIC ||
+        header->version != h->version ||
+        header->layout != h->layout ||
+        header->size != (uint64_t)st.st_size - h->page_size ||
+        memchr(header->name, '\0', sizeof(header->name)) == NULL)
+    {
+        munmap(header, h->page_size);
+        return -1; /* incompatible state */
+    }
+
+    r = &h->received[h->nreceived];
+    r->fd = fd;
+    r->size = header->size;
+    r->warm = 1;
+    munmap(header, h->page_size);
+
+    /* map the whole region */
+    r->header = mmap(NULL, h->page_size + r->size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    if (r->header == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    h->nreceived++;
+    return 0;
+}
+
+/* receive the regions from the predecessor, if any */
+static void receive_regions(struct dmn_handoff *h, int timeout_ms)
+{
+    int fds[DMN_HANDOFF_MAX_REGIONS];
+    char control[CMSG_SPACE(sizeof(fds))];
+    long long deadline = timeout_ms >= 0 ? dmn_now_ms() + timeout_ms : -1;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    uint32_t count = 0;
+    ssize_t n;
+    int sock;
+    size_t i, nfds = 0;
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+    {
+        return;
+    }
+
+    /* there is no predecessor if the socket does not exist */
+    if (connect(sock, (struct sockaddr *)&h->addr, sizeof(h->addr)) == -1 ||
+        wait_fd(sock, POLLIN, deadline) == -1)
+    {
+        close(sock);
+        return;
+    }
+
+    iov.iov_base = &count;
+    iov.iov_len = sizeof(count);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    do
+    {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n == -1 && errno == EINTR);
+
+    if (n != sizeof(count))
+    {
+        close(sock);
+        return;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+        }
+    }
+
+    for (i = 0; i < nfds; i++)
+    {
+        if (accept_region(h, fds[i]) == -1)
+        {
+            close(fds[i]);
+        }
+    }
+
+    /* acknowledge, the predecessor might exit now */
+    send(sock, "a", 1, MSG_NOSIGNAL);
+    close(sock);
+}
+
+struct dmn_handoff *dmn_handoff_open(const char *pid_file_path,
+                                     uint32_t version, uint64_t layout,
+                                     int timeout_ms)
+{
+    struct dmn_handoff *h;
+
+    h = calloc(1, sizeof(*h));
+    if (h == NULL)
+    {
+        return NULL;
+    }
+
+    if (dmn_socket_address(&h->addr, pid_file_path, DMN_HANDOFF_SUFFIX) == -1 ||
+        (h->pid_file_path = strdup(pid_file_path)) == NULL)
+    {
+        free(h);
+        return NULL;
+    }
+
+    h->version = version;
+    h->layout = layout;
+    h->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    h->listen_fd = -1;
+
+    receive_regions(h, timeout_ms);
+    return h;
+}
+
+void dmn_handoff_close(struct dmn_handoff *h)
+{
+    size_t i;
+
+    if (h == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < h->nregions; i++)
+    {
+        unmap_region(h, &h->regions[i]);
+    }
+    for (i = 0; i < h->nreceived; i++)
+    {
+        unmap_region(h, &h->received[i]);
+    }
+
+    if (h->listen_fd != -1)
+    {
+        close(h->listen_fd);
+        unlink(h->addr.sun_path);
+    }
+    free(h->pid_file_path);
+    free(h);
+}
+
+void *dmn_handoff_region(struct dmn_handoff *h, const char *name,
+                         size_t size, int *warm)
+{
+    struct region_header *header;
+    struct region *r;
+    size_t i;
+    int fd;
+
+    if (h == NULL || name == NULL || strlen(name) >= DMN_HANDOFF_NAME_MAX)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* already in use */
+    for (i = 0; i < h->nregions; i++)
+    {
+        r = &h->regions[i];
+        if (strcmp(r->header->name, name) == 0)
+        {
+            if (r->size != size)
+            {
+                errno = EEXIST;
+                return NULL;
+            }
+            if (warm != NULL)
+            {
+                *warm = r->warm;
+            }
+            return (char *)r->header + h->page_size;
+        }
+    }
+
+    if (h->nregions >= DMN_HANDOFF_MAX_REGIONS)
+    {
+        errno = ENOSPC;
+        return NULL;
+    }
+
+    /* passed by the predecessor */
+    for (i = 0; i < h->nreceived; i++)
+    {
+        r = &h->received[i];
+        if (strcmp(r->header->name, name) == 0)
+        {
+            if (r->size != size) /* incompatible, start cold */
+            {
+                unmap_region(h, r);
+                h->received[i] = h->received[--h->nreceived];
+                break;
+            }
+
+            h->regions[h->nregions] = *r;
+            h->received[i] = h->received[--h->nreceived];
+            r = &h->regions[h->nregions++];
+            if (warm != NULL)
+            {
+                *warm = 1;
+            }
+            return (char *)r->header + h->page_size;
+        }
+    }
+
+    /* create new region */
+    fd = memfd_create(name, MFD_CLOEXEC);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    if (ftruncate(fd, (off_t)(h->page_size + size)) == -1)
+    {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    header = mmap(NULL, h->page_size + size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED)
+    {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    header->magic = REGION_MAGIC;
+    header->layout = h->layout;
+    header->size = size;
+    header->version = h->version;
+    strcpy(header->name, name);
+
+    r = &h->regions[h->nregions++];
+    r->fd = fd;
+    r->size = size;
+    r->warm = 0;
+    r->header = header;
+
+    if (warm != NULL)
+    {
+        *warm = 0;
+    }
+    return (char *)header + h->page_size;
+}
+
+int dmn_handoff_offer(struct dmn_handoff *h)
+{
+    int saved_errno;
+
+    if (h == NULL || h->listen_fd != -1)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    h->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (h->listen_fd == -1)
+    {
+        return -1;
+    }
+
+    /* the socket file (if any) is left by a previous instance */
+    if (dmn_unlink_stale(h->pid_file_path, h->addr.sun_path) == -1)
+    {
+        goto error;
+    }
+
+    /* the socket is accessible by the owner only */
+    if (dmn_listen_unix(h->listen_fd, &h->addr, 1) == -1)
+    {
+        goto error;
+    }
+
+    /* let the successor start */
+    if (releasepidfile() == -1)
+    {
+        unlink(h->addr.sun_path);
+        goto error;
+    }
+
+    return 0;
+
+error:
+    saved_errno = errno;
+    close(h->listen_fd);
+    h->listen_fd = -1;
+    errno = saved_errno;
+    return -1;
+}
+
+/*
+  Withdraw the offer after the failed transfer: remove the socket and
+  take the PID-file back. Returns -1 with the errno of the failure or -2
+  if the PID-file cannot be locked again.
+*/
+static int withdraw_offer(struct dmn_handoff *h)
+{
+    int saved_errno = errno;
+    int result;
+
+    close(h->listen_fd);
+    h->listen_fd = -1;
+    unlink(h->addr.sun_path);
+
+    result = acquirepidfile(h->pid_file_path);
+    if (result == 0)
+    {
+        errno = saved_errno;
+        return -1;
+    }
+    else if (result == -2)
+    {
+        errno = EEXIST; /* another instance has started in the meantime */
+    }
+    return -2;
+}
+
+int dmn_handoff_transfer(struct dmn_handoff *h, int timeout_ms)
+{
+    int fds[DMN_HANDOFF_MAX_REGIONS];
+    char control[CMSG_SPACE(sizeof(fds))];
+    long long deadline = timeout_ms >= 0 ? dmn_now_ms() + timeout_ms : -1;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    uint32_t count;
+    int sock = -1;
+    ssize_t n;
+    char ack;
+    size_t i;
+
+    if (h == NULL || h->listen_fd == -1)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* wait for the successor */
+    for (;;)
+    {
+        if (wait_fd(h->listen_fd, POLLIN, deadline) == -1)
+        {
+            return withdraw_offer(h);
+        }
+
+        sock = accept4(h->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (sock == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            return withdraw_offer(h);
+        }
+
+        if (dmn_check_peer(sock) == 0)
+        {
+            break;
+        }
+        close(sock);
+    }
+
+    /* pass the regions */
+    count = (uint32_t)h->nregions;
+    for (i = 0; i < h->nregions; i++)
+    {
+        fds[i] = h->regions[i].fd;
+    }
+
+    iov.iov_base = &count;
+    iov.iov_len = sizeof(count);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (count > 0)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+    }
+
+    do
+    {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n == -1 && errno == EINTR);
+
+    /* wait for the acknowledgement */
+    if (n != sizeof(count) || wait_fd(sock, POLLIN, deadline) == -1 ||
+        read(sock, &ack, 1) != 1)
+    {
+        int saved_errno = n == -1 ? errno : EPROTO;
+        close(sock);
+        errno = saved_errno;
+        return withdraw_offer(h);
+    }
+    close(sock);
+
+    close(h->listen_fd);
+    h->listen_fd = -1;
+    unlink(h->addr.sun_path);
+    return 0;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,150 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+*/
+
+#ifndef _DMN_HANDOFF_H
+#define _DMN_HANDOFF_H
+
+#ifdef __linux__
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Warm state handoff. The daemon keeps the state which is expensive to
+rebuild in memfd-backed regions. During a planned restart the daemon
+(predecessor) passes the memfds to the new instance (successor) over a
+Unix domain socket created next to the PID-file
+("<pid_file_path>.handoff"), and the successor maps the same pages
+again, without copying.
+
+Every region starts with a header which contains the state version and
+layout identifiers supplied by the daemon. The successor rejects the
+regions with different identifiers and starts cold instead.
+
+The restart sequence is:
+
+1. The predecessor calls dmn_handoff_offer(): the handoff socket is
+   created and the PID-file is released (see releasepidfile()).
+2. The successor is started in the usual way (e.g. with rundaemon()),
+   as the PID-file is no longer locked.
+3. The predecessor calls dmn_handoff_transfer() to wait for the successor
+   and pass the regions to it, then exits.
+4. The successor calls dmn_handoff_open() and gets the regions with
+   dmn_handoff_region().
+
+Between the steps 1 and 3 the predecessor runs without the PID-file, so
+any instance of the daemon (not necessarily the successor) might lock
+it. If the transfer fails, the predecessor locks the PID-file again and
+continues, or exits if another instance has taken it over. Thus, two
+instances might run at the same time during the handoff, but only one
+of them holds the PID-file.
+*/
+
+/* suffix which is appended to the PID-file path to get the socket path */
+#define DMN_HANDOFF_SUFFIX ".handoff"
+
+/* maximal number of the regions */
+#define DMN_HANDOFF_MAX_REGIONS 64
+
+/* maximal length of the region name (including the terminating zero) */
+#define DMN_HANDOFF_NAME_MAX 64
+
+struct dmn_handoff;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern struct dmn_handoff *dmn_handoff_open(const char *pid_file_path,
+                                            uint32_t version, uint64_t layout,
+                                            int timeout_ms);
+/*
+* Description
+dmn_handoff_open() - create the handoff object of the daemon and receive
+the state regions of the predecessor if it offers them.
+
+* Arguments:
+pid_file_path - full pathname to the PID-file of the daemon;
+version, layout - identifiers of the state format. The regions of the
+predecessor are accepted only if they are the same;
+timeout_ms - maximal time to wait for the predecessor's data.
+
+* Return value
+Handoff object or NULL on error. The absence of the predecessor is not
+an error. In the latter case errno will be set accordingly.
+*/
+
+extern void dmn_handoff_close(struct dmn_handoff *h);
+/*
+* Description
+dmn_handoff_close() - unmap the regions and free the handoff object.
+The memory is freed when the last process which maps it (or holds its
+descriptor) releases it.
+*/
+
+extern void *dmn_handoff_region(struct dmn_handoff *h, const char *name,
+                                size_t size, int *warm);
+/*
+* Description
+dmn_handoff_region() - get a state region. If the predecessor has passed
+a compatible region with the same name and size, its pages are mapped,
+otherwise a new zero-filled region is created.
+
+* Arguments:
+h - handoff object;
+name - region name (shorter than DMN_HANDOFF_NAME_MAX);
+size - region size;
+warm - pointer to a variable which is set to 1 if the predecessor's data
+is reused and to 0 otherwise, might be NULL.
+
+* Return value
+Address of the page aligned region data or NULL on error. In the latter
+case errno will be set accordingly. Getting the same region again
+returns the same address and the same warm flag.
+*/
+
+extern int dmn_handoff_offer(struct dmn_handoff *h);
+/*
+* Description
+dmn_handoff_offer() - prepare to pass the state to the successor: create
+the handoff socket and release the PID-file, so that the successor can
+be started. The daemon should hold the PID-file: it should be started
+by rundaemon() or acquire the file with acquirepidfile() (e.g. if it is
+executed by dmnctl).
+
+* Return value
+0 on success or -1 on error (ENOENT if the daemon does not hold the
+PID-file). In the latter case errno will be set accordingly.
+*/
+
+extern int dmn_handoff_transfer(struct dmn_handoff *h, int timeout_ms);
+/*
+* Description
+dmn_handoff_transfer() - wait for the successor and pass the state
+regions to it. The function returns after the successor has received
+them. The daemon should not modify the regions after that.
+
+* Arguments:
+h - handoff object;
+timeout_ms - maximal time to wait for the successor, -1 - forever.
+
+* Return value
+0 on success. If the successor has not received the state (e.g. it has
+not connected in time), the offer is withdrawn and the PID-file is
+locked again: -1 is returned (ETIMEDOUT if the successor has not
+connected) and the daemon can continue. -2 is returned if the PID-file
+cannot be locked again (EEXIST if another instance holds it), the daemon
+should exit then. In both cases errno will be set accordingly.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __linux__ */
+
+#endif /* _DMN_HANDOFF_H */
@@ -0,0 +1,955 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Heartbeat based stall detector. This implementation is Linux specific
+because the diagnostics are gathered from procfs.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE /* gettid(), pipe2(), program_invocation_short_name */
+#include <unistd.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include "dmn_heartbeat.h"
+#include "dmn_internal.h"
+
+/* "DMNHBEAT" */
+#define PAGE_MAGIC 0x54414542484e4d44ull
+/* the slots follow the page header */
+#define SLOTS_OFFSET 64
+
+/* the header of the heartbeat page */
+struct page_header {
+    uint64_t magic;
+    int32_t pid;
+    uint32_t nslots;
+};
+
+/* the state of a slot seen by the checker */
+struct slot_state {
+    uint64_t counter;
+    uint32_t generation;
+    int active;
+    int stalled;
+    long long changed_ms; /* when the counter has changed last time */
+};
+
+struct dmn_heartbeat {
+    struct page_header *page;
+    struct dmn_heartbeat_slot *slots;
+    size_t page_size;
+    uint32_t nslots;
+    struct slot_state *state;
+    /* the owner side */
+    int owner;
+    dev_t dev;
+    ino_t ino;
+    pthread_mutex_t lock;
+    /* the watchdog */
+    pthread_t thread;
+    int watchdog;
+    int flags;
+    unsigned period_ms;
+    int report_fd;
+    int stop_pipe[2];
+    char path[];
+};
+
+/* allocate the heartbeat object with the page path */
+static struct dmn_heartbeat *alloc_heartbeat(const char *pid_file_path)
+{
+    struct dmn_heartbeat *h;
+    size_t len;
+
+    if (pid_file_path == NULL || *pid_file_path == '\0')
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    len = strlen(pid_file_path) + sizeof(DMN_HEARTBEAT_SUFFIX);
+    h = calloc(1, sizeof(*h) + len);
+    if (h == NULL)
+    {
+        return NULL;
+    }
+
+    snprintf(h->path, len, "%s%s", pid_file_path, DMN_HEARTBEAT_SUFFIX);
+    h->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    h->stop_pipe[0] = h->stop_pipe[1] = -1;
+    h->report_fd = -1;
+    return h;
+}
+
+/* set up the page pointers and the checker state */
+static int init_state(struct dmn_heartbeat *h)
+{
+    h->slots = (struct dmn_heartbeat_slot *)((char *)h->page + SLOTS_OFFSET);
+    h->nslots = h->page->nslots;
+
+    h->state = calloc(h->nslots, sizeof(*h->state));
+    return h->state == NULL ? -1 : 0;
+}
+
+struct dmn_heartbeat *dmn_heartbeat_open(const char *pid_file_path)
+{
+    struct dmn_heartbeat *h;
+    struct stat st;
+    int saved_errno;
+    int fd;
+
+    h = alloc_heartbeat(pid_file_path);
+    if (h == NULL)
+    {
+        return NULL;
+    }
+
+    /* The page (if any) is left by a previous instance. A new file is
+       created to keep the old mapping of a checker intact. */
+    if (dmn_unlink_stale(pid_file_path, h->path) == -1 ||
+        (fd = open(h->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1)
+    {
+        free(h);
+        return NULL;
+    }
+
+    if (fchmod(fd, 0644) == -1 || ftruncate(fd, (off_t)h->page_size) == -1 ||
+        fstat(fd, &st) == -1)
+    {
+        goto error;
+    }
+
+    h->page = mmap(NULL, h->page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h->page == MAP_FAILED)
+    {
+        goto error;
+    }
+    close(fd);
+
+    h->owner = 1;
+    h->dev = st.st_dev;
+    h->ino = st.st_ino;
+    pthread_mutex_init(&h->lock, NULL);
+
+    h->page->pid = (int32_t)getpid();
+    h->page->nslots = (uint32_t)((h->page_size - SLOTS_OFFSET) / sizeof(struct dmn_heartbeat_slot));
+    if (init_state(h) == -1)
+    {
+        saved_errno = errno;
+        dmn_heartbeat_close(h);
+        errno = saved_errno;
+        return NULL;
+    }
+    /* the page is valid from now on */
+    __atomic_store_n(&h->page->magic, PAGE_MAGIC, __ATOMIC_RELEASE);
+
+    return h;
+
+error:
+    saved_errno = errno;
+    close(fd);
+    unlink(h->path);
+    free(h);
+    errno = saved_errno;
+    return NULL;
+}
+
+struct dmn_heartbeat *dmn_heartbeat_attach(const char *pid_file_path)
+{
+    struct dmn_heartbeat *h;
+    struct stat st;
+    int saved_errno;
+    int fd;
+
+    h = alloc_heartbeat(pid_file_path);
+    if (h == NULL)
+    {
+        return NULL;
+    }
+
+    fd = open(h->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        free(h);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1)
+    {
+        goto error;
+    }
+    if ((size_t)st.st_size != h->page_size)
+    {
+        errno = EINVAL;
+        goto error;
+    }
+
+    h->page = mmap(NULL, h->page_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (h->page == MAP_FAILED)
+    {
+        goto error;
+    }
+    close(fd);
+
+    if (__atomic_load_n(&h->page->magic, __ATOMIC_ACQUIRE) != PAGE_MAGIC ||
+        h->page->nslots > (h->page_size - SLOTS_OFFSET) / sizeof(struct dmn_heartbeat_slot))
+    {
+        munmap(h->page, h->page_size);
+        free(h);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (init_state(h) == -1)
+    {
+        saved_errno = errno;
+        munmap(h->page, h->page_size);
+        free(h);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    return h;
+
+error:
+    saved_errno = errno;
+    close(fd);
+    free(h);
+    errno = saved_errno;
+    return NULL;
+}
+
+void dmn_heartbeat_close(struct dmn_heartbeat *h)
+{
+    struct stat st;
+
+    if (h == NULL)
+    {
+        return;
+    }
+
+    if (h->watchdog)
+    {
+        /* wake the watchdog up */
+        close(h->stop_pipe[1]);
+        pthread_join(h->thread, NULL);
+        close(h->stop_pipe[0]);
+    }
+
+    if (h->owner)
+    {
+        /* do not remove the page of a newer instance */
+        if (stat(h->path, &st) == 0 && st.st_dev == h->dev && st.st_ino == h->ino)
+        {
+            unlink(h->path);
+        }
+        pthread_mutex_destroy(&h->lock);
+    }
+
+    munmap(h->page, h->page_size);
+    free(h->state);
+    free(h);
+}
+
+pid_t dmn_heartbeat_pid(const struct dmn_heartbeat *h)
+{
+    return (pid_t)h->page->pid;
+}
+
+struct dmn_heartbeat_slot *dmn_heartbeat_register(struct dmn_heartbeat *h,
+                                                  const char *name,
+                                                  unsigned timeout_ms)
+{
+    struct dmn_heartbeat_slot *slot = NULL;
+    uint32_t i;
+
+    if (h == NULL || !h->owner || name == NULL ||
+        strlen(name) >= DMN_HEARTBEAT_NAME_MAX || timeout_ms == 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&h->lock);
+    for (i = 0; i < h->nslots; i++)
+    {
+        if (h->slots[i].timeout_ms == 0)
+        {
+            slot = &h->slots[i];
+            break;
+        }
+    }
+
+    if (slot == NULL)
+    {
+        pthread_mutex_unlock(&h->lock);
+        errno = ENOSPC;
+        return NULL;
+    }
+
+    /* the checkers reset their state when the generation changes */
+    slot->counter = 0;
+    slot->tid = (int32_t)gettid();
+    strcpy(slot->name, name);
+    slot->generation++;
+    __atomic_store_n(&slot->timeout_ms, timeout_ms, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&h->lock);
+
+    return slot;
+}
+
+void dmn_heartbeat_unregister(struct dmn_heartbeat *h,
+                              struct dmn_heartbeat_slot *slot)
+{
+    if (h == NULL || slot == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&h->lock);
+    __atomic_store_n(&slot->timeout_ms, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&h->lock);
+}
+
+/* compare the heartbeats with the state of the previous check */
+static int check_heartbeats(struct dmn_heartbeat *h,
+                            dmn_heartbeat_callback callback, void *udata)
+{
+    long long now = dmn_now_ms();
+    int stalled = 0;
+    uint32_t i;
+
+    for (i = 0; i < h->nslots; i++)
+    {
+        struct dmn_heartbeat_slot *slot = &h->slots[i];
+        struct slot_state *state = &h->state[i];
+        uint32_t timeout = __atomic_load_n(&slot->timeout_ms, __ATOMIC_ACQUIRE);
+        uint32_t generation = __atomic_load_n(&slot->generation, __ATOMIC_RELAXED);
+        uint64_t counter = __atomic_load_n(&slot->counter, __ATOMIC_RELAXED);
+
+        if (timeout == 0)
+        {
+            state->active = 0;
+            continue;
+        }
+
+        if (!state->active || state->generation != generation ||
+            state->counter != counter)
+        {
+            /* new or alive */
+            state->active = 1;
+            state->generation = generation;
+            state->counter = counter;
+            state->changed_ms = now;
+            state->stalled = 0;
+            continue;
+        }
+
+        if (now - state->changed_ms < (long long)timeout)
+        {
+            continue;
+        }
+
+        stalled++;
+        if (!state->stalled)
+        {
+            char name[DMN_HEARTBEAT_NAME_MAX];
+
+            state->stalled = 1;
+            if (callback != NULL)
+            {
+                memcpy(name, slot->name, sizeof(name));
+                name[sizeof(name) - 1] = '\0';
+                callback(udata, name, (pid_t)slot->tid,
+                         (unsigned)(now - state->changed_ms));
+            }
+        }
+    }
+
+    return stalled;
+}
+
+int dmn_heartbeat_check(struct dmn_heartbeat *h,
+                        dmn_heartbeat_callback callback, void *udata)
+{
+    /* the checker state belongs to the watchdog while it runs */
+    if (h->watchdog)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    return check_heartbeats(h, callback, udata);
+}
+
+unsigned dmn_heartbeat_timeout(const struct dmn_heartbeat *h)
+{
+    unsigned result = 0;
+    uint32_t i;
+
+    for (i = 0; i < h->nslots; i++)
+    {
+        unsigned timeout = __atomic_load_n(&h->slots[i].timeout_ms, __ATOMIC_ACQUIRE);
+        if (timeout > result)
+        {
+            result = timeout;
+        }
+    }
+
+    return result;
+}
+
+/*
+  The diagnostics are gathered by the watchdog of a wedged daemon, which
+  might hold the stdio, malloc or syslog locks, so only plain system
+  calls are used from here on: no stdio, no opendir() and no syslog().
+*/
+
+/* the output of the diagnostics */
+struct report {
+    int fd;
+    long long deadline_ms; /* 0 - no deadline */
+    int failed;
+    size_t len;
+    char buf[1024]; /* less than PIPE_BUF, so a writable pipe never blocks */
+};
+
+/* write the buffered output, give up after the deadline */
+static void report_flush(struct report *r)
+{
+    struct pollfd pfd;
+    long long left;
+    size_t done = 0;
+    ssize_t n;
+
+    while (!r->failed && done < r->len)
+    {
+        if (r->deadline_ms != 0)
+        {
+            left = r->deadline_ms - dmn_now_ms();
+            pfd.fd = r->fd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            if (left <= 0 || poll(&pfd, 1, (int)left) <= 0)
+            {
+                r->failed = 1;
+                break;
+            }
+        }
+
+        n = write(r->fd, r->buf + done, r->len - done);
+        if (n == -1 && (errno == EINTR || (errno == EAGAIN && r->deadline_ms != 0)))
+        {
+            continue;
+        }
+        else if (n <= 0)
+        {
+            r->failed = 1;
+            break;
+        }
+        done += (size_t)n;
+    }
+
+    r->len = 0;
+}
+
+static void report_mem(struct report *r, const char *str, size_t len)
+{
+    size_t n;
+
+    while (len > 0)
+    {
+        if (r->len == sizeof(r->buf))
+        {
+            report_flush(r);
+        }
+
+        n = sizeof(r->buf) - r->len;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(r->buf + r->len, str, n);
+        r->len += n;
+        str += n;
+        len -= n;
+    }
+}
+
+static void report_str(struct report *r, const char *str)
+{
+    report_mem(r, str, strlen(str));
+}
+
+/* the first line of the string */
+static void report_line(struct report *r, const char *str)
+{
+    report_mem(r, str, strcspn(str, "\n"));
+}
+
+/* format the number into the buffer of at least 21 characters */
+static size_t format_num(char *buf, unsigned long long value)
+{
+    char digits[20];
+    size_t len = 0, i;
+
+    do
+    {
+        digits[len++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    for (i = 0; i < len; i++)
+    {
+        buf[i] = digits[len - i - 1];
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+static void report_num(struct report *r, unsigned long long value)
+{
+    char buf[21];
+    report_mem(r, buf, format_num(buf, value));
+}
+
+/* nanoseconds as milliseconds with three decimals */
+static void report_ns_as_ms(struct report *r, unsigned long long ns)
+{
+    char buf[21];
+    size_t len;
+
+    report_num(r, ns / 1000000);
+    len = format_num(buf, ns / 1000 % 1000);
+    report_mem(r, ".000", 4 - len);
+    report_mem(r, buf, len);
+    report_str(r, " ms");
+}
+
+/* "/proc/<pid>/task/<tid>/<name>" */
+static void task_path(char *path, size_t size, pid_t pid, const char *tid,
+                      const char *name)
+{
+    char num[21];
+    const char *parts[6];
+    size_t len = 0, i, n;
+
+    format_num(num, (unsigned long long)pid);
+    parts[0] = "/proc/";
+    parts[1] = num;
+    parts[2] = "/task/";
+    parts[3] = tid;
+    parts[4] = "/";
+    parts[5] = name;
+
+    for (i = 0; i < sizeof(parts) / sizeof(parts[0]); i++)
+    {
+        n = strlen(parts[i]);
+        if (len + n >= size)
+        {
+            break;
+        }
+        memcpy(path + len, parts[i], n);
+        len += n;
+    }
+    path[len] = '\0';
+}
+
+/* read a small procfs file, the trailing newline is removed */
+static ssize_t read_proc_file(const char *path, char *buf, size_t size)
+{
+    ssize_t n;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    do
+    {
+        n = read(fd, buf, size - 1);
+    } while (n == -1 && errno == EINTR);
+    close(fd);
+
+    if (n == -1)
+    {
+        return -1;
+    }
+
+    while (n > 0 && buf[n - 1] == '\n')
+    {
+        n--;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/* find the value of a "Name: value" line of /proc/.../status */
+static const char *status_field(const char *status, const char *name)
+{
+    size_t len = strlen(name);
+    const char *line;
+
+    for (line = status; line != NULL && *line != '\0'; )
+    {
+        if (strncmp(line, name, len) == 0 && line[len] == ':')
+        {
+            line += len + 1;
+            while (*line == ' ' || *line == '\t')
+            {
+                line++;
+            }
+            return line;
+        }
+        line = strchr(line, '\n');
+        if (line != NULL)
+        {
+            line++;
+        }
+    }
+
+    return "?";
+}
+
+/* describe a thread */
+static void report_thread(struct report *r, pid_t pid, const char *tid)
+{
+    char path[64];
+    char buf[4096];
+    char status[4096];
+    unsigned long long run_ns, wait_ns, slices;
+    const char *line;
+    char *end;
+    int error;
+
+    task_path(path, sizeof(path), pid, tid, "comm");
+    if (read_proc_file(path, buf, sizeof(buf)) == -1)
+    {
+        return; /* the thread has exited */
+    }
+    report_str(r, "thread ");
+    report_str(r, tid);
+    report_str(r, " (");
+    report_str(r, buf);
+    report_str(r, ")\n");
+
+    task_path(path, sizeof(path), pid, tid, "status");
+    if (read_proc_file(path, status, sizeof(status)) == -1)
+    {
+        status[0] = '\0';
+    }
+    report_str(r, "  state: ");
+    report_line(r, status_field(status, "State"));
+    report_str(r, "\n");
+
+    task_path(path, sizeof(path), pid, tid, "wchan");
+    if (read_proc_file(path, buf, sizeof(buf)) != -1)
+    {
+        report_str(r, "  wchan: ");
+        report_str(r, buf);
+        report_str(r, "\n");
+    }
+
+    task_path(path, sizeof(path), pid, tid, "syscall");
+    if (read_proc_file(path, buf, sizeof(buf)) != -1)
+    {
+        report_str(r, "  syscall: ");
+        report_str(r, buf);
+        report_str(r, "\n");
+    }
+
+    /* on CPU time, run queue wait time, number of time slices */
+    task_path(path, sizeof(path), pid, tid, "schedstat");
+    if (read_proc_file(path, buf, sizeof(buf)) != -1)
+    {
+        run_ns = strtoull(buf, &end, 10);
+        wait_ns = strtoull(end, &end, 10);
+        slices = strtoull(end, &end, 10);
+        report_str(r, "  sched: run ");
+        report_ns_as_ms(r, run_ns);
+        report_str(r, ", wait ");
+        report_ns_as_ms(r, wait_ns);
+        report_str(r, ", ");
+        report_num(r, slices);
+        report_str(r, " slices\n");
+    }
+    report_str(r, "  context switches: ");
+    report_line(r, status_field(status, "voluntary_ctxt_switches"));
+    report_str(r, " voluntary, ");
+    report_line(r, status_field(status, "nonvoluntary_ctxt_switches"));
+    report_str(r, " involuntary\n");
+
+    task_path(path, sizeof(path), pid, tid, "stack");
+    if (read_proc_file(path, buf, sizeof(buf)) == -1)
+    {
+        error = errno;
+        report_str(r, "  kernel stack: unavailable (");
+        if (error == EACCES || error == EPERM)
+        {
+            report_str(r, "permission denied");
+        }
+        else
+        {
+            report_str(r, "error ");
+            report_num(r, (unsigned long long)error);
+        }
+        report_str(r, ")\n");
+        return;
+    }
+
+    report_str(r, "  kernel stack:\n");
+    for (line = buf; *line != '\0'; )
+    {
+        size_t len = strcspn(line, "\n");
+        report_str(r, "    ");
+        report_mem(r, line, len);
+        report_str(r, "\n");
+        line += len;
+        if (*line == '\n')
+        {
+            line++;
+        }
+    }
+}
+
+/* the directory entry returned by getdents64() */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* write the diagnostics of the process */
+static int report_process(struct report *r, pid_t pid)
+{
+    char path[64];
+    char buf[4096];
+    char entries[4096];
+    struct linux_dirent64 *entry;
+    long n, pos;
+    int dir;
+
+    task_path(path, sizeof(path), pid, "", "");
+    path[strlen(path) - 1] = '\0'; /* "/proc/<pid>/task" */
+    dir = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir == -1)
+    {
+        return -1;
+    }
+
+    report_str(r, "process ");
+    report_num(r, (unsigned long long)pid);
+    report_str(r, ":\n");
+    if (read_proc_file("/proc/loadavg", buf, sizeof(buf)) != -1)
+    {
+        report_str(r, "load average: ");
+        report_str(r, buf);
+        report_str(r, "\n");
+    }
+    if (read_proc_file("/proc/pressure/cpu", buf, sizeof(buf)) != -1)
+    {
+        report_str(r, "cpu pressure:\n");
+        report_str(r, buf);
+        report_str(r, "\n");
+    }
+
+    while ((n = syscall(SYS_getdents64, dir, entries, sizeof(entries))) > 0)
+    {
+        for (pos = 0; pos < n; pos += entry->d_reclen)
+        {
+            entry = (struct linux_dirent64 *)(entries + pos);
+            if (entry->d_name[0] != '.')
+            {
+                report_thread(r, pid, entry->d_name);
+            }
+        }
+    }
+
+    close(dir);
+    report_flush(r);
+    return 0;
+}
+
+int dmn_heartbeat_report(pid_t pid, int fd)
+{
+    struct report r;
+
+    r.fd = fd;
+    r.deadline_ms = 0;
+    r.failed = 0;
+    r.len = 0;
+    if (report_process(&r, pid) == -1)
+    {
+        return -1;
+    }
+
+    if (r.failed)
+    {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/* Log the stall the way syslog() does, but without its lock and without
+   blocking: the datagram is dropped if the logging daemon is stuck. */
+static void log_stall(const struct report *message)
+{
+    struct sockaddr_un addr;
+    int sock;
+
+    sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock == -1)
+    {
+        return;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, "/dev/log");
+    sendto(sock, message->buf, message->len, MSG_DONTWAIT | MSG_NOSIGNAL,
+           (const struct sockaddr *)&addr, sizeof(addr));
+    close(sock);
+}
+
+/* stall callback of the watchdog */
+static void watchdog_stall(void *udata, const char *name, pid_t tid, unsigned stalled_ms)
+{
+    struct dmn_heartbeat *h = udata;
+    struct report message, r;
+
+    /* "<priority>program[pid]: message" */
+    message.fd = -1;
+    message.deadline_ms = 0;
+    message.failed = 0;
+    message.len = 0;
+    report_str(&message, "<");
+    report_num(&message, LOG_DAEMON | LOG_ERR);
+    report_str(&message, ">");
+    report_str(&message, program_invocation_short_name);
+    report_str(&message, "[");
+    report_num(&message, (unsigned long long)getpid());
+    report_str(&message, "]: ");
+    report_str(&message, "Heartbeat '");
+    report_str(&message, name);
+    report_str(&message, "' (thread ");
+    report_num(&message, (unsigned long long)tid);
+    report_str(&message, ") has stalled for ");
+    report_num(&message, stalled_ms);
+    report_str(&message, " ms");
+    log_stall(&message);
+
+    if (h->report_fd != -1)
+    {
+        /* a stuck report descriptor must not stop the watchdog */
+        r.fd = h->report_fd;
+        r.deadline_ms = dmn_now_ms() + h->period_ms;
+        r.failed = 0;
+        r.len = 0;
+        report_str(&r, "heartbeat '");
+        report_str(&r, name);
+        report_str(&r, "' (thread ");
+        report_num(&r, (unsigned long long)tid);
+        report_str(&r, ") has stalled for ");
+        report_num(&r, stalled_ms);
+        report_str(&r, " ms\n");
+        report_process(&r, getpid());
+        report_flush(&r);
+    }
+}
+
+static void *watchdog_thread(void *arg)
+{
+    struct dmn_heartbeat *h = arg;
+    struct pollfd pfd;
+    sigset_t mask;
+
+    /* the signals are handled by the daemon's own threads */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    pfd.fd = h->stop_pipe[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    /* the write end is closed by dmn_heartbeat_close() */
+    while (!(pfd.revents & (POLLIN | POLLHUP)))
+    {
+        if (poll(&pfd, 1, (int)h->period_ms) != 0)
+        {
+            continue;
+        }
+
+        if (check_heartbeats(h, watchdog_stall, h) > 0 &&
+            (h->flags & DMN_HEARTBEAT_ABORT))
+        {
+            /* dump core, all the threads are in the core file */
+            abort();
+        }
+    }
+
+    return NULL;
+}
+
+int dmn_heartbeat_watchdog(struct dmn_heartbeat *h, int flags,
+                           unsigned period_ms, int report_fd)
+{
+    int result;
+
+    if (h == NULL || !h->owner || h->watchdog || period_ms == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (pipe2(h->stop_pipe, O_CLOEXEC) == -1)
+    {
+        return -1;
+    }
+
+    h->flags = flags;
+    h->period_ms = period_ms;
+    h->report_fd = report_fd;
+
+    result = pthread_create(&h->thread, NULL, watchdog_thread, h);
+    if (result != 0)
+    {
+        close(h->stop_pipe[0]);
+        close(h->stop_pipe[1]);
+        h->stop_pipe[0] = h->stop_pipe[1] = -1;
+        errno = result;
+        return -1;
+    }
+
+    h->watchdog = 1;
+    return 0;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,225 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+*/
+
+#ifndef _DMN_HEARTBEAT_H
+#define _DMN_HEARTBEAT_H
+
+#ifdef __linux__
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+Heartbeat based stall detector. A daemon which is alive but wedged still
+holds the lock on its PID-file, so it looks like a running one. To notice
+that it has stopped serving, the main loop of the daemon (and optionally
+every worker thread) periodically bumps a heartbeat counter in a shared
+memory page, which is a file next to the PID-file
+("<pid_file_path>.heartbeat"). A watchdog thread in the daemon or an
+external checker (e.g. "dmnctl check") reports the heartbeats which have
+not changed for longer than their timeouts.
+*/
+
+/* suffix which is appended to the PID-file path to get the page path */
+#define DMN_HEARTBEAT_SUFFIX ".heartbeat"
+
+/* maximal length of the heartbeat name (including the terminating zero) */
+#define DMN_HEARTBEAT_NAME_MAX 40
+
+/* Watchdog flags. */
+enum {
+    DMN_HEARTBEAT_DEFAULT = 0,
+    DMN_HEARTBEAT_ABORT = 1 /* Call abort() after reporting a stall to get a core dump. */
+};
+
+/* A heartbeat slot in the shared page. It occupies a cache line. */
+struct dmn_heartbeat_slot {
+    uint64_t counter; /* written by the owner thread only */
+    uint32_t generation;
+    uint32_t timeout_ms; /* 0 - free slot */
+    int32_t tid;
+    uint32_t reserved;
+    char name[DMN_HEARTBEAT_NAME_MAX];
+};
+
+struct dmn_heartbeat;
+
+/*
+Stall callback. It is called once when the heartbeat stalls; the
+heartbeat is reported again only after it has been bumped.
+*/
+typedef void (*dmn_heartbeat_callback)(void *udata, const char *name,
+                                       pid_t tid, unsigned stalled_ms);
+
+/*
+* Description
+dmn_heartbeat_beat() - bump the heartbeat. This is a single relaxed
+store, so it can be called from the hottest loop. Only the thread which
+has registered the heartbeat might bump it.
+*/
+static inline void dmn_heartbeat_beat(struct dmn_heartbeat_slot *slot)
+{
+    __atomic_store_n(&slot->counter, slot->counter + 1, __ATOMIC_RELAXED);
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern struct dmn_heartbeat *dmn_heartbeat_open(const char *pid_file_path);
+/*
+* Description
+dmn_heartbeat_open() - create the heartbeat page of the daemon. It
+should be called from the daemon process which holds the PID-file.
+
+* Arguments:
+pid_file_path - full pathname to the PID-file of the daemon.
+
+* Return value
+Heartbeat object or NULL on error. In the latter case errno will be set
+accordingly.
+*/
+
+extern struct dmn_heartbeat *dmn_heartbeat_attach(const char *pid_file_path);
+/*
+* Description
+dmn_heartbeat_attach() - map the heartbeat page of a running daemon
+read-only to check its heartbeats from another process.
+
+* Arguments:
+pid_file_path - full pathname to the PID-file of the daemon.
+
+* Return value
+Heartbeat object or NULL on error (ENOENT if the daemon does not have
+a heartbeat page). In the latter case errno will be set accordingly.
+*/
+
+extern void dmn_heartbeat_close(struct dmn_heartbeat *h);
+/*
+* Description
+dmn_heartbeat_close() - stop the watchdog, unmap the page and free the
+heartbeat object. The page is removed if it has been created by
+dmn_heartbeat_open().
+*/
+
+extern pid_t dmn_heartbeat_pid(const struct dmn_heartbeat *h);
+/*
+* Description
+dmn_heartbeat_pid() - get the PID of the process which has created the
+heartbeat page. The page might be left behind by a crashed daemon, so
+it should be compared with the PID returned by checkdaemon().
+*/
+
+extern struct dmn_heartbeat_slot *dmn_heartbeat_register(struct dmn_heartbeat *h,
+                                                          const char *name,
+                                                          unsigned timeout_ms);
+/*
+* Description
+dmn_heartbeat_register() - add a heartbeat for the calling thread. The
+thread should call dmn_heartbeat_beat() at least once per timeout, so a
+loop which waits for events should use a wait timeout shorter than
+that.
+
+* Arguments:
+h - heartbeat object created by dmn_heartbeat_open();
+name - heartbeat name (shorter than DMN_HEARTBEAT_NAME_MAX);
+timeout_ms - time without heartbeats after which the thread is
+considered stalled.
+
+* Return value
+Heartbeat slot or NULL on error (ENOSPC if there are no free slots). In
+the latter case errno will be set accordingly.
+*/
+
+extern void dmn_heartbeat_unregister(struct dmn_heartbeat *h,
+                                     struct dmn_heartbeat_slot *slot);
+/*
+* Description
+dmn_heartbeat_unregister() - remove the heartbeat (e.g. before the thread
+exits).
+*/
+
+extern int dmn_heartbeat_check(struct dmn_heartbeat *h,
+                               dmn_heartbeat_callback callback, void *udata);
+/*
+* Description
+dmn_heartbeat_check() - check the heartbeats. The counters are compared
+with the ones seen by the previous call, so the function should be
+called periodically (more often than the heartbeat timeouts). A
+heartbeat is stalled when its counter has not changed for longer than
+its timeout. It must not be used while the watchdog of the same object
+runs, which owns the state of the previous check.
+
+* Arguments:
+h - heartbeat object;
+callback - function to be called for every newly stalled heartbeat,
+might be NULL;
+udata - pointer to be passed to the callback.
+
+* Return value
+Number of the stalled heartbeats or -1 on error (EBUSY if the watchdog
+of the object runs). In the latter case errno will be set accordingly.
+*/
+
+extern unsigned dmn_heartbeat_timeout(const struct dmn_heartbeat *h);
+/*
+* Description
+dmn_heartbeat_timeout() - get the longest timeout of the registered
+heartbeats, 0 if there are none.
+*/
+
+extern int dmn_heartbeat_watchdog(struct dmn_heartbeat *h, int flags,
+                                  unsigned period_ms, int report_fd);
+/*
+* Description
+dmn_heartbeat_watchdog() - start a watchdog thread in the daemon which
+checks the heartbeats every period. A stall is logged to the system log
+and the diagnostics (see dmn_heartbeat_report()) are written to the
+report descriptor. The wedged daemon might hold the locks of the C
+library, so the watchdog uses plain system calls only: the message is
+sent to /dev/log directly (with the daemon facility) and dropped if the
+logging daemon does not accept it, and the report is abandoned if the
+descriptor does not accept it within a period. So the stall is always
+escalated with DMN_HEARTBEAT_ABORT. The thread blocks all signals.
+
+* Arguments:
+h - heartbeat object created by dmn_heartbeat_open();
+flags - a bit mask of the watchdog flags, see above;
+period_ms - check period;
+report_fd - descriptor to write the diagnostics to (e.g. a log file
+opened with O_APPEND) or -1.
+
+* Return value
+0 on success or -1 on error. In the latter case errno will be set
+accordingly.
+*/
+
+extern int dmn_heartbeat_report(pid_t pid, int fd);
+/*
+* Description
+dmn_heartbeat_report() - write the diagnostics of a (stalled) process:
+the state, wait channel, current system call, kernel stack and scheduler
+statistics of every thread, and the system load. The kernel stacks are
+only available to privileged users. The function does not use stdio or
+allocate memory.
+
+* Arguments:
+pid - process to describe;
+fd - descriptor to write to.
+
+* Return value
+0 on success or -1 on error (EIO if the report could not be written).
+In the latter case errno will be set accordingly.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __linux__ */
+
+#endif /* _DMN_HEARTBEAT_H */
@@ -0,0 +1,120 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+The helpers shared by the Linux specific modules.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE /* struct ucred */
+#include <unistd.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "daemonize.h"
+#include "dmn_internal.h"
+
+long long dmn_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int dmn_socket_address(struct sockaddr_un *addr, const char *pid_file_path,
+                       const char *suffix)
+{
+    int len;
+
+    if (pid_file_path == NULL || *pid_file_path == '\0')
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s%s",
+                   pid_file_path, suffix);
+    if (len < 0 || (size_t)len >= sizeof(addr->sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return 0;
+}
+
+int dmn_check_peer(int sock)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+    {
+        return -1;
+    }
+
+    return cred.uid == geteuid() ? 0 : -1;
+}
+
+int dmn_listen_unix(int sock, const struct sockaddr_un *addr, int backlog)
+{
+    int saved_errno;
+
+    if (bind(sock, (const struct sockaddr *)addr, sizeof(*addr)) == -1)
+    {
+        return -1;
+    }
+
+    /* connect() is refused until listen(), so the permissions which
+       come from the umask do not matter in between */
+    if (chmod(addr->sun_path, S_IRWXU) == -1 || listen(sock, backlog) == -1)
+    {
+        saved_errno = errno;
+        unlink(addr->sun_path);
+        errno = saved_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+int dmn_unlink_stale(const char *pid_file_path, const char *path)
+{
+    pid_t pid;
+
+    /* The lock of the calling process is reported with its PID (open
+       file description locks), or it is not reported at all (the record
+       lock kept over exec(), see DMN_KEEP_PID_FILE_ON_EXEC). */
+    pid = checkdaemon(pid_file_path);
+    if ((pid > 0 && pid != getpid()) || (pid == -1 && errno == EAGAIN))
+    {
+        errno = EEXIST;
+        return -1;
+    }
+    else if (pid == -1)
+    {
+        return -1;
+    }
+
+    if (unlink(path) == -1 && errno != ENOENT)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+#endif /* __linux__ */
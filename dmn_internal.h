@@ -0,0 +1,88 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+*/
+
+#ifndef _DMN_INTERNAL_H
+#define _DMN_INTERNAL_H
+
+/*
+The helpers shared by the Linux specific modules. They are not a part
+of the public interface.
+*/
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern long long dmn_now_ms(void);
+/*
+* Description
+dmn_now_ms() - get the monotonic time in milliseconds.
+*/
+
+extern int dmn_socket_address(struct sockaddr_un *addr, const char *pid_file_path,
+                              const char *suffix);
+/*
+* Description
+dmn_socket_address() - get the address of the socket which is located
+next to the PID-file ("<pid_file_path><suffix>").
+
+* Return value
+0 on success or -1 on error (ENAMETOOLONG if the path does not fit). In
+the latter case errno will be set accordingly.
+*/
+
+extern int dmn_check_peer(int sock);
+/*
+* Description
+dmn_check_peer() - check that the peer of the connected Unix domain
+socket runs as the same user.
+
+* Return value
+0 if it does or -1 otherwise.
+*/
+
+extern int dmn_listen_unix(int sock, const struct sockaddr_un *addr, int backlog);
+/*
+* Description
+dmn_listen_unix() - bind the Unix domain socket to the address and
+listen on it. The socket file is accessible by the owner only
+(srwx------). The permissions are changed before listen(), so nobody
+can connect earlier, and the process umask is not touched, so it is
+safe in a multi-threaded daemon.
+
+* Return value
+0 on success or -1 on error (the socket file is removed then). In the
+latter case errno will be set accordingly.
+*/
+
+extern int dmn_unlink_stale(const char *pid_file_path, const char *path);
+/*
+* Description
+dmn_unlink_stale() - remove the file next to the PID-file (a socket,
+a shared page, etc.) which is left by a previous instance of the
+daemon. The file is removed only if the PID-file is held by the calling
+process or by nobody, so the file of another running instance is never
+removed.
+
+* Return value
+0 on success (including the case when the file does not exist) or -1
+on error (EEXIST if the PID-file is held by another process). In the
+latter case errno will be set accordingly.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __linux__ */
+
+#endif /* _DMN_INTERNAL_H */
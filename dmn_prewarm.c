@@ -0,0 +1,465 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Page cache prewarming. This implementation is Linux specific because it
+relies on madvise(MADV_POPULATE_READ).
+*/
+
+#ifdef __linux__
+#include <unistd.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "dmn_prewarm.h"
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_PROGRESS_MS 1000
+
+/* the unit of work, a multiple of the page size */
+#define CHUNK_SIZE (2u << 20)
+
+struct file_entry {
+    const char *path;
+    uint64_t size;
+    uint64_t done;
+    int failed;
+    dev_t dev;
+    ino_t ino;
+};
+
+struct prewarm {
+    struct file_entry *files;
+    size_t nfiles;
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* a worker has exited */
+    /* the next chunk */
+    size_t next_file;
+    uint64_t next_offset;
+    /* the rate cap */
+    uint64_t rate;
+    uint64_t rate_next_ns;
+    unsigned running;
+    int error;
+    struct dmn_prewarm_progress progress;
+};
+
+/* monotonic time in nanoseconds */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_files(const void *a, const void *b)
+{
+    const struct file_entry *x = a;
+    const struct file_entry *y = b;
+
+    if (x->dev != y->dev)
+    {
+        return x->dev < y->dev ? -1 : 1;
+    }
+    return x->ino < y->ino ? -1 : x->ino > y->ino;
+}
+
+/* expand the patterns into the list of the regular files */
+static int list_files(struct prewarm *p, const char *const *patterns, glob_t *g)
+{
+    size_t i, n;
+    int flags = 0;
+
+    for (; *patterns != NULL; patterns++)
+    {
+        int result = glob(*patterns, flags, NULL, g);
+
+        if (result == GLOB_NOSPACE)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        if (result == 0)
+        {
+            flags = GLOB_APPEND;
+        }
+    }
+
+    if (flags == 0)
+    {
+        return 0; /* nothing has matched */
+    }
+
+    p->files = calloc(g->gl_pathc, sizeof(*p->files));
+    if (p->files == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < g->gl_pathc; i++)
+    {
+        struct stat st;
+
+        if (stat(g->gl_pathv[i], &st) == 0 && S_ISREG(st.st_mode))
+        {
+            struct file_entry *f = &p->files[p->nfiles++];
+
+            f->path = g->gl_pathv[i];
+            f->size = (uint64_t)st.st_size;
+            f->dev = st.st_dev;
+            f->ino = st.st_ino;
+        }
+    }
+
+    /* the files in the disk order (roughly) and without duplicates */
+    qsort(p->files, p->nfiles, sizeof(*p->files), compare_files);
+    for (i = 0, n = 0; i < p->nfiles; i++)
+    {
+        if (n > 0 && compare_files(&p->files[n - 1], &p->files[i]) == 0)
+        {
+            continue;
+        }
+        p->files[n++] = p->files[i];
+    }
+    p->nfiles = n;
+
+    for (i = 0; i < p->nfiles; i++)
+    {
+        p->progress.bytes_total += p->files[i].size;
+        if (p->files[i].size == 0)
+        {
+            p->progress.files_done++;
+        }
+    }
+    p->progress.files_total = p->nfiles;
+    return 0;
+}
+
+/* read the chunk into the page cache */
+static int populate_chunk(int fd, uint64_t offset, size_t len, char **buf)
+{
+    size_t done;
+    void *addr;
+    int saved_errno;
+    int result;
+
+    addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, (off_t)offset);
+    if (addr != MAP_FAILED)
+    {
+        /* the pages are read synchronously, but not copied */
+        result = madvise(addr, len, MADV_POPULATE_READ);
+        saved_errno = errno;
+        munmap(addr, len);
+        if (result == 0)
+        {
+            return 0;
+        }
+        else if (saved_errno != EINVAL) /* EINVAL: Linux older than 5.14 */
+        {
+            errno = saved_errno;
+            return -1;
+        }
+    }
+
+    /* the file system does not support mmap() or the kernel is too old */
+    if (*buf == NULL && (*buf = malloc(CHUNK_SIZE)) == NULL)
+    {
+        return -1;
+    }
+
+    for (done = 0; done < len; )
+    {
+        ssize_t n = pread(fd, *buf, len - done, (off_t)(offset + done));
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        else if (n == 0) /* truncated in the meantime */
+        {
+            break;
+        }
+        done += (size_t)n;
+    }
+
+    return 0;
+}
+
+/* mark the file as failed, the lock should be held */
+static void file_failed(struct prewarm *p, struct file_entry *f, int error)
+{
+    if (!f->failed)
+    {
+        f->failed = 1;
+        p->progress.files_failed++;
+        if (p->error == 0)
+        {
+            p->error = error;
+        }
+    }
+}
+
+/* get the next chunk and the time to wait for the rate cap, the lock should be held */
+static struct file_entry *next_chunk(struct prewarm *p, uint64_t *offset, size_t *len, uint64_t *wait_ns)
+{
+    while (p->next_file < p->nfiles)
+    {
+        struct file_entry *f = &p->files[p->next_file];
+
+        if (f->failed || p->next_offset >= f->size)
+        {
+            p->next_file++;
+            p->next_offset = 0;
+            continue;
+        }
+
+        *offset = p->next_offset;
+        *len = f->size - *offset < CHUNK_SIZE ? (size_t)(f->size - *offset) : CHUNK_SIZE;
+        p->next_offset += *len;
+
+        *wait_ns = 0;
+        if (p->rate != 0)
+        {
+            uint64_t now = now_ns();
+
+            if (p->rate_next_ns < now)
+            {
+                p->rate_next_ns = now;
+            }
+            *wait_ns = p->rate_next_ns - now;
+            p->rate_next_ns += (uint64_t)*len * 1000000000ull / p->rate;
+        }
+        return f;
+    }
+
+    return NULL;
+}
+
+static void *prewarm_thread(void *arg)
+{
+    struct prewarm *p = arg;
+    struct file_entry *current = NULL;
+    char *buf = NULL;
+    sigset_t mask;
+    int fd = -1;
+
+    /* the signals are handled by the daemon's own threads */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    pthread_mutex_lock(&p->lock);
+    for (;;)
+    {
+        struct file_entry *f;
+        uint64_t offset, wait_ns;
+        size_t len;
+        int result;
+
+        f = next_chunk(p, &offset, &len, &wait_ns);
+        if (f == NULL)
+        {
+            break;
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        if (wait_ns > 0)
+        {
+            struct timespec ts;
+
+            ts.tv_sec = (time_t)(wait_ns / 1000000000ull);
+            ts.tv_nsec = (long)(wait_ns % 1000000000ull);
+            while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+        }
+
+        if (f != current)
+        {
+            if (fd != -1)
+            {
+                close(fd);
+            }
+            current = f;
+            fd = open(f->path, O_RDONLY | O_CLOEXEC);
+        }
+        result = fd == -1 ? -1 : populate_chunk(fd, offset, len, &buf);
+
+        pthread_mutex_lock(&p->lock);
+        if (result == -1)
+        {
+            file_failed(p, f, errno);
+            continue;
+        }
+
+        f->done += len;
+        p->progress.bytes_done += len;
+        if (f->done == f->size)
+        {
+            p->progress.files_done++;
+        }
+    }
+
+    p->running--;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    free(buf);
+    return NULL;
+}
+
+/* run the threads and report the progress until they are done */
+static int run_threads(struct prewarm *p, const struct dmn_prewarm_options *options, uint64_t start)
+{
+    unsigned nthreads = options->threads != 0 ? options->threads : DEFAULT_THREADS;
+    unsigned progress_ms = options->progress_ms != 0 ? options->progress_ms : DEFAULT_PROGRESS_MS;
+    uint64_t chunks = p->progress.bytes_total / CHUNK_SIZE + p->nfiles;
+    pthread_t threads[DMN_PREWARM_MAX_THREADS];
+    unsigned i, started;
+    int result = 0;
+
+    if (nthreads > DMN_PREWARM_MAX_THREADS)
+    {
+        nthreads = DMN_PREWARM_MAX_THREADS;
+    }
+    if (nthreads > chunks)
+    {
+        nthreads = (unsigned)chunks;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    for (started = 0; started < nthreads; started++)
+    {
+        result = pthread_create(&threads[started], NULL, prewarm_thread, p);
+        if (result != 0)
+        {
+            break;
+        }
+        p->running++;
+    }
+
+    if (started == 0 && nthreads > 0)
+    {
+        pthread_mutex_unlock(&p->lock);
+        errno = result;
+        return -1;
+    }
+
+    while (p->running > 0)
+    {
+        uint64_t deadline = now_ns() + (uint64_t)progress_ms * 1000000ull;
+        struct timespec ts;
+
+        ts.tv_sec = (time_t)(deadline / 1000000000ull);
+        ts.tv_nsec = (long)(deadline % 1000000000ull);
+        if (pthread_cond_timedwait(&p->cond, &p->lock, &ts) == ETIMEDOUT &&
+            options->callback != NULL)
+        {
+            struct dmn_prewarm_progress progress = p->progress;
+
+            pthread_mutex_unlock(&p->lock);
+            progress.elapsed_ns = now_ns() - start;
+            options->callback(options->udata, &progress);
+            pthread_mutex_lock(&p->lock);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    return 0;
+}
+
+int dmn_prewarm(const char *const *patterns,
+                const struct dmn_prewarm_options *options,
+                struct dmn_prewarm_progress *result)
+{
+    static const struct dmn_prewarm_options default_options;
+    uint64_t start = now_ns();
+    pthread_condattr_t attr;
+    struct prewarm p;
+    glob_t g;
+    int status = 0;
+
+    if (patterns == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (options == NULL)
+    {
+        options = &default_options;
+    }
+
+    memset(&p, 0, sizeof(p));
+    memset(&g, 0, sizeof(g));
+    p.rate = options->rate;
+
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&p.cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (list_files(&p, patterns, &g) == -1 || run_threads(&p, options, start) == -1)
+    {
+        status = -1;
+        p.error = errno;
+    }
+    else if (p.progress.files_failed > 0)
+    {
+        status = -1;
+    }
+
+    p.progress.elapsed_ns = now_ns() - start;
+    p.progress.finished = 1;
+    if (options->callback != NULL)
+    {
+        options->callback(options->udata, &p.progress);
+    }
+    if (result != NULL)
+    {
+        *result = p.progress;
+    }
+
+    pthread_cond_destroy(&p.cond);
+    pthread_mutex_destroy(&p.lock);
+    free(p.files);
+    globfree(&g);
+
+    if (status == -1)
+    {
+        errno = p.error;
+    }
+    return status;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,86 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+*/
+
+#ifndef _DMN_PREWARM_H
+#define _DMN_PREWARM_H
+
+#ifdef __linux__
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Page cache prewarming. A daemon which serves its data from large files
+serves the first requests after a restart from the disk, as the files
+are not in the page cache yet. dmn_prewarm() reads the files into the
+page cache in parallel before the daemon reports its readiness (or at
+any other moment): the files are split into chunks which are populated
+by a bounded pool of threads with madvise(MADV_POPULATE_READ) on a
+temporary mapping (or with read(2) on older kernels), so every chunk is
+in the page cache when it is counted as done. The read rate can be
+capped to leave the disk bandwidth for the other services.
+*/
+
+/* maximal number of the reading threads, more threads are not started */
+#define DMN_PREWARM_MAX_THREADS 64
+
+/* the progress of the prewarming */
+struct dmn_prewarm_progress {
+    size_t files_total;   /* files matched by the patterns */
+    size_t files_done;    /* files read completely */
+    size_t files_failed;  /* files which could not be read */
+    uint64_t bytes_total;
+    uint64_t bytes_done;
+    uint64_t elapsed_ns;
+    int finished;         /* 1 for the final report */
+};
+
+/* the progress callback, it is called from the thread which has called dmn_prewarm() */
+typedef void (*dmn_prewarm_callback)(void *udata, const struct dmn_prewarm_progress *progress);
+
+/* the options, the fields which are 0 or NULL take the default values */
+struct dmn_prewarm_options {
+    unsigned threads;              /* number of the reading threads (default: 4) */
+    uint64_t rate;                 /* read rate cap in bytes per second (default: no cap) */
+    unsigned progress_ms;          /* period of the progress reports (default: 1000) */
+    dmn_prewarm_callback callback; /* progress callback */
+    void *udata;                   /* user data of the callback */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int dmn_prewarm(const char *const *patterns,
+                       const struct dmn_prewarm_options *options,
+                       struct dmn_prewarm_progress *result);
+/*
+* Description
+dmn_prewarm() - read the files into the page cache and wait for the
+completion. The progress callback is called periodically and once
+after the completion.
+
+* Arguments:
+patterns - NULL terminated array of the file paths or glob(3) patterns.
+Directories and the other non-regular files are skipped, a pattern
+which matches nothing is not an error;
+options - the options or NULL for the defaults;
+result - the final progress (can be NULL).
+
+* Return value
+0 if all the files have been read or -1 on error (e.g. if some of the
+files could not be read, the others are read anyway). In the latter case
+errno will be set accordingly.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __linux__ */
+
+#endif /* _DMN_PREWARM_H */
@@ -0,0 +1,355 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Memory sharing between daemon instances. This implementation is Linux
+specific.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE /* F_OFD_SETLKW */
+#include <unistd.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+#include "dmn_shared.h"
+
+#ifndef PR_SET_MEMORY_MERGE
+#define PR_SET_MEMORY_MERGE 67
+#endif
+
+/* "DMNSHARE" */
+#define DATASET_MAGIC 0x45524148534e4d44ull
+
+/* suffixes of the lock file and of the dataset which is being populated */
+#define LOCK_SUFFIX ".lock"
+#define TMP_SUFFIX ".tmp"
+
+/* The header follows the data, so that the data starts at the beginning
+   of a (huge) page. */
+struct dataset_header {
+    uint64_t magic;
+    uint64_t layout;
+    uint64_t size;
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct dmn_shared {
+    void *data;
+    size_t size;
+    size_t map_size;
+    int populated;
+};
+
+/* offset of the header in the dataset file */
+static size_t header_offset(size_t size)
+{
+    return (size + 63) & ~(size_t)63;
+}
+
+/* size of the dataset file, rounded up to the file system block size */
+static int dataset_size(int fd, size_t size, size_t *map_size)
+{
+    struct statfs st;
+    size_t block;
+
+    if (fstatfs(fd, &st) == -1)
+    {
+        return -1;
+    }
+
+    block = st.f_bsize > 0 ? (size_t)st.f_bsize : (size_t)sysconf(_SC_PAGESIZE);
+    *map_size = (header_offset(size) + sizeof(struct dataset_header) + block - 1) / block * block;
+    return 0;
+}
+
+/* map the existing dataset, ESTALE if it has different identifiers */
+static int map_dataset(struct dmn_shared *s, const char *path, uint32_t version, uint64_t layout)
+{
+    const struct dataset_header *header;
+    struct stat st;
+    int saved_errno;
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (fstat(fd, &st) == -1 || dataset_size(fd, s->size, &s->map_size) == -1)
+    {
+        goto error;
+    }
+    if ((size_t)st.st_size != s->map_size)
+    {
+        errno = ESTALE;
+        goto error;
+    }
+
+    data = mmap(NULL, s->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        goto error;
+    }
+    close(fd);
+
+    header = (const struct dataset_header *)((char *)data + header_offset(s->size));
+    if (header->magic != DATASET_MAGIC || header->size != s->size ||
+        header->version != version || header->layout != layout)
+    {
+        munmap(data, s->map_size);
+        errno = ESTALE;
+        return -1;
+    }
+
+    s->data = data;
+    return 0;
+
+error:
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+}
+
+/* build the dataset under the temporary name and move it in place */
+static int populate_dataset(struct dmn_shared *s, const char *path, const char *tmp_path,
+                            uint32_t version, uint64_t layout,
+                            dmn_shared_init_func init, void *udata)
+{
+    struct dataset_header *header;
+    int saved_errno;
+    void *data = MAP_FAILED;
+    int fd;
+
+    /* left by a crashed instance (the lock is held) */
+    unlink(tmp_path);
+    fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (fchmod(fd, 0644) == -1 || dataset_size(fd, s->size, &s->map_size) == -1 ||
+        ftruncate(fd, (off_t)s->map_size) == -1)
+    {
+        goto error;
+    }
+
+    data = mmap(NULL, s->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED || init(udata, data, s->size) == -1)
+    {
+        goto error;
+    }
+
+    header = (struct dataset_header *)((char *)data + header_offset(s->size));
+    header->layout = layout;
+    header->size = s->size;
+    header->version = version;
+    header->magic = DATASET_MAGIC;
+    munmap(data, s->map_size);
+    close(fd);
+
+    /* the old dataset (if any) stays mapped by its users */
+    if (rename(tmp_path, path) == -1)
+    {
+        saved_errno = errno;
+        unlink(tmp_path);
+        errno = saved_errno;
+        return -1;
+    }
+
+    return 0;
+
+error:
+    saved_errno = errno;
+    if (data != MAP_FAILED)
+    {
+        munmap(data, s->map_size);
+    }
+    close(fd);
+    unlink(tmp_path);
+    errno = saved_errno;
+    return -1;
+}
+
+/* take the lock which serializes the populating instances */
+static int lock_dataset(const char *lock_path)
+{
+    struct flock fl;
+    int saved_errno;
+    int fd;
+
+    fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_pid = 0; /* must be 0 for open file description locks */
+
+    while (fcntl(fd, F_OFD_SETLKW, &fl) == -1)
+    {
+        if (errno != EINTR)
+        {
+            saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+struct dmn_shared *dmn_shared_open(const char *path, size_t size,
+                                   uint32_t version, uint64_t layout,
+                                   dmn_shared_init_func init, void *udata)
+{
+    struct dmn_shared *s;
+    char *lock_path = NULL, *tmp_path = NULL;
+    size_t len;
+    int saved_errno;
+    int lock_fd = -1;
+    int result;
+
+    if (path == NULL || *path == '\0' || size == 0 || init == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    s = calloc(1, sizeof(*s));
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    s->size = size;
+
+    /* the dataset is usually in place already */
+    if (map_dataset(s, path, version, layout) == 0)
+    {
+        return s;
+    }
+    if (errno != ENOENT && errno != ESTALE)
+    {
+        goto error;
+    }
+
+    len = strlen(path) + sizeof(LOCK_SUFFIX);
+    lock_path = malloc(len);
+    tmp_path = malloc(len);
+    if (lock_path == NULL || tmp_path == NULL)
+    {
+        goto error;
+    }
+    snprintf(lock_path, len, "%s%s", path, LOCK_SUFFIX);
+    snprintf(tmp_path, len, "%s%s", path, TMP_SUFFIX);
+
+    lock_fd = lock_dataset(lock_path);
+    if (lock_fd == -1)
+    {
+        goto error;
+    }
+
+    /* it might have been populated while we were waiting for the lock */
+    result = map_dataset(s, path, version, layout);
+    if (result == -1 && (errno == ENOENT || errno == ESTALE))
+    {
+        result = populate_dataset(s, path, tmp_path, version, layout, init, udata);
+        if (result == 0)
+        {
+            s->populated = 1;
+            result = map_dataset(s, path, version, layout);
+        }
+    }
+    if (result == -1)
+    {
+        goto error;
+    }
+
+    close(lock_fd); /* releases the lock */
+    free(lock_path);
+    free(tmp_path);
+    return s;
+
+error:
+    saved_errno = errno;
+    if (lock_fd != -1)
+    {
+        close(lock_fd);
+    }
+    free(lock_path);
+    free(tmp_path);
+    free(s);
+    errno = saved_errno;
+    return NULL;
+}
+
+void dmn_shared_close(struct dmn_shared *s)
+{
+    if (s == NULL)
+    {
+        return;
+    }
+
+    munmap(s->data, s->map_size);
+    free(s);
+}
+
+const void *dmn_shared_data(const struct dmn_shared *s)
+{
+    return s->data;
+}
+
+size_t dmn_shared_size(const struct dmn_shared *s)
+{
+    return s->size;
+}
+
+int dmn_shared_populated(const struct dmn_shared *s)
+{
+    return s->populated;
+}
+
+int dmn_shared_merge(void *addr, size_t len)
+{
+    uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)addr + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = ((uintptr_t)addr + len) & ~(page_size - 1);
+
+    if (end <= start)
+    {
+        return 0; /* no whole pages */
+    }
+
+    return madvise((void *)start, end - start, MADV_MERGEABLE);
+}
+
+int dmn_shared_merge_all(void)
+{
+    return prctl(PR_SET_MEMORY_MERGE, 1, 0, 0, 0);
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,138 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+*/
+
+#ifndef _DMN_SHARED_H
+#define _DMN_SHARED_H
+
+#ifdef __linux__
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Memory sharing between instances of the same daemon. Many instances
+which load the same read-only data (e.g. lookup tables) keep a copy of
+it each. There are two ways to keep only one copy in memory:
+
+1. Shared datasets. The data is built once into a file on a memory file
+   system (tmpfs, e.g. "/dev/shm/mydaemon-tables-v3", or hugetlbfs) by
+   the first instance, and every instance maps it read-only, so all of
+   them use the same pages. The file is populated under a temporary
+   name and renamed when it is complete, so the other instances never
+   see a partial dataset. The dataset is identified by its size and the
+   version and layout identifiers supplied by the daemon; a dataset with
+   different identifiers is rebuilt (the instances which map the old one
+   keep using it).
+
+   The file holds the memory while it exists, even when no instance is
+   running. It should be removed (e.g. by the service stop script) when
+   it is not needed anymore.
+
+2. KSM (Kernel Samepage Merging). The daemon marks the memory regions
+   which are likely to be identical in all instances as mergeable (or
+   the whole process, since Linux 6.4), and the kernel thread "ksmd"
+   scans them and merges identical pages copy-on-write. It requires no
+   cooperation between the instances, but the merging takes time
+   (depending on the scan rate) and costs CPU time of ksmd. KSM should
+   be enabled by the administrator ("/sys/kernel/mm/ksm/run").
+*/
+
+/* the dataset initializer, returns 0 on success or -1 on error (errno should be set) */
+typedef int (*dmn_shared_init_func)(void *udata, void *data, size_t size);
+
+struct dmn_shared;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern struct dmn_shared *dmn_shared_open(const char *path, size_t size,
+                                          uint32_t version, uint64_t layout,
+                                          dmn_shared_init_func init, void *udata);
+/*
+* Description
+dmn_shared_open() - map the shared dataset read-only. If it does not
+exist or has different identifiers, it is created and populated by
+calling the initializer. Concurrent callers wait for the one which
+populates the dataset (the lock file "<path>.lock" is used for that).
+
+* Arguments:
+path - full pathname to the dataset file on tmpfs or hugetlbfs. The
+file size is rounded up to the file system block (huge page) size;
+size - size of the data;
+version, layout - identifiers of the data format;
+init - the initializer. It receives the writable mapping of the new
+dataset, which is filled with zeros;
+udata - user data for the initializer.
+
+* Return value
+Dataset object or NULL on error (including the initializer failure). In
+the latter case errno will be set accordingly.
+*/
+
+extern void dmn_shared_close(struct dmn_shared *s);
+/*
+* Description
+dmn_shared_close() - unmap the dataset and free the dataset object. The
+dataset file is left in place for the other instances.
+*/
+
+extern const void *dmn_shared_data(const struct dmn_shared *s);
+/*
+* Description
+dmn_shared_data() - get the address of the (read-only) data.
+*/
+
+extern size_t dmn_shared_size(const struct dmn_shared *s);
+/*
+* Description
+dmn_shared_size() - get the size of the data.
+*/
+
+extern int dmn_shared_populated(const struct dmn_shared *s);
+/*
+* Description
+dmn_shared_populated() - check if the dataset has been populated by
+the calling process.
+
+* Return value
+1 if the initializer has been called by dmn_shared_open(), 0 otherwise.
+*/
+
+extern int dmn_shared_merge(void *addr, size_t len);
+/*
+* Description
+dmn_shared_merge() - mark the memory region as mergeable by KSM (see
+madvise(2), MADV_MERGEABLE). Only the pages which are entirely inside
+the region are marked, so the region should be page aligned (e.g.
+allocated with mmap(2) or aligned_alloc()) to be merged entirely. The
+region should be private anonymous memory.
+
+* Return value
+0 on success or -1 on error (EINVAL if the kernel has no KSM support).
+In the latter case errno will be set accordingly.
+*/
+
+extern int dmn_shared_merge_all(void);
+/*
+* Description
+dmn_shared_merge_all() - make all the anonymous memory of the process
+mergeable by KSM, including the memory allocated later (see prctl(2),
+PR_SET_MEMORY_MERGE). The setting is inherited by the forked processes.
+
+* Return value
+0 on success or -1 on error (EINVAL on kernels older than 6.4). In the
+latter case errno will be set accordingly.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __linux__ */
+
+#endif /* _DMN_SHARED_H */
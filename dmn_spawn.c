@@ -0,0 +1,378 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Helper process spawner. This implementation is Linux specific because
+it relies on pidfds and PR_SET_CHILD_SUBREAPER.
+*/
+
+#ifdef __linux__
+#include <unistd.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <spawn.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+#include <sys/signalfd.h>
+
+#include "dmn_spawn.h"
+
+/* maximal number of the events handled by a dmn_spawner_process() call */
+#define EVENTS_PER_CALL 64
+
+extern char **environ;
+
+struct child {
+    pid_t pid;
+    int pidfd;
+    dmn_spawn_callback callback;
+    void *udata;
+    struct child *prev;
+    struct child *next;
+};
+
+struct dmn_spawner {
+    int flags;
+    int epfd;
+    int sigfd;   /* SIGCHLD, the orphans are not tracked via pidfds */
+    int blocked; /* SIGCHLD has been blocked by the spawner */
+    struct child *children;
+    size_t nchildren;
+};
+
+static struct child *find_child(struct dmn_spawner *sp, pid_t pid)
+{
+    struct child *c;
+
+    for (c = sp->children; c != NULL; c = c->next)
+    {
+        if (c->pid == pid)
+        {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static void remove_child(struct dmn_spawner *sp, struct child *c)
+{
+    /* closing the pidfd removes it from the epoll set */
+    close(c->pidfd);
+
+    if (c->prev != NULL)
+    {
+        c->prev->next = c->next;
+    }
+    else
+    {
+        sp->children = c->next;
+    }
+    if (c->next != NULL)
+    {
+        c->next->prev = c->prev;
+    }
+
+    sp->nchildren--;
+    free(c);
+}
+
+/* forget the reaped child and call its callback */
+static void child_exited(struct dmn_spawner *sp, struct child *c, int status)
+{
+    dmn_spawn_callback callback = c->callback;
+    void *udata = c->udata;
+    pid_t pid = c->pid;
+
+    /* the callback might spawn new children */
+    remove_child(sp, c);
+    if (callback != NULL)
+    {
+        callback(udata, pid, status);
+    }
+}
+
+/* wake up on SIGCHLD to reap the orphaned descendants */
+static int watch_sigchld(struct dmn_spawner *sp)
+{
+    struct epoll_event ev;
+    sigset_t mask, old_mask;
+
+    /* the signal is received only via the signalfd when it is blocked */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (pthread_sigmask(SIG_BLOCK, &mask, &old_mask) != 0)
+    {
+        return -1;
+    }
+    sp->blocked = !sigismember(&old_mask, SIGCHLD);
+
+    sp->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sp->sigfd == -1)
+    {
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* the signalfd */
+    return epoll_ctl(sp->epfd, EPOLL_CTL_ADD, sp->sigfd, &ev);
+}
+
+/* close the descriptors and restore the signal mask */
+static void free_spawner(struct dmn_spawner *sp)
+{
+    sigset_t mask;
+
+    if (sp->sigfd != -1)
+    {
+        close(sp->sigfd);
+    }
+    if (sp->blocked)
+    {
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+    }
+    if (sp->epfd != -1)
+    {
+        close(sp->epfd);
+    }
+    free(sp);
+}
+
+struct dmn_spawner *dmn_spawner_open(int flags)
+{
+    struct dmn_spawner *sp;
+    int saved_errno;
+
+    sp = calloc(1, sizeof(*sp));
+    if (sp == NULL)
+    {
+        return NULL;
+    }
+    sp->flags = flags;
+    sp->sigfd = -1;
+
+    sp->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (sp->epfd == -1)
+    {
+        goto error;
+    }
+
+    if ((flags & DMN_SPAWN_SUBREAPER) &&
+        (watch_sigchld(sp) == -1 || prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) == -1))
+    {
+        goto error;
+    }
+
+    return sp;
+
+error:
+    saved_errno = errno;
+    free_spawner(sp);
+    errno = saved_errno;
+    return NULL;
+}
+
+void dmn_spawner_close(struct dmn_spawner *sp)
+{
+    if (sp == NULL)
+    {
+        return;
+    }
+
+    while (sp->children != NULL)
+    {
+        remove_child(sp, sp->children);
+    }
+
+    free_spawner(sp);
+}
+
+pid_t dmn_spawn(struct dmn_spawner *sp,
+                const char *file, char *const argv[], char *const envp[],
+                const posix_spawn_file_actions_t *file_actions,
+                dmn_spawn_callback callback, void *udata)
+{
+    posix_spawnattr_t attr;
+    struct epoll_event ev;
+    struct child *c;
+    sigset_t sigset;
+    pid_t pid;
+    int result;
+
+    if (sp == NULL || file == NULL || argv == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    c = calloc(1, sizeof(*c));
+    if (c == NULL)
+    {
+        return -1;
+    }
+
+    /* The daemon usually blocks or handles some signals, the helper
+       starts with the empty signal mask and default dispositions. */
+    if ((result = posix_spawnattr_init(&attr)) != 0)
+    {
+        free(c);
+        errno = result;
+        return -1;
+    }
+    sigemptyset(&sigset);
+    posix_spawnattr_setsigmask(&attr, &sigset);
+    sigfillset(&sigset);
+    posix_spawnattr_setsigdefault(&attr, &sigset);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    /* glibc implements posix_spawn() with clone(CLONE_VM | CLONE_VFORK) */
+    result = posix_spawnp(&pid, file, file_actions, &attr, argv,
+                          envp != NULL ? envp : environ);
+    posix_spawnattr_destroy(&attr);
+    if (result != 0)
+    {
+        free(c);
+        errno = result;
+        return -1;
+    }
+
+    /* The child cannot be reaped by anyone but us, so its
+       PID cannot be reused until then (it might be a zombie). */
+    c->pid = pid;
+    c->callback = callback;
+    c->udata = udata;
+    c->pidfd = pidfd_open(pid, 0);
+    if (c->pidfd == -1)
+    {
+        goto error;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    if (epoll_ctl(sp->epfd, EPOLL_CTL_ADD, c->pidfd, &ev) == -1)
+    {
+        goto error;
+    }
+
+    c->next = sp->children;
+    if (sp->children != NULL)
+    {
+        sp->children->prev = c;
+    }
+    sp->children = c;
+    sp->nchildren++;
+
+    return pid;
+
+error:
+    {
+        /* the child cannot be tracked: do not leave it behind */
+        int saved_errno = errno;
+        if (c->pidfd != -1)
+        {
+            close(c->pidfd);
+        }
+        kill(pid, SIGKILL);
+        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+            ;
+        free(c);
+        errno = saved_errno;
+        return -1;
+    }
+}
+
+int dmn_spawner_fd(const struct dmn_spawner *sp)
+{
+    return sp->epfd;
+}
+
+int dmn_spawner_process(struct dmn_spawner *sp)
+{
+    struct epoll_event events[EVENTS_PER_CALL];
+    int reaped = 0;
+    int status;
+    pid_t pid;
+    int n;
+    int i;
+
+    do
+    {
+        n = epoll_wait(sp->epfd, events, EVENTS_PER_CALL, 0);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1)
+    {
+        return -1;
+    }
+
+    /* the pidfds of the exited children are readable */
+    for (i = 0; i < n; i++)
+    {
+        struct child *c = events[i].data.ptr;
+
+        if (c == NULL) /* SIGCHLD, see below */
+        {
+            struct signalfd_siginfo si;
+            while (read(sp->sigfd, &si, sizeof(si)) == sizeof(si))
+                ;
+            continue;
+        }
+
+        pid = waitpid(c->pid, &status, WNOHANG);
+        if (pid == c->pid)
+        {
+            child_exited(sp, c, status);
+            reaped++;
+        }
+        else if (pid == -1 && errno == ECHILD)
+        {
+            /* reaped elsewhere (or SIGCHLD is ignored), the status
+               is lost, but the pidfd would stay readable forever */
+            child_exited(sp, c, DMN_SPAWN_STATUS_UNKNOWN);
+            reaped++;
+        }
+    }
+
+    /* The other children of the daemon (e.g. of system()) are reaped
+       by their owners, unless the daemon is a subreaper. */
+    if (!(sp->flags & DMN_SPAWN_SUBREAPER))
+    {
+        return reaped;
+    }
+
+    /* reap the orphaned descendants and the children which
+       have exited after epoll_wait() */
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        struct child *c = find_child(sp, pid);
+        if (c != NULL)
+        {
+            child_exited(sp, c, status);
+        }
+        reaped++;
+    }
+
+    return reaped;
+}
+
+size_t dmn_spawner_count(const struct dmn_spawner *sp)
+{
+    return sp->nchildren;
+}
+
+#endif /* __linux__ */
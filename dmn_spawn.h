@@ -0,0 +1,132 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+*/
+
+#ifndef _DMN_SPAWN_H
+#define _DMN_SPAWN_H
+
+#ifdef __linux__
+#include <sys/types.h>
+#include <spawn.h>
+
+/* Spawner creation flags. */
+enum {
+    DMN_SPAWN_DEFAULT = 0,
+    DMN_SPAWN_SUBREAPER = 1 /* Become a subreaper and reap all the children of the daemon, including the orphaned descendants of the helpers. */
+};
+
+struct dmn_spawner;
+
+/* the status of a child which has been reaped by someone else */
+#define DMN_SPAWN_STATUS_UNKNOWN (-1)
+
+/*
+Child exit callback. The status is the value stored by waitpid(), it
+should be examined with WIFEXITED(), WEXITSTATUS(), etc. It is
+DMN_SPAWN_STATUS_UNKNOWN if the child has been reaped outside of the
+spawner (e.g. SIGCHLD is ignored), no WIF*() macro is true for it.
+*/
+typedef void (*dmn_spawn_callback)(void *udata, pid_t pid, int status);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern struct dmn_spawner *dmn_spawner_open(int flags);
+/*
+* Description
+dmn_spawner_open() - create a helper process spawner. By default only
+the children spawned by the spawner are reaped, so the other children
+of the daemon (e.g. of system(), popen() or dmn_zygote.h) are left to
+their owners. With DMN_SPAWN_SUBREAPER the calling process becomes a
+child subreaper (see PR_SET_CHILD_SUBREAPER in prctl(2)), so the
+orphaned descendants of the helpers are reparented to the daemon, and
+the spawner reaps them along with the helpers. In this case the
+spawner should be the only code in the daemon which reaps children.
+SIGCHLD is blocked in the calling thread and received via a signalfd,
+so that an exited orphan wakes up the descriptor; it should be blocked
+in all the other threads too (e.g. the spawner should be created before
+them).
+
+* Arguments:
+flags - a bit mask of the spawner creation flags, see above.
+
+* Return value
+Spawner object or NULL on error. In the latter case errno will be set
+accordingly.
+*/
+
+extern void dmn_spawner_close(struct dmn_spawner *sp);
+/*
+* Description
+dmn_spawner_close() - stop tracking the children and free the spawner.
+The running children are not terminated and no callbacks are called.
+*/
+
+extern pid_t dmn_spawn(struct dmn_spawner *sp,
+                       const char *file, char *const argv[], char *const envp[],
+                       const posix_spawn_file_actions_t *file_actions,
+                       dmn_spawn_callback callback, void *udata);
+/*
+* Description
+dmn_spawn() - start a helper process. The process is created with
+posix_spawn(3) (which uses vfork semantics and does not copy the page
+tables of the daemon), so the cost does not depend on the daemon size.
+The child starts with the empty signal mask and the default signal
+dispositions regardless of the daemon's signal handling.
+
+* Arguments:
+sp - spawner object;
+file - program to execute, searched in PATH if it does not contain a slash;
+argv - NULL-terminated argument list;
+envp - NULL-terminated environment or NULL to use the daemon's environment;
+file_actions - file actions (e.g. redirections) for posix_spawn() or NULL;
+callback - function to be called by dmn_spawner_process() after the
+child exits, might be NULL;
+udata - pointer to be passed to the callback.
+
+* Return value
+PID of the child or -1 on error. In the latter case errno will be set
+accordingly.
+*/
+
+extern int dmn_spawner_fd(const struct dmn_spawner *sp);
+/*
+* Description
+dmn_spawner_fd() - get the file descriptor which becomes readable when
+a child exits (it is an epoll(7) descriptor for the children's pidfds
+and, with DMN_SPAWN_SUBREAPER, for SIGCHLD).
+It should be added to the event loop of the daemon; dmn_spawner_process()
+should be called when it is readable.
+*/
+
+extern int dmn_spawner_process(struct dmn_spawner *sp);
+/*
+* Description
+dmn_spawner_process() - reap the exited children and call their
+callbacks. It never blocks. With DMN_SPAWN_SUBREAPER the orphaned
+descendants (see dmn_spawner_open()) are reaped too.
+
+* Return value
+Number of the reaped children or -1 on a fatal error. In the latter case
+errno will be set accordingly.
+*/
+
+extern size_t dmn_spawner_count(const struct dmn_spawner *sp);
+/*
+* Description
+dmn_spawner_count() - get the number of the running children which are
+spawned by the spawner.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __linux__ */
+
+#endif /* _DMN_SPAWN_H */
@@ -0,0 +1,569 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Resource usage sampler. This implementation is Linux specific because
+the memory and descriptor usage is taken from procfs.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE /* pipe2(), getdents64() */
+#include <unistd.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/prctl.h>
+
+#include "dmn_usage.h"
+#include "dmn_internal.h"
+
+/* "DMNUSAGE" */
+#define RING_MAGIC 0x45474153554e4d44ull
+/* the slots follow the ring header */
+#define SLOTS_OFFSET 64
+
+/* the header of the ring */
+struct ring_header {
+    uint64_t magic;
+    int32_t pid;
+    uint32_t capacity;
+    uint32_t period_ms;
+    uint32_t flags;
+    uint64_t head;       /* number of the samples taken */
+    uint64_t sampler_ns; /* CPU time of the sampler thread */
+};
+
+/* A slot of the ring. The sequence counter of the sample number N is
+   2N+1 while the sample is written and 2N+2 after that. */
+struct ring_slot {
+    uint64_t seq;
+    struct dmn_usage_sample sample;
+};
+
+struct dmn_usage {
+    struct ring_header *header;
+    struct ring_slot *slots;
+    size_t size;
+    uint32_t capacity;
+    /* the owner side */
+    int owner;
+    dev_t dev;
+    ino_t ino;
+    /* the sampler */
+    pthread_t thread;
+    int sampler;
+    int statm_fd; /* /proc/self/statm */
+    int smaps_fd; /* /proc/self/smaps_rollup */
+    int fd_dir;   /* /proc/self/fd */
+    int own_fds;  /* descriptors of the sampler, they are not counted */
+    int stop_pipe[2];
+    char path[];
+};
+
+static uint64_t timespec_ns(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000ull + (uint64_t)ts->tv_nsec;
+}
+
+static uint64_t timeval_ns(const struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * 1000000000ull + (uint64_t)tv->tv_usec * 1000ull;
+}
+
+/* allocate the sampler object with the ring path */
+static struct dmn_usage *alloc_usage(const char *pid_file_path)
+{
+    struct dmn_usage *u;
+    size_t len;
+
+    if (pid_file_path == NULL || *pid_file_path == '\0')
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    len = strlen(pid_file_path) + sizeof(DMN_USAGE_SUFFIX);
+    u = calloc(1, sizeof(*u) + len);
+    if (u == NULL)
+    {
+        return NULL;
+    }
+
+    snprintf(u->path, len, "%s%s", pid_file_path, DMN_USAGE_SUFFIX);
+    u->statm_fd = u->smaps_fd = u->fd_dir = -1;
+    u->stop_pipe[0] = u->stop_pipe[1] = -1;
+    return u;
+}
+
+/* size of the ring file, rounded up to pages */
+static size_t ring_size(uint32_t capacity)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = SLOTS_OFFSET + (size_t)capacity * sizeof(struct ring_slot);
+
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+/* read a procfs file from the beginning, the descriptor is reused */
+static ssize_t pread_proc(int fd, char *buf, size_t size)
+{
+    ssize_t n;
+
+    do
+    {
+        n = pread(fd, buf, size - 1, 0);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1)
+    {
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/* get the RSS from /proc/self/statm, it is much cheaper than /proc/self/stat */
+static void read_rss(struct dmn_usage *u, struct dmn_usage_sample *s)
+{
+    static long page_size;
+    char buf[256];
+    unsigned long long pages;
+
+    if (page_size == 0)
+    {
+        page_size = sysconf(_SC_PAGESIZE);
+    }
+
+    if (pread_proc(u->statm_fd, buf, sizeof(buf)) != -1 &&
+        sscanf(buf, "%*u %llu", &pages) == 1)
+    {
+        s->rss = pages * (unsigned long long)page_size;
+    }
+}
+
+/* get the PSS from /proc/self/smaps_rollup */
+static void read_pss(struct dmn_usage *u, struct dmn_usage_sample *s)
+{
+    char buf[2048];
+    const char *p;
+    unsigned long long kb;
+
+    if (pread_proc(u->smaps_fd, buf, sizeof(buf)) == -1)
+    {
+        return;
+    }
+
+    p = strstr(buf, "\nPss:");
+    if (p != NULL && sscanf(p + 5, "%llu", &kb) == 1)
+    {
+        s->pss = kb * 1024;
+    }
+}
+
+/* count the open descriptors */
+static uint32_t count_fds(struct dmn_usage *u)
+{
+    char buf[4096];
+    uint32_t count = 0;
+    ssize_t n, off;
+
+    if (lseek(u->fd_dir, 0, SEEK_SET) == -1)
+    {
+        return 0;
+    }
+
+    while ((n = getdents64(u->fd_dir, buf, sizeof(buf))) > 0)
+    {
+        for (off = 0; off < n; )
+        {
+            struct dirent64 *entry = (struct dirent64 *)(buf + off);
+
+            if (entry->d_name[0] != '.')
+            {
+                count++;
+            }
+            off += entry->d_reclen;
+        }
+    }
+
+    return count > (uint32_t)u->own_fds ? count - (uint32_t)u->own_fds : 0;
+}
+
+/* take a sample and put it into the ring */
+static void take_sample(struct dmn_usage *u)
+{
+    struct dmn_usage_sample s;
+    struct ring_slot *slot;
+    struct rusage ru;
+    struct timespec ts;
+    uint64_t n;
+
+    memset(&s, 0, sizeof(s));
+    clock_gettime(CLOCK_REALTIME, &ts);
+    s.time_ns = timespec_ns(&ts);
+
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+    {
+        s.utime_ns = timeval_ns(&ru.ru_utime);
+        s.stime_ns = timeval_ns(&ru.ru_stime);
+        s.minflt = (uint64_t)ru.ru_minflt;
+        s.majflt = (uint64_t)ru.ru_majflt;
+        s.nvcsw = (uint64_t)ru.ru_nvcsw;
+        s.nivcsw = (uint64_t)ru.ru_nivcsw;
+    }
+
+    read_rss(u, &s);
+    if (u->smaps_fd != -1)
+    {
+        read_pss(u, &s);
+    }
+    s.nfds = count_fds(u);
+
+    /* the sampler is the only writer */
+    n = u->header->head;
+    slot = &u->slots[n % u->capacity];
+    __atomic_store_n(&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->sample = s;
+    __atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&u->header->head, n + 1, __ATOMIC_RELEASE);
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+    {
+        __atomic_store_n(&u->header->sampler_ns, timespec_ns(&ts), __ATOMIC_RELAXED);
+    }
+}
+
+static void *sampler_thread(void *arg)
+{
+    struct dmn_usage *u = arg;
+    long long deadline;
+    struct pollfd pfd;
+    sigset_t mask;
+
+    /* the signals are handled by the daemon's own threads */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    /* let the kernel batch the wakeups with other timers, the samples
+       carry their own time anyway */
+    prctl(PR_SET_TIMERSLACK, (unsigned long)u->header->period_ms * 1000000ul / 100, 0, 0, 0);
+
+    pfd.fd = u->stop_pipe[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    take_sample(u);
+    deadline = dmn_now_ms() + u->header->period_ms;
+
+    /* the write end is closed by dmn_usage_close() */
+    while (!(pfd.revents & (POLLIN | POLLHUP)))
+    {
+        long long timeout = deadline - dmn_now_ms();
+
+        if (timeout > 0 && poll(&pfd, 1, (int)timeout) != 0)
+        {
+            continue;
+        }
+
+        take_sample(u);
+        /* keep the period stable, but do not catch up after a long delay */
+        deadline += u->header->period_ms;
+        if (deadline < dmn_now_ms())
+        {
+            deadline = dmn_now_ms() + u->header->period_ms;
+        }
+    }
+
+    return NULL;
+}
+
+/* open the procfs files and start the sampler thread */
+static int start_sampler(struct dmn_usage *u, int flags)
+{
+    int result;
+
+    u->statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    u->fd_dir = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (u->statm_fd == -1 || u->fd_dir == -1)
+    {
+        return -1;
+    }
+    u->own_fds = 2;
+
+    if (flags & DMN_USAGE_PSS)
+    {
+        u->smaps_fd = open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+        if (u->smaps_fd == -1)
+        {
+            return -1;
+        }
+        u->own_fds++;
+    }
+
+    if (pipe2(u->stop_pipe, O_CLOEXEC) == -1)
+    {
+        return -1;
+    }
+    u->own_fds += 2;
+
+    result = pthread_create(&u->thread, NULL, sampler_thread, u);
+    if (result != 0)
+    {
+        errno = result;
+        return -1;
+    }
+
+    u->sampler = 1;
+    return 0;
+}
+
+struct dmn_usage *dmn_usage_open(const char *pid_file_path, size_t capacity,
+                                 unsigned period_ms, int flags)
+{
+    struct dmn_usage *u;
+    struct stat st;
+    int saved_errno;
+    int fd;
+
+    if (capacity == 0 || capacity > DMN_USAGE_MAX_CAPACITY || period_ms == 0 || period_ms > INT32_MAX)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    u = alloc_usage(pid_file_path);
+    if (u == NULL)
+    {
+        return NULL;
+    }
+    u->capacity = (uint32_t)capacity;
+    u->size = ring_size(u->capacity);
+
+    /* The ring (if any) is left by a previous instance. A new file is
+       created to keep the old mapping of a reader intact. */
+    if (dmn_unlink_stale(pid_file_path, u->path) == -1 ||
+        (fd = open(u->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1)
+    {
+        free(u);
+        return NULL;
+    }
+
+    if (fchmod(fd, 0644) == -1 || ftruncate(fd, (off_t)u->size) == -1 ||
+        fstat(fd, &st) == -1)
+    {
+        goto error;
+    }
+
+    u->header = mmap(NULL, u->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (u->header == MAP_FAILED)
+    {
+        goto error;
+    }
+    close(fd);
+
+    u->slots = (struct ring_slot *)((char *)u->header + SLOTS_OFFSET);
+    u->owner = 1;
+    u->dev = st.st_dev;
+    u->ino = st.st_ino;
+
+    u->header->pid = (int32_t)getpid();
+    u->header->capacity = u->capacity;
+    u->header->period_ms = period_ms;
+    u->header->flags = (uint32_t)flags;
+    /* the ring is valid from now on */
+    __atomic_store_n(&u->header->magic, RING_MAGIC, __ATOMIC_RELEASE);
+
+    if (start_sampler(u, flags) == -1)
+    {
+        saved_errno = errno;
+        dmn_usage_close(u);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    return u;
+
+error:
+    saved_errno = errno;
+    close(fd);
+    unlink(u->path);
+    free(u);
+    errno = saved_errno;
+    return NULL;
+}
+
+struct dmn_usage *dmn_usage_attach(const char *pid_file_path)
+{
+    struct dmn_usage *u;
+    struct stat st;
+    int saved_errno;
+    int fd;
+
+    u = alloc_usage(pid_file_path);
+    if (u == NULL)
+    {
+        return NULL;
+    }
+
+    fd = open(u->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        free(u);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1)
+    {
+        goto error;
+    }
+    if (st.st_size < SLOTS_OFFSET)
+    {
+        errno = EINVAL;
+        goto error;
+    }
+
+    u->size = (size_t)st.st_size;
+    u->header = mmap(NULL, u->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (u->header == MAP_FAILED)
+    {
+        goto error;
+    }
+    close(fd);
+
+    /* the header fields are valid only after the magic is set */
+    if (__atomic_load_n(&u->header->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ||
+        (u->capacity = u->header->capacity) == 0 || ring_size(u->capacity) != u->size)
+    {
+        munmap(u->header, u->size);
+        free(u);
+        errno = EINVAL;
+        return NULL;
+    }
+    u->slots = (struct ring_slot *)((char *)u->header + SLOTS_OFFSET);
+
+    return u;
+
+error:
+    saved_errno = errno;
+    close(fd);
+    free(u);
+    errno = saved_errno;
+    return NULL;
+}
+
+void dmn_usage_close(struct dmn_usage *u)
+{
+    struct stat st;
+
+    if (u == NULL)
+    {
+        return;
+    }
+
+    if (u->sampler)
+    {
+        /* wake the sampler up */
+        close(u->stop_pipe[1]);
+        pthread_join(u->thread, NULL);
+        close(u->stop_pipe[0]);
+    }
+    else if (u->stop_pipe[0] != -1)
+    {
+        close(u->stop_pipe[0]);
+        close(u->stop_pipe[1]);
+    }
+
+    if (u->statm_fd != -1)
+    {
+        close(u->statm_fd);
+    }
+    if (u->smaps_fd != -1)
+    {
+        close(u->smaps_fd);
+    }
+    if (u->fd_dir != -1)
+    {
+        close(u->fd_dir);
+    }
+
+    /* do not remove the ring of a newer instance */
+    if (u->owner && stat(u->path, &st) == 0 && st.st_dev == u->dev && st.st_ino == u->ino)
+    {
+        unlink(u->path);
+    }
+
+    munmap(u->header, u->size);
+    free(u);
+}
+
+size_t dmn_usage_read(struct dmn_usage *u, uint64_t *next,
+                      struct dmn_usage_sample *samples, size_t max)
+{
+    uint64_t head = __atomic_load_n(&u->header->head, __ATOMIC_ACQUIRE);
+    uint64_t n = *next;
+    size_t count = 0;
+
+    /* the older samples have been overwritten */
+    if (head > u->capacity && n < head - u->capacity)
+    {
+        n = head - u->capacity;
+    }
+
+    for (; n < head && count < max; n++)
+    {
+        const struct ring_slot *slot = &u->slots[n % u->capacity];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        /* skip the sample if the sampler has got to the slot again */
+        if (seq != 2 * n + 2)
+        {
+            continue;
+        }
+
+        memcpy(&samples[count], &slot->sample, sizeof(samples[count]));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+        {
+            count++;
+        }
+    }
+
+    *next = n;
+    return count;
+}
+
+pid_t dmn_usage_pid(const struct dmn_usage *u)
+{
+    return (pid_t)u->header->pid;
+}
+
+unsigned dmn_usage_period(const struct dmn_usage *u)
+{
+    return u->header->period_ms;
+}
+
+uint64_t dmn_usage_overhead(const struct dmn_usage *u)
+{
+    return __atomic_load_n(&u->header->sampler_ns, __ATOMIC_RELAXED);
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,148 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+*/
+
+#ifndef _DMN_USAGE_H
+#define _DMN_USAGE_H
+
+#ifdef __linux__
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+Resource usage sampler. A thread in the daemon periodically records the
+resource usage of the daemon process (from getrusage(2) and procfs) into
+a fixed-size ring of samples in a shared memory file next to the
+PID-file ("<pid_file_path>.usage"). Another process (e.g. "dmnctl
+usage") maps the file read-only and reads the series without any
+interaction with the daemon: every sample is protected by a sequence
+counter, so a sample which is being overwritten is skipped instead of
+blocking the writer.
+*/
+
+/* suffix which is appended to the PID-file path to get the file path */
+#define DMN_USAGE_SUFFIX ".usage"
+
+/* the largest number of the samples in the ring */
+#define DMN_USAGE_MAX_CAPACITY 65536
+
+/* Sampler flags. */
+enum {
+    DMN_USAGE_DEFAULT = 0,
+    DMN_USAGE_PSS = 1 /* Record PSS. The kernel walks all the mappings of the process to compute it, so it costs more for large processes. */
+};
+
+/* A sample. The counters are cumulative since the daemon start. */
+struct dmn_usage_sample {
+    uint64_t time_ns;  /* CLOCK_REALTIME */
+    uint64_t utime_ns; /* user CPU time */
+    uint64_t stime_ns; /* system CPU time */
+    uint64_t rss;      /* resident set size in bytes */
+    uint64_t pss;      /* proportional set size in bytes, 0 without DMN_USAGE_PSS */
+    uint64_t minflt;   /* minor page faults */
+    uint64_t majflt;   /* major page faults */
+    uint64_t nvcsw;    /* voluntary context switches */
+    uint64_t nivcsw;   /* involuntary context switches */
+    uint64_t nfds;     /* open file descriptors, except the ones of the sampler */
+};
+
+struct dmn_usage;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern struct dmn_usage *dmn_usage_open(const char *pid_file_path, size_t capacity,
+                                        unsigned period_ms, int flags);
+/*
+* Description
+dmn_usage_open() - create the sample ring of the daemon and start the
+sampler thread. The first sample is taken immediately. It should be
+called from the daemon process which holds the PID-file. The thread
+blocks all signals.
+
+* Arguments:
+pid_file_path - full pathname to the PID-file of the daemon;
+capacity - number of the samples in the ring (up to
+DMN_USAGE_MAX_CAPACITY), the oldest samples are overwritten (e.g. 1440
+samples with the 60 seconds period keep a day);
+period_ms - sampling period;
+flags - a bit mask of the sampler flags, see above.
+
+* Return value
+Sampler object or NULL on error. In the latter case errno will be set
+accordingly.
+*/
+
+extern struct dmn_usage *dmn_usage_attach(const char *pid_file_path);
+/*
+* Description
+dmn_usage_attach() - map the sample ring of a running daemon read-only.
+
+* Arguments:
+pid_file_path - full pathname to the PID-file of the daemon.
+
+* Return value
+Sampler object or NULL on error (ENOENT if the daemon does not record
+its resource usage). In the latter case errno will be set accordingly.
+*/
+
+extern void dmn_usage_close(struct dmn_usage *u);
+/*
+* Description
+dmn_usage_close() - stop the sampler thread, unmap the ring and free the
+sampler object. The file is removed if it has been created by
+dmn_usage_open().
+*/
+
+extern size_t dmn_usage_read(struct dmn_usage *u, uint64_t *next,
+                             struct dmn_usage_sample *samples, size_t max);
+/*
+* Description
+dmn_usage_read() - copy the samples in the order they were taken. It
+never blocks the sampler.
+
+* Arguments:
+u - sampler object;
+next - number of the first sample to read (0 - the oldest sample in the
+ring). The samples which have been overwritten are skipped. On return
+it is set to the number of the sample which follows the last read one,
+so the next call returns only the new samples;
+samples - array to receive the samples;
+max - size of the array.
+
+* Return value
+Number of the samples copied.
+*/
+
+extern pid_t dmn_usage_pid(const struct dmn_usage *u);
+/*
+* Description
+dmn_usage_pid() - get the PID of the process which has created the ring.
+*/
+
+extern unsigned dmn_usage_period(const struct dmn_usage *u);
+/*
+* Description
+dmn_usage_period() - get the sampling period in milliseconds.
+*/
+
+extern uint64_t dmn_usage_overhead(const struct dmn_usage *u);
+/*
+* Description
+dmn_usage_overhead() - get the CPU time consumed by the sampler thread
+in nanoseconds. It is included into the recorded CPU time of the daemon.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __linux__ */
+
+#endif /* _DMN_USAGE_H */
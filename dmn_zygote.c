@@ -0,0 +1,679 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+Fork-server (zygote) mode. This implementation is Linux specific because
+it relies on pidfds and SO_PEERCRED.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE /* accept4(), pipe2() */
+#include <unistd.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "daemonize.h"
+#include "dmn_zygote.h"
+#include "dmn_internal.h"
+
+/* maximal number of the events handled by a dmn_zygote_process() call */
+#define EVENTS_PER_CALL 64
+
+/* "DMNZ" */
+#define REQUEST_MAGIC 0x5a4e4d44u
+
+/* the request is a single packet: the header, the path and the data */
+struct request_header {
+    uint32_t magic;
+    uint32_t path_len; /* without the terminating zero */
+    uint32_t data_len;
+    uint32_t reserved;
+};
+
+#define REQUEST_MAX (sizeof(struct request_header) + PATH_MAX + DMN_ZYGOTE_MAX_DATA)
+
+/* the response mirrors the return value of dmn_zygote_spawn() */
+struct response {
+    int32_t result; /* PID, -1 or -2 */
+    int32_t error;  /* errno value */
+};
+
+enum {
+    ENTRY_LISTEN,
+    ENTRY_REQUEST,  /* a connection which has not sent the request yet */
+    ENTRY_INSTANCE  /* a running instance, fd is its pidfd */
+};
+
+struct entry {
+    int type;
+    int fd;
+    pid_t pid;
+    struct entry *prev;
+    struct entry *next;
+};
+
+struct dmn_zygote {
+    int flags;
+    dmn_zygote_func func;
+    void *udata;
+    struct sockaddr_un addr;
+    int epfd;
+    struct entry listen;
+    struct entry *requests;
+    struct entry *instances;
+    size_t ninstances;
+};
+
+static void link_entry(struct entry **list, struct entry *e)
+{
+    e->prev = NULL;
+    e->next = *list;
+    if (*list != NULL)
+    {
+        (*list)->prev = e;
+    }
+    *list = e;
+}
+
+/* unlink the entry, close its descriptor (this removes it from the epoll set) and free it */
+static void remove_entry(struct entry **list, struct entry *e)
+{
+    close(e->fd);
+
+    if (e->prev != NULL)
+    {
+        e->prev->next = e->next;
+    }
+    else
+    {
+        *list = e->next;
+    }
+    if (e->next != NULL)
+    {
+        e->next->prev = e->prev;
+    }
+
+    free(e);
+}
+
+static int watch_entry(struct dmn_zygote *z, struct entry *e)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = e;
+    return epoll_ctl(z->epfd, EPOLL_CTL_ADD, e->fd, &ev);
+}
+
+static void send_response(int sock, pid_t result, int error)
+{
+    struct response r;
+
+    r.result = (int32_t)result;
+    r.error = (int32_t)error;
+    while (send(sock, &r, sizeof(r), MSG_NOSIGNAL) == -1 && errno == EINTR)
+        ;
+}
+
+struct dmn_zygote *dmn_zygote_open(const char *pid_file_path, int flags,
+                                   dmn_zygote_func instance_func, void *udata)
+{
+    struct dmn_zygote *z;
+    int saved_errno;
+
+    if (instance_func == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    z = calloc(1, sizeof(*z));
+    if (z == NULL)
+    {
+        return NULL;
+    }
+    z->flags = flags;
+    z->func = instance_func;
+    z->udata = udata;
+    z->epfd = -1;
+    z->listen.type = ENTRY_LISTEN;
+    z->listen.fd = -1;
+
+    if (dmn_socket_address(&z->addr, pid_file_path, DMN_ZYGOTE_SUFFIX) == -1)
+    {
+        free(z);
+        return NULL;
+    }
+
+    z->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (z->epfd == -1)
+    {
+        goto error;
+    }
+
+    /* the packets keep the request boundaries */
+    z->listen.fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (z->listen.fd == -1)
+    {
+        goto error;
+    }
+
+    /* the socket file (if any) is left by a previous instance */
+    if (dmn_unlink_stale(pid_file_path, z->addr.sun_path) == -1)
+    {
+        goto error;
+    }
+
+    /* the socket is accessible by the owner only */
+    if (dmn_listen_unix(z->listen.fd, &z->addr, SOMAXCONN) == -1)
+    {
+        goto error;
+    }
+
+    if (watch_entry(z, &z->listen) == -1)
+    {
+        saved_errno = errno;
+        unlink(z->addr.sun_path);
+        errno = saved_errno;
+        goto error;
+    }
+
+    return z;
+
+error:
+    saved_errno = errno;
+    if (z->listen.fd != -1)
+    {
+        close(z->listen.fd);
+    }
+    if (z->epfd != -1)
+    {
+        close(z->epfd);
+    }
+    free(z);
+    errno = saved_errno;
+    return NULL;
+}
+
+void dmn_zygote_close(struct dmn_zygote *z)
+{
+    if (z == NULL)
+    {
+        return;
+    }
+
+    while (z->requests != NULL)
+    {
+        remove_entry(&z->requests, z->requests);
+    }
+    while (z->instances != NULL)
+    {
+        remove_entry(&z->instances, z->instances);
+    }
+
+    close(z->listen.fd);
+    unlink(z->addr.sun_path);
+    close(z->epfd);
+    free(z);
+}
+
+int dmn_zygote_fd(const struct dmn_zygote *z)
+{
+    return z->epfd;
+}
+
+size_t dmn_zygote_count(const struct dmn_zygote *z)
+{
+    return z->ninstances;
+}
+
+/* reset the signal handling inherited from the template */
+static void reset_signals(void)
+{
+    sigset_t sigset;
+    int i;
+
+    for (i = 1; i < _NSIG; i++)
+    {
+        signal(i, SIG_DFL);
+    }
+
+    sigemptyset(&sigset);
+    sigprocmask(SIG_SETMASK, &sigset, NULL);
+}
+
+/* the forked instance, never returns */
+static void run_instance(struct dmn_zygote *z, int sock, int go_fd,
+                         struct dmn_zygote_instance *inst)
+{
+    struct entry *e;
+    size_t i;
+    ssize_t n;
+    char go;
+    int result;
+
+    /* Wait until the zygote tracks the instance. Otherwise the zygote
+       might kill it after the client has been told that it runs. */
+    do
+    {
+        n = read(go_fd, &go, 1);
+    } while (n == -1 && errno == EINTR);
+    if (n != 1)
+    {
+        _exit(EXIT_FAILURE); /* the zygote has given up on it */
+    }
+    close(go_fd);
+
+    /* drop the descriptors of the zygote (the memory is not freed,
+       the instance does not return to the zygote code) */
+    close(z->epfd);
+    close(z->listen.fd);
+    for (e = z->requests; e != NULL; e = e->next)
+    {
+        if (e->fd != sock)
+        {
+            close(e->fd);
+        }
+    }
+    for (e = z->instances; e != NULL; e = e->next)
+    {
+        close(e->fd);
+    }
+
+    if (!(z->flags & DMN_ZYGOTE_KEEP_SIGNAL_HANDLERS))
+    {
+        reset_signals();
+    }
+
+    /* the descriptors are received with FD_CLOEXEC, the
+       instance gets them as if they were inherited */
+    for (i = 0; i < inst->nfds; i++)
+    {
+        fcntl(inst->fds[i], F_SETFD, 0);
+    }
+
+    /* The forked process is never a process group leader,
+       so it cannot fail. */
+    setsid();
+
+    result = acquirepidfile(inst->pid_file_path);
+    if (result != 0)
+    {
+        send_response(sock, result, result == -1 ? errno : 0);
+        _exit(EXIT_FAILURE);
+    }
+
+    /* the instance is ready */
+    send_response(sock, getpid(), 0);
+    close(sock);
+
+    result = z->func(z->udata, inst);
+    releasepidfile();
+    exit(result);
+}
+
+/* create an instance for the received request */
+static int create_instance(struct dmn_zygote *z, int sock, struct dmn_zygote_instance *inst)
+{
+    struct entry *e;
+    int go_pipe[2];
+    int saved_errno;
+    pid_t pid;
+
+    e = calloc(1, sizeof(*e));
+    if (e == NULL)
+    {
+        send_response(sock, -1, errno);
+        return -1;
+    }
+
+    /* the instance starts when it is written to */
+    if (pipe2(go_pipe, O_CLOEXEC) == -1)
+    {
+        send_response(sock, -1, errno);
+        free(e);
+        return -1;
+    }
+
+    pid = fork();
+    if (pid == -1)
+    {
+        send_response(sock, -1, errno);
+        close(go_pipe[0]);
+        close(go_pipe[1]);
+        free(e);
+        return -1;
+    }
+    else if (pid == 0)
+    {
+        close(go_pipe[1]);
+        run_instance(z, sock, go_pipe[0], inst);
+    }
+    close(go_pipe[0]);
+
+    /* The instance cannot be reaped by anyone but us, so its
+       PID cannot be reused until then (it might be a zombie). */
+    e->type = ENTRY_INSTANCE;
+    e->pid = pid;
+    e->fd = pidfd_open(pid, 0);
+    if (e->fd == -1 || watch_entry(z, e) == -1 ||
+        write(go_pipe[1], "", 1) != 1)
+    {
+        /* the instance cannot be tracked: do not leave it behind,
+           it has not responded yet */
+        saved_errno = errno;
+        close(go_pipe[1]);
+        if (e->fd != -1)
+        {
+            close(e->fd);
+        }
+        kill(pid, SIGKILL);
+        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+            ;
+        free(e);
+        send_response(sock, -1, saved_errno);
+        return -1;
+    }
+    close(go_pipe[1]);
+
+    link_entry(&z->instances, e);
+    z->ninstances++;
+    return 0;
+}
+
+/* receive the request and create the instance, returns 1 if it is created */
+static int handle_request(struct dmn_zygote *z, struct entry *req)
+{
+    char buf[REQUEST_MAX + 1];
+    int fds[DMN_ZYGOTE_MAX_FDS];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct request_header header;
+    struct dmn_zygote_instance inst;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    size_t i, nfds = 0;
+    ssize_t n;
+    int created = 0;
+
+    iov.iov_base = buf;
+    iov.iov_len = REQUEST_MAX;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    do
+    {
+        n = recvmsg(req->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1 && errno == EAGAIN)
+    {
+        return 0; /* spurious wakeup */
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+        }
+    }
+
+    /* validate the request */
+    if (n < (ssize_t)sizeof(header) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+    {
+        goto done;
+    }
+    memcpy(&header, buf, sizeof(header));
+    if (header.magic != REQUEST_MAGIC ||
+        header.path_len == 0 || header.path_len >= PATH_MAX ||
+        header.data_len > DMN_ZYGOTE_MAX_DATA ||
+        (size_t)n != sizeof(header) + header.path_len + header.data_len)
+    {
+        send_response(req->fd, -1, EPROTO);
+        goto done;
+    }
+
+    /* the path is followed by the data, so the data are moved
+       to make room for the terminating zero */
+    memmove(buf + sizeof(header) + header.path_len + 1,
+            buf + sizeof(header) + header.path_len, header.data_len);
+    buf[sizeof(header) + header.path_len] = '\0';
+
+    inst.pid_file_path = buf + sizeof(header);
+    inst.fds = fds;
+    inst.nfds = nfds;
+    inst.data = buf + sizeof(header) + header.path_len + 1;
+    inst.data_len = header.data_len;
+
+    created = create_instance(z, req->fd, &inst) == 0;
+
+done:
+    /* the instance has its own copies */
+    for (i = 0; i < nfds; i++)
+    {
+        close(fds[i]);
+    }
+    remove_entry(&z->requests, req);
+    return created;
+}
+
+static void accept_requests(struct dmn_zygote *z)
+{
+    struct entry *e;
+    int sock;
+
+    for (;;)
+    {
+        sock = accept4(z->listen.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            return; /* EAGAIN or a transient error (e.g. EMFILE) */
+        }
+
+        if (dmn_check_peer(sock) == -1 || (e = calloc(1, sizeof(*e))) == NULL)
+        {
+            close(sock);
+            continue;
+        }
+
+        e->type = ENTRY_REQUEST;
+        e->fd = sock;
+        if (watch_entry(z, e) == -1)
+        {
+            close(sock);
+            free(e);
+            continue;
+        }
+        link_entry(&z->requests, e);
+    }
+}
+
+int dmn_zygote_process(struct dmn_zygote *z)
+{
+    struct epoll_event events[EVENTS_PER_CALL];
+    int created = 0;
+    int n;
+    int i;
+
+    do
+    {
+        n = epoll_wait(z->epfd, events, EVENTS_PER_CALL, 0);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        struct entry *e = events[i].data.ptr;
+
+        if (e->type == ENTRY_LISTEN)
+        {
+            accept_requests(z);
+        }
+        else if (e->type == ENTRY_REQUEST)
+        {
+            created += handle_request(z, e);
+        }
+        else if (e->type == ENTRY_INSTANCE)
+        {
+            /* the pidfd of the exited instance is readable; ECHILD
+               means that SIGCHLD is ignored and it is reaped already */
+            pid_t pid = waitpid(e->pid, NULL, WNOHANG);
+            if (pid == e->pid || (pid == -1 && errno == ECHILD))
+            {
+                remove_entry(&z->instances, e);
+                z->ninstances--;
+            }
+        }
+    }
+
+    return created;
+}
+
+pid_t dmn_zygote_spawn(const char *pid_file_path,
+                       const char *instance_pid_file_path,
+                       const int *fds, size_t nfds,
+                       const void *data, size_t data_len)
+{
+    char control[CMSG_SPACE(DMN_ZYGOTE_MAX_FDS * sizeof(int))];
+    struct sockaddr_un addr;
+    struct request_header header;
+    struct response r;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov[3];
+    size_t path_len;
+    ssize_t n;
+    int sock;
+
+    /* validate arguments */
+    if (instance_pid_file_path == NULL ||
+        (path_len = strlen(instance_pid_file_path)) == 0 || path_len >= PATH_MAX ||
+        nfds > DMN_ZYGOTE_MAX_FDS || (nfds > 0 && fds == NULL) ||
+        data_len > DMN_ZYGOTE_MAX_DATA || (data_len > 0 && data == NULL))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (dmn_socket_address(&addr, pid_file_path, DMN_ZYGOTE_SUFFIX) == -1)
+    {
+        return -1;
+    }
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+    {
+        return -1;
+    }
+
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        goto error;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = REQUEST_MAGIC;
+    header.path_len = (uint32_t)path_len;
+    header.data_len = (uint32_t)data_len;
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)instance_pid_file_path;
+    iov[1].iov_len = path_len;
+    iov[2].iov_base = (void *)data;
+    iov[2].iov_len = data_len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = data_len > 0 ? 3 : 2;
+    if (nfds > 0)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+
+    do
+    {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1)
+    {
+        goto error;
+    }
+
+    /* wait for the instance (or the template if it has failed) */
+    do
+    {
+        n = recv(sock, &r, sizeof(r), 0);
+    } while (n == -1 && errno == EINTR);
+
+    if (n != sizeof(r))
+    {
+        if (n != -1)
+        {
+            errno = EPROTO; /* the instance has died before it was ready */
+        }
+        goto error;
+    }
+    close(sock);
+
+    if (r.result == -1)
+    {
+        errno = r.error;
+    }
+    else if (r.result == -2)
+    {
+        errno = 0;
+    }
+    return (pid_t)r.result;
+
+error:
+    {
+        int saved_errno = errno;
+        close(sock);
+        errno = saved_errno;
+        return -1;
+    }
+}
+
+#endif /* __linux__ */
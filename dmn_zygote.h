@@ -0,0 +1,165 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+*/
+
+#ifndef _DMN_ZYGOTE_H
+#define _DMN_ZYGOTE_H
+
+#ifdef __linux__
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+Fork-server (zygote) mode. A template daemon is started once with
+rundaemon(), performs the expensive initialization (loading of the
+shared libraries, parsing of the configuration, cache warmup), then
+listens on a Unix domain socket created next to its PID-file
+("<pid_file_path>.zygote"). On request it forks a fresh instance which
+shares the warmed pages with the template copy-on-write, so the instance
+is ready to work right after fork().
+
+Every instance calls setsid(), holds its own PID-file and receives the
+descriptors passed by the requesting process. Like rundaemon(), the
+request returns when the instance has written its PID-file: the
+instance reports its PID (or the error) over the request connection.
+
+The instances are the children of the template (they are forked once,
+not twice, to keep the creation cost down): the template reaps them in
+dmn_zygote_process(). As the instances are session leaders, they should
+open terminal devices with O_NOCTTY.
+*/
+
+/* suffix which is appended to the PID-file path to get the socket path */
+#define DMN_ZYGOTE_SUFFIX ".zygote"
+
+/* maximal number of the descriptors passed to an instance */
+#define DMN_ZYGOTE_MAX_FDS 16
+
+/* maximal size of the instance argument data */
+#define DMN_ZYGOTE_MAX_DATA 4096
+
+/* Zygote creation flags. */
+enum {
+    DMN_ZYGOTE_DEFAULT = 0,
+    DMN_ZYGOTE_KEEP_SIGNAL_HANDLERS = 1 /* Do not reset signal handlers and the signal mask of the instances. */
+};
+
+struct dmn_zygote;
+
+/* the instance parameters supplied by the requesting process */
+struct dmn_zygote_instance {
+    const char *pid_file_path; /* PID-file of the instance */
+    const int *fds;            /* the passed descriptors */
+    size_t nfds;
+    const void *data;          /* argument data */
+    size_t data_len;
+};
+
+/*
+Instance body. It is called in the forked instance and its return value
+becomes the instance exit code.
+*/
+typedef int (*dmn_zygote_func)(void *udata, const struct dmn_zygote_instance *inst);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern struct dmn_zygote *dmn_zygote_open(const char *pid_file_path, int flags,
+                                          dmn_zygote_func instance_func, void *udata);
+/*
+* Description
+dmn_zygote_open() - create the fork-server socket of the template
+daemon. It should be called by the daemon (which holds its PID-file)
+after the initialization is complete.
+
+* Arguments:
+pid_file_path - full pathname to the PID-file of the template daemon;
+flags - a bit mask of the zygote creation flags, see above;
+instance_func - the instance body;
+udata - pointer to be passed to instance_func.
+
+* Return value
+Zygote object or NULL on error. In the latter case errno will be set
+accordingly.
+*/
+
+extern void dmn_zygote_close(struct dmn_zygote *z);
+/*
+* Description
+dmn_zygote_close() - remove the fork-server socket and free the zygote.
+The running instances are not terminated and are not reaped anymore.
+*/
+
+extern int dmn_zygote_fd(const struct dmn_zygote *z);
+/*
+* Description
+dmn_zygote_fd() - get the file descriptor which becomes readable when
+there is a request or an instance exits (it is an epoll(7) descriptor).
+It should be added to the event loop of the daemon;
+dmn_zygote_process() should be called when it is readable.
+*/
+
+extern int dmn_zygote_process(struct dmn_zygote *z);
+/*
+* Description
+dmn_zygote_process() - accept the requests, create the instances and
+reap the exited ones. It never blocks (besides the fork() itself).
+
+In the instance this function does not return: the instance closes the
+descriptors of the zygote, resets the signal handling (unless
+DMN_ZYGOTE_KEEP_SIGNAL_HANDLERS is specified), calls setsid(), locks its
+PID-file, reports its PID to the requesting process and calls the
+instance body. Then the PID-file is removed and the instance exits.
+Other descriptors of the template are inherited by the instance.
+
+* Return value
+Number of the created instances or -1 on a fatal error. In the latter
+case errno will be set accordingly.
+*/
+
+extern size_t dmn_zygote_count(const struct dmn_zygote *z);
+/*
+* Description
+dmn_zygote_count() - get the number of the running instances.
+*/
+
+extern pid_t dmn_zygote_spawn(const char *pid_file_path,
+                              const char *instance_pid_file_path,
+                              const int *fds, size_t nfds,
+                              const void *data, size_t data_len);
+/*
+* Description
+dmn_zygote_spawn() - ask the template daemon to create an instance and
+wait until the instance has written its PID-file. The instance starts
+only after the template has begun to track it, so a successful instance
+is never killed by the template afterwards.
+
+* Arguments:
+pid_file_path - full pathname to the PID-file of the template daemon;
+instance_pid_file_path - full pathname to the PID-file of the instance;
+fds - descriptors to pass to the instance (at most DMN_ZYGOTE_MAX_FDS)
+or NULL;
+nfds - number of the descriptors;
+data - argument data to pass to the instance (at most
+DMN_ZYGOTE_MAX_DATA bytes) or NULL;
+data_len - size of the data.
+
+* Return value
+PID of the instance on success, -2 if the instance PID-file is locked
+(the instance is already running) or -1 on error. In the latter case
+errno will be set accordingly (e.g. ENOENT or ECONNREFUSED if the
+template is not running).
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __linux__ */
+
+#endif /* _DMN_ZYGOTE_H */
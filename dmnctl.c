@@ -0,0 +1,843 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+dmnctl - a control tool for daemons started with rundaemon().
+
+The daemon liveness is determined by the PID-file lock (see
+checkdaemon()), so a stale PID-file is never mistaken for a running
+daemon. Signals are delivered via pidfd_send_signal(2) to the exact
+process which holds the lock and the tool waits for the daemon to exit
+by polling its pidfd, so there is no sleeping and no PID reuse race.
+
+This tool is Linux specific because it uses pidfd_open(2).
+*/
+
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+#ifdef __linux__
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/pidfd.h>
+#include <poll.h>
+#include <time.h>
+#include <stdint.h>
+#include <syslog.h>
+
+#include "daemonize.h"
+#include "dmn_cgroup.h"
+#include "dmn_control.h"
+#include "dmn_heartbeat.h"
+#include "dmn_internal.h"
+#include "dmn_prewarm.h"
+#include "dmn_usage.h"
+
+/* exit codes (LSB init script conventions) */
+enum {
+    CTL_OK = 0,
+    CTL_FAILURE = 1,
+    CTL_USAGE = 2,
+    CTL_NOT_RUNNING = 3,
+    CTL_UNKNOWN = 4
+};
+
+/* heartbeat check period */
+#define CHECK_PERIOD_MS 100
+
+/* number of attempts to get a pidfd which refers to the lock owner */
+#define OPEN_DAEMON_ATTEMPTS 3
+
+/* command line options */
+static int opt_timeout = 30; /* seconds, 0 - wait forever */
+static int opt_signal = SIGTERM;
+static int opt_kill = 0; /* send SIGKILL on timeout */
+static const char *opt_cgroup = NULL;
+static struct dmn_cgroup_limits opt_limits;
+static const char **opt_prewarm = NULL; /* NULL terminated */
+static size_t opt_prewarm_count = 0;
+static struct dmn_prewarm_options opt_prewarm_options;
+
+static const struct {
+    const char *name;
+    int signo;
+} signal_names[] = {
+    { "TERM", SIGTERM },
+    { "HUP",  SIGHUP },
+    { "INT",  SIGINT },
+    { "QUIT", SIGQUIT },
+    { "KILL", SIGKILL },
+    { "USR1", SIGUSR1 },
+    { "USR2", SIGUSR2 },
+};
+
+static int parse_signal(const char *str)
+{
+    char *end = NULL;
+    long signo;
+    size_t i;
+
+    if (strncmp(str, "SIG", 3) == 0)
+    {
+        str += 3;
+    }
+
+    for (i = 0; i < sizeof(signal_names) / sizeof(signal_names[0]); i++)
+    {
+        if (strcmp(str, signal_names[i].name) == 0)
+        {
+            return signal_names[i].signo;
+        }
+    }
+
+    signo = strtol(str, &end, 10);
+    if (*str == '\0' || *end != '\0' || signo <= 0 || signo >= NSIG)
+    {
+        return -1;
+    }
+
+    return (int)signo;
+}
+
+/*
+  Parse a decimal number in the range from min to max.
+  Returns 0 on success or -1 if the string is not such a number.
+*/
+static int parse_number(const char *str, unsigned long long min,
+                        unsigned long long max, unsigned long long *value)
+{
+    char *end = NULL;
+    unsigned long long n;
+
+    /* strtoull() accepts the leading spaces and signs */
+    if (*str < '0' || *str > '9')
+    {
+        return -1;
+    }
+
+    errno = 0;
+    n = strtoull(str, &end, 10);
+    if (errno != 0 || *end != '\0' || n < min || n > max)
+    {
+        return -1;
+    }
+
+    *value = n;
+    return 0;
+}
+
+/*
+  Get a pidfd for the daemon which holds the lock on the PID-file.
+  Returns 1 on success, 0 if the daemon is not running, or -1 on error.
+*/
+static int open_daemon(const char *pid_file_path, int *daemon_pidfd, pid_t *daemon_pid)
+{
+    int attempt;
+
+    for (attempt = 0; attempt < OPEN_DAEMON_ATTEMPTS; attempt++)
+    {
+        pid_t pid;
+        int pidfd;
+
+        pid = checkdaemon(pid_file_path);
+        if (pid <= 0)
+        {
+            return (int)pid;
+        }
+
+        pidfd = pidfd_open(pid, 0);
+        if (pidfd == -1)
+        {
+            if (errno == ESRCH) /* exited in the meantime, check again */
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        /* The PID might have been reused between reading the PID-file
+           and opening the pidfd. If the lock is still held by the
+           same PID, the pidfd refers to the daemon. */
+        if (checkdaemon(pid_file_path) == pid)
+        {
+            *daemon_pidfd = pidfd;
+            *daemon_pid = pid;
+            return 1;
+        }
+        close(pidfd);
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
+
+/*
+  Wait for the process to exit. Returns 0 when the process has exited,
+  1 on timeout, or -1 on error.
+*/
+static int wait_exit(int pidfd, int timeout_sec)
+{
+    long long deadline = dmn_now_ms() + (long long)timeout_sec * 1000;
+
+    for (;;)
+    {
+        struct pollfd pfd;
+        int timeout = -1;
+        int result;
+
+        if (timeout_sec > 0)
+        {
+            long long left = deadline - dmn_now_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+
+        pfd.fd = pidfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        /* pidfd becomes readable when the process terminates */
+        result = poll(&pfd, 1, timeout);
+        if (result == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        return result == 0 ? 1 : 0;
+    }
+}
+
+static void log_prewarm(void *udata, const struct dmn_prewarm_progress *progress)
+{
+    (void)udata;
+
+    syslog(LOG_INFO, "%s: %zu of %zu files, %llu of %llu MB in %.1f s%s",
+           progress->finished ? "Prewarming finished" : "Prewarming",
+           progress->files_done, progress->files_total,
+           (unsigned long long)(progress->bytes_done >> 20),
+           (unsigned long long)(progress->bytes_total >> 20),
+           progress->elapsed_ns / 1e9,
+           progress->files_failed > 0 ? " (some files could not be read)" : "");
+}
+
+/* the body of the daemons started by 'start' */
+static int exec_daemon(void *udata)
+{
+    char **argv = (char **)udata;
+
+    /* the data files are read before the program starts, so it serves
+       the first requests from the page cache */
+    if (opt_prewarm != NULL)
+    {
+        openlog("dmnctl", LOG_PID, LOG_DAEMON);
+        opt_prewarm_options.callback = log_prewarm;
+        dmn_prewarm(opt_prewarm, &opt_prewarm_options, NULL);
+        closelog();
+    }
+
+    /* The PID-file descriptor is inherited by the program (see
+       DMN_KEEP_PID_FILE_ON_EXEC), so the PID-file stays locked
+       while the program is running. */
+    execvp(argv[0], argv);
+
+    openlog("dmnctl", LOG_PID, LOG_DAEMON);
+    syslog(LOG_ERR, "Cannot execute '%s': %s", argv[0], strerror(errno));
+    closelog();
+
+    return 127;
+}
+
+/* describe the cgroup placement of the started daemon */
+static void print_placement(const struct dmn_cgroup_placement *placement)
+{
+    switch (placement->result)
+    {
+        case DMN_CGROUP_CLONED:
+            printf("The daemon is started in cgroup %s.\n", opt_cgroup);
+            break;
+        case DMN_CGROUP_ATTACHED:
+            printf("The daemon is started in cgroup %s (clone3() is not available: %s).\n",
+                   opt_cgroup, strerror(placement->error));
+            break;
+        default:
+            fprintf(stderr, "Warning: the daemon is not placed into cgroup %s: %s\n",
+                    opt_cgroup, strerror(placement->error));
+            break;
+    }
+}
+
+static int cmd_start(const char *pid_file_path, char **argv)
+{
+    struct dmn_cgroup_placement placement;
+    int cgroup_fd = -1;
+    int exit_code = 0;
+    pid_t pid;
+
+    /* the daemon is started without the limits if they cannot be set */
+    if (opt_cgroup != NULL)
+    {
+        cgroup_fd = dmn_cgroup_open(opt_cgroup, &opt_limits);
+        if (cgroup_fd == -1)
+        {
+            fprintf(stderr, "Warning: cannot set up cgroup %s: %s\n", opt_cgroup, strerror(errno));
+        }
+    }
+
+    /* do not let the forked processes flush the buffered output again */
+    fflush(stdout);
+    fflush(stderr);
+
+    /* The program is started in the current directory and with
+       the caller's umask, so relative paths in its arguments work. */
+    pid = rundaemon_cgroup(DMN_NO_CHDIR | DMN_NO_UMASK | DMN_KEEP_PID_FILE_ON_EXEC,
+                           exec_daemon, argv,
+                           &exit_code,
+                           pid_file_path,
+                           cgroup_fd, &placement);
+    if (pid != 0 && cgroup_fd != -1)
+    {
+        close(cgroup_fd);
+    }
+    switch (pid)
+    {
+        case -1:
+        {
+            perror("Cannot start daemon");
+            return CTL_FAILURE;
+        }
+        break;
+        case -2:
+        {
+            printf("Daemon already running.\n");
+        }
+        break;
+        case 0: /* daemon process, exec failed */
+        {
+            exit(exit_code);
+        }
+        break;
+        default:
+        {
+            printf("Started daemon: %ld\n", (long)pid);
+            if (cgroup_fd != -1)
+            {
+                print_placement(&placement);
+            }
+        }
+        break;
+    }
+
+    return CTL_OK;
+}
+
+static int cmd_stop(const char *pid_file_path)
+{
+    pid_t pid = 0;
+    int pidfd = -1;
+    int result;
+
+    result = open_daemon(pid_file_path, &pidfd, &pid);
+    if (result == -1)
+    {
+        perror("Cannot check daemon");
+        return CTL_FAILURE;
+    }
+    else if (result == 0)
+    {
+        printf("Daemon not running.\n");
+        return CTL_OK;
+    }
+
+    if (pidfd_send_signal(pidfd, opt_signal, NULL, 0) == -1)
+    {
+        result = errno == ESRCH ? 0 : -1; /* already gone */
+    }
+    else
+    {
+        result = wait_exit(pidfd, opt_timeout);
+    }
+
+    if (result == 1 && opt_kill) /* timeout, kill the daemon */
+    {
+        fprintf(stderr, "Daemon %ld did not stop in time, killing.\n", (long)pid);
+        if (pidfd_send_signal(pidfd, SIGKILL, NULL, 0) == -1 && errno != ESRCH)
+        {
+            result = -1;
+        }
+        else
+        {
+            result = wait_exit(pidfd, 0);
+        }
+    }
+    close(pidfd);
+
+    switch (result)
+    {
+        case 0:
+            printf("Stopped daemon: %ld\n", (long)pid);
+            return CTL_OK;
+        case 1:
+            fprintf(stderr, "Daemon %ld did not stop in time.\n", (long)pid);
+            return CTL_FAILURE;
+        default:
+            perror("Cannot stop daemon");
+            return CTL_FAILURE;
+    }
+}
+
+static int cmd_status(const char *pid_file_path)
+{
+    pid_t pid = checkdaemon(pid_file_path);
+
+    if (pid == -1)
+    {
+        perror("Cannot check daemon");
+        return CTL_UNKNOWN;
+    }
+    else if (pid == 0)
+    {
+        printf("Daemon not running.\n");
+        return CTL_NOT_RUNNING;
+    }
+
+    printf("Daemon running: %ld\n", (long)pid);
+    return CTL_OK;
+}
+
+static int cmd_wait(const char *pid_file_path)
+{
+    pid_t pid = 0;
+    int pidfd = -1;
+    int result;
+
+    result = open_daemon(pid_file_path, &pidfd, &pid);
+    if (result == -1)
+    {
+        perror("Cannot check daemon");
+        return CTL_FAILURE;
+    }
+    else if (result == 0)
+    {
+        return CTL_OK;
+    }
+
+    result = wait_exit(pidfd, opt_timeout);
+    close(pidfd);
+
+    if (result == -1)
+    {
+        perror("Cannot wait for daemon");
+        return CTL_FAILURE;
+    }
+    else if (result == 1)
+    {
+        fprintf(stderr, "Daemon %ld is still running.\n", (long)pid);
+        return CTL_FAILURE;
+    }
+
+    return CTL_OK;
+}
+
+static int cmd_call(const char *pid_file_path, const char *command, const char *data)
+{
+    char response[DMN_CONTROL_MAX_PAYLOAD];
+    size_t response_len = sizeof(response);
+    size_t data_len = data != NULL ? strlen(data) : 0;
+    char *end = NULL;
+    unsigned long id;
+    int32_t status = 0;
+    int fd;
+
+    id = strtoul(command, &end, 0);
+    if (*command == '\0' || *end != '\0' || id > UINT32_MAX)
+    {
+        fprintf(stderr, "Invalid command: %s\n", command);
+        return CTL_USAGE;
+    }
+
+    fd = dmn_control_connect(pid_file_path);
+    if (fd == -1)
+    {
+        perror("Cannot connect to daemon");
+        return CTL_FAILURE;
+    }
+
+    if (dmn_control_call(fd, (uint32_t)id, data, data_len,
+                         response, &response_len, &status) == -1)
+    {
+        perror("Cannot call daemon");
+        close(fd);
+        return CTL_FAILURE;
+    }
+    close(fd);
+
+    fwrite(response, 1, response_len, stdout);
+    if (status != 0)
+    {
+        fprintf(stderr, "Command failed: %s\n", strerror(-status));
+        return CTL_FAILURE;
+    }
+
+    return CTL_OK;
+}
+
+static void print_stall(void *udata, const char *name, pid_t tid, unsigned stalled_ms)
+{
+    printf("Heartbeat '%s' (thread %ld) has stalled for %u ms.\n",
+           name, (long)tid, stalled_ms);
+}
+
+static int cmd_check(const char *pid_file_path)
+{
+    struct dmn_heartbeat *h;
+    long long deadline;
+    pid_t pid = 0;
+    int pidfd = -1;
+    int stalled;
+    int result;
+
+    result = open_daemon(pid_file_path, &pidfd, &pid);
+    if (result == -1)
+    {
+        perror("Cannot check daemon");
+        return CTL_UNKNOWN;
+    }
+    else if (result == 0)
+    {
+        printf("Daemon not running.\n");
+        return CTL_NOT_RUNNING;
+    }
+
+    /* the page might be left behind by a crashed instance */
+    h = dmn_heartbeat_attach(pid_file_path);
+    if (h == NULL || dmn_heartbeat_pid(h) != pid)
+    {
+        fprintf(stderr, "Daemon %ld has no heartbeat.\n", (long)pid);
+        dmn_heartbeat_close(h);
+        close(pidfd);
+        return CTL_UNKNOWN;
+    }
+
+    /* watch the heartbeats for the longest timeout */
+    dmn_heartbeat_check(h, NULL, NULL);
+    deadline = dmn_now_ms() + dmn_heartbeat_timeout(h) + CHECK_PERIOD_MS;
+    do
+    {
+        struct timespec ts = { 0, CHECK_PERIOD_MS * 1000000L };
+
+        nanosleep(&ts, NULL);
+        stalled = dmn_heartbeat_check(h, print_stall, NULL);
+    } while (stalled == 0 && dmn_now_ms() < deadline);
+    dmn_heartbeat_close(h);
+
+    if (stalled == 0)
+    {
+        printf("Daemon %ld is alive.\n", (long)pid);
+        close(pidfd);
+        return CTL_OK;
+    }
+
+    fflush(stdout);
+    dmn_heartbeat_report(pid, STDOUT_FILENO);
+
+    if (opt_kill) /* dump core */
+    {
+        fprintf(stderr, "Aborting daemon %ld.\n", (long)pid);
+        if (pidfd_send_signal(pidfd, SIGABRT, NULL, 0) == -1 && errno != ESRCH)
+        {
+            perror("Cannot abort daemon");
+        }
+    }
+    close(pidfd);
+
+    return CTL_FAILURE;
+}
+
+static int cmd_usage(const char *pid_file_path)
+{
+    struct dmn_usage_sample *samples;
+    struct dmn_usage *u;
+    uint64_t next = 0;
+    uint64_t sampler_ns;
+    size_t count, i;
+    pid_t pid;
+
+    pid = checkdaemon(pid_file_path);
+    if (pid == -1)
+    {
+        perror("Cannot check daemon");
+        return CTL_UNKNOWN;
+    }
+    else if (pid == 0)
+    {
+        printf("Daemon not running.\n");
+        return CTL_NOT_RUNNING;
+    }
+
+    /* the ring might be left behind by a crashed instance */
+    u = dmn_usage_attach(pid_file_path);
+    if (u == NULL || dmn_usage_pid(u) != pid)
+    {
+        fprintf(stderr, "Daemon %ld does not record its resource usage.\n", (long)pid);
+        dmn_usage_close(u);
+        return CTL_UNKNOWN;
+    }
+
+    samples = calloc(DMN_USAGE_MAX_CAPACITY, sizeof(*samples));
+    if (samples == NULL)
+    {
+        perror("Cannot read resource usage");
+        dmn_usage_close(u);
+        return CTL_FAILURE;
+    }
+    count = dmn_usage_read(u, &next, samples, DMN_USAGE_MAX_CAPACITY);
+    sampler_ns = dmn_usage_overhead(u);
+
+    /* the counters are shown per sampling interval */
+    printf("%-19s %6s %10s %10s %8s %8s %8s %8s %6s\n", "TIME", "CPU%", "RSS(KB)",
+           "PSS(KB)", "MINFLT", "MAJFLT", "VCSW", "IVCSW", "FDS");
+    for (i = 0; i < count; i++)
+    {
+        const struct dmn_usage_sample *s = &samples[i];
+        const struct dmn_usage_sample *prev = i > 0 ? &samples[i - 1] : s;
+        uint64_t interval = s->time_ns - prev->time_ns;
+        time_t sec = (time_t)(s->time_ns / 1000000000ull);
+        char timestr[32];
+        struct tm tm;
+
+        strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", localtime_r(&sec, &tm));
+        printf("%-19s ", timestr);
+        if (interval > 0)
+        {
+            printf("%6.2f ", 100.0 * (double)(s->utime_ns + s->stime_ns - prev->utime_ns - prev->stime_ns) /
+                   (double)interval);
+        }
+        else
+        {
+            printf("%6s ", "-");
+        }
+        printf("%10llu %10llu %8llu %8llu %8llu %8llu %6llu\n",
+               (unsigned long long)(s->rss / 1024), (unsigned long long)(s->pss / 1024),
+               (unsigned long long)(s->minflt - prev->minflt),
+               (unsigned long long)(s->majflt - prev->majflt),
+               (unsigned long long)(s->nvcsw - prev->nvcsw),
+               (unsigned long long)(s->nivcsw - prev->nivcsw),
+               (unsigned long long)s->nfds);
+    }
+
+    printf("Sampler: %llu samples every %u ms, %.1f us of CPU time per sample (%.4f%% of a CPU).\n",
+           (unsigned long long)next, dmn_usage_period(u),
+           next > 0 ? (double)sampler_ns / 1e3 / (double)next : 0.0,
+           next > 0 ? 100.0 * (double)sampler_ns / ((double)next * dmn_usage_period(u) * 1e6) : 0.0);
+
+    free(samples);
+    dmn_usage_close(u);
+    return CTL_OK;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [OPTIONS] COMMAND PID-FILE [ARGS...]\n"
+            "Commands:\n"
+            "  start PID-FILE PROGRAM [ARGS...]    run PROGRAM as a daemon\n"
+            "  stop PID-FILE                       signal the daemon and wait for it to exit\n"
+            "  status PID-FILE                     check if the daemon is running\n"
+            "  wait PID-FILE                       wait for the daemon to exit\n"
+            "  restart PID-FILE PROGRAM [ARGS...]  stop, then start the daemon\n"
+            "  call PID-FILE COMMAND [DATA]        send a command to the control socket\n"
+            "  check PID-FILE                      check the heartbeats of the daemon\n"
+            "  usage PID-FILE                      print the resource usage of the daemon\n"
+            "Options:\n"
+            "  -t SECONDS  time to wait for the daemon to exit, 0 - forever (default: 30)\n"
+            "  -s SIGNAL   signal to stop the daemon with (default: TERM)\n"
+            "  -k          send SIGKILL if the daemon did not stop in time,\n"
+            "              or SIGABRT if it has stalled (check)\n"
+            "Options of start and restart (cgroup v2):\n"
+            "  -g CGROUP   start the daemon in CGROUP (a full path, created if needed)\n"
+            "  -c CPU_MAX  cpu.max of the cgroup: \"QUOTA PERIOD\" in microseconds\n"
+            "  -w WEIGHT   cpu.weight of the cgroup (1-10000)\n"
+            "  -H BYTES    memory.high of the cgroup\n"
+            "  -M BYTES    memory.max of the cgroup\n"
+            "  -i WEIGHT   io.weight of the cgroup (1-10000)\n"
+            "Options of start and restart (page cache prewarming):\n"
+            "  -W GLOB     read the files matching GLOB into the page cache before\n"
+            "              running the program (can be repeated)\n"
+            "  -j THREADS  number of the reading threads (1-64, default: 4)\n"
+            "  -R MB/S     read rate cap\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *cmd;
+    const char *pid_file_path;
+    unsigned long long value;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "+t:s:kg:c:w:H:M:i:W:j:R:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                if (parse_number(optarg, 0, INT_MAX, &value) == -1)
+                {
+                    fprintf(stderr, "Invalid timeout: %s\n", optarg);
+                    return CTL_USAGE;
+                }
+                opt_timeout = (int)value;
+                break;
+            case 's':
+                if ((opt_signal = parse_signal(optarg)) == -1)
+                {
+                    fprintf(stderr, "Unknown signal: %s\n", optarg);
+                    return CTL_USAGE;
+                }
+                break;
+            case 'k':
+                opt_kill = 1;
+                break;
+            case 'g':
+                opt_cgroup = optarg;
+                break;
+            case 'c':
+                opt_limits.cpu_max = optarg;
+                break;
+            case 'w':
+                if (parse_number(optarg, 1, 10000, &value) == -1)
+                {
+                    fprintf(stderr, "Invalid CPU weight: %s\n", optarg);
+                    return CTL_USAGE;
+                }
+                opt_limits.cpu_weight = (unsigned)value;
+                break;
+            case 'H':
+                opt_limits.memory_high = optarg;
+                break;
+            case 'M':
+                opt_limits.memory_max = optarg;
+                break;
+            case 'i':
+                if (parse_number(optarg, 1, 10000, &value) == -1)
+                {
+                    fprintf(stderr, "Invalid IO weight: %s\n", optarg);
+                    return CTL_USAGE;
+                }
+                opt_limits.io_weight = (unsigned)value;
+                break;
+            case 'W':
+                if (opt_prewarm == NULL &&
+                    (opt_prewarm = calloc((size_t)argc, sizeof(*opt_prewarm))) == NULL)
+                {
+                    perror("Cannot parse options");
+                    return CTL_FAILURE;
+                }
+                opt_prewarm[opt_prewarm_count++] = optarg;
+                break;
+            case 'j':
+                if (parse_number(optarg, 1, DMN_PREWARM_MAX_THREADS, &value) == -1)
+                {
+                    fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                    return CTL_USAGE;
+                }
+                opt_prewarm_options.threads = (unsigned)value;
+                break;
+            case 'R':
+                /* MB/s to bytes per second without the overflow */
+                if (parse_number(optarg, 1, UINT64_MAX >> 20, &value) == -1)
+                {
+                    fprintf(stderr, "Invalid read rate: %s\n", optarg);
+                    return CTL_USAGE;
+                }
+                opt_prewarm_options.rate = (uint64_t)value << 20;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return CTL_OK;
+            default:
+                usage(argv[0]);
+                return CTL_USAGE;
+        }
+    }
+
+    if (argc - optind < 2)
+    {
+        usage(argv[0]);
+        return CTL_USAGE;
+    }
+
+    cmd = argv[optind];
+    pid_file_path = argv[optind + 1];
+
+    if (strcmp(cmd, "start") == 0 || strcmp(cmd, "restart") == 0)
+    {
+        if (argc - optind < 3)
+        {
+            usage(argv[0]);
+            return CTL_USAGE;
+        }
+
+        if (cmd[0] == 'r')
+        {
+            int result = cmd_stop(pid_file_path);
+            if (result != CTL_OK)
+            {
+                return result;
+            }
+        }
+
+        return cmd_start(pid_file_path, &argv[optind + 2]);
+    }
+    else if (strcmp(cmd, "stop") == 0)
+    {
+        return cmd_stop(pid_file_path);
+    }
+    else if (strcmp(cmd, "status") == 0)
+    {
+        return cmd_status(pid_file_path);
+    }
+    else if (strcmp(cmd, "wait") == 0)
+    {
+        return cmd_wait(pid_file_path);
+    }
+    else if (strcmp(cmd, "check") == 0)
+    {
+        return cmd_check(pid_file_path);
+    }
+    else if (strcmp(cmd, "usage") == 0)
+    {
+        return cmd_usage(pid_file_path);
+    }
+    else if (strcmp(cmd, "call") == 0)
+    {
+        if (argc - optind < 3)
+        {
+            usage(argv[0]);
+            return CTL_USAGE;
+        }
+        return cmd_call(pid_file_path, argv[optind + 2], argv[optind + 3]);
+    }
+
+    fprintf(stderr, "Unknown command: %s\n", cmd);
+    usage(argv[0]);
+    return CTL_USAGE;
+}
+#else
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "This program contains Linux specific code. Exiting...\n");
+    return EXIT_FAILURE;
+}
+#endif /* __linux__ */
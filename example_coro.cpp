@@ -0,0 +1,116 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+This example shows the C++20 coroutine layer from daemonize_coro.hpp.
+The signals are awaited by a coroutine instead of being dispatched by
+a hand-written select() loop, and another coroutine runs a periodic
+timer.
+*/
+
+#include <signal.h>
+#include <syslog.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "daemonize.hpp"
+
+#ifdef __linux__
+#include "daemonize_coro.hpp"
+
+using dmn::coro::executor;
+using dmn::coro::signal_set;
+using dmn::coro::task;
+
+/* handle the signals until SIGTERM arrives */
+static task<> handle_signals(executor &ex, signal_set &signals)
+{
+    for (;;)
+    {
+        auto signo = co_await signals.wait();
+        if (!signo)
+        {
+            syslog(LOG_ERR, "Cannot wait for signals: %s", signo.error().message().c_str());
+            break;
+        }
+
+        if (*signo == SIGTERM) /* stop the daemon */
+        {
+            syslog(LOG_INFO, "Got SIGTERM signal. Stopping daemon...");
+            break;
+        }
+        syslog(LOG_INFO, "Got SIGHUP signal."); /* reload the configuration */
+    }
+
+    ex.stop(); /* the unfinished tasks are destroyed with the executor */
+}
+
+/* a periodic job */
+static task<> tick(executor &ex)
+{
+    for (unsigned long n = 1; ; n++)
+    {
+        co_await ex.sleep_for(std::chrono::minutes(1));
+        syslog(LOG_INFO, "The daemon has been running for %lu minutes.", n);
+    }
+}
+
+int main()
+{
+    auto body = []() -> int {
+        openlog("EXAMPLE", LOG_NDELAY, LOG_DAEMON);
+        syslog(LOG_INFO, "EXAMPLE daemon started. PID: %ld", (long)getpid());
+
+        /* do not let the exceptions escape to rundaemon() */
+        try
+        {
+            executor ex;
+            signal_set signals(ex, {SIGTERM, SIGHUP});
+
+            ex.spawn(handle_signals(ex, signals));
+            ex.spawn(tick(ex));
+            ex.run();
+        }
+        catch (const std::exception &e)
+        {
+            syslog(LOG_ERR, "Daemon failed: %s", e.what());
+            closelog();
+            return EXIT_FAILURE;
+        }
+
+        closelog();
+        return EXIT_SUCCESS;
+    };
+
+    auto result = dmn::run(body, "/tmp/example.pid");
+    if (!result)
+    {
+        if (result.error() == dmn::errc::already_running)
+        {
+            std::fprintf(stderr, "Daemon already running.\n");
+            return EXIT_SUCCESS;
+        }
+        std::fprintf(stderr, "Cannot start daemon: %s\n", result.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (result->is_daemon())
+    {
+        return result->exit_code; /* Return the daemon exit code. */
+    }
+
+    std::printf("Parent: %ld, Daemon: %ld\n", (long)getpid(), (long)result->pid);
+    return EXIT_SUCCESS;
+}
+#else
+int main()
+{
+    std::fprintf(stderr, "This program contains Linux specific code. Exiting...\n");
+    return EXIT_FAILURE;
+}
+#endif /* __linux__ */
@@ -0,0 +1,73 @@
+/*
+MIT/Expat License
+
+Copyright (c) 2016-2020 Artem Boldariev <artem@boldariev.com>
+
+See the LICENSE.txt for details about the terms of use.
+
+This example shows the C++ interface from daemonize.hpp. The daemon body
+is a lambda and the signals are handled synchronously with sigwait().
+*/
+
+#include <signal.h>
+#include <syslog.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "daemonize.hpp"
+
+int main()
+{
+    int reloads = 0;
+
+    /* The daemon body. It is called by reference, no copies are made. */
+    auto body = [&reloads]() -> int {
+        sigset_t mask;
+        int signo = 0;
+
+        openlog("EXAMPLE", LOG_NDELAY, LOG_DAEMON);
+        syslog(LOG_INFO, "EXAMPLE daemon started. PID: %ld", (long)getpid());
+
+        /* handle the following signals synchronously */
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTERM);
+        sigaddset(&mask, SIGHUP);
+        if (sigprocmask(SIG_BLOCK, &mask, nullptr) == -1)
+        {
+            closelog();
+            return EXIT_FAILURE;
+        }
+
+        /* the daemon loop */
+        while (sigwait(&mask, &signo) == 0 && signo != SIGTERM)
+        {
+            reloads++; /* SIGHUP: reload the configuration */
+            syslog(LOG_INFO, "Got SIGHUP signal (%d so far).", reloads);
+        }
+
+        syslog(LOG_INFO, "Got SIGTERM signal. Stopping daemon...");
+        closelog();
+        return EXIT_SUCCESS;
+    };
+
+    auto result = dmn::run(body, "/tmp/example.pid");
+    if (!result)
+    {
+        if (result.error() == dmn::errc::already_running)
+        {
+            std::fprintf(stderr, "Daemon already running.\n");
+            return EXIT_SUCCESS;
+        }
+        std::fprintf(stderr, "Cannot start daemon: %s\n", result.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (result->is_daemon())
+    {
+        return result->exit_code; /* Return the daemon exit code. */
+    }
+
+    std::printf("Parent: %ld, Daemon: %ld\n", (long)getpid(), (long)result->pid);
+    return EXIT_SUCCESS;
+}
@@ -25,6 +25,15 @@ This example is Linux specific because it uses signalfd(2).
 #include <syslog.h>
 
 #include "daemonize.h"
+#include "dmn_heartbeat.h"
+
+/* Full path to the PID-file (lock). */
+#define PID_FILE_PATH "/tmp/example.pid"
+
+/* The main loop is considered stalled after this time without
+   heartbeats (see "dmnctl check"). It wakes up at least once a second. */
+#define HEARTBEAT_TIMEOUT_MS 5000
+#define LOOP_TIMEOUT_MS 1000
 
 /* helps to keep track of the largest file descriptor for select() */
 #define FD_SET_MAX(fd, setp, maxp) \
@@ -40,6 +49,9 @@ static int example_daemon(void *udata)
     sigset_t mask;
     struct signalfd_siginfo si;
 
+    struct dmn_heartbeat *heartbeat;
+    struct dmn_heartbeat_slot *slot = NULL;
+
     /* open the system log */
     openlog("EXAMPLE", LOG_NDELAY, LOG_DAEMON);
 
@@ -69,12 +81,29 @@ static int example_daemon(void *udata)
         return EXIT_FAILURE;
     }
 
+    /* Let the stalls of the main loop be detected. The watchdog logs
+       them to the system log. The daemon works without it too. */
+    heartbeat = dmn_heartbeat_open(PID_FILE_PATH);
+    if (heartbeat == NULL ||
+        (slot = dmn_heartbeat_register(heartbeat, "main", HEARTBEAT_TIMEOUT_MS)) == NULL ||
+        dmn_heartbeat_watchdog(heartbeat, DMN_HEARTBEAT_DEFAULT, LOOP_TIMEOUT_MS, -1) == -1)
+    {
+        syslog(LOG_WARNING, "Cannot set up the heartbeat: %m");
+    }
+
     /* the daemon loop */
     while (!exit)
     {
         int maxfd = -1;
         int result;
         fd_set readset;
+        struct timeval timeout;
+
+        /* the main loop is alive */
+        if (slot != NULL)
+        {
+            dmn_heartbeat_beat(slot);
+        }
 
         /* add the signal file descriptor to set */
         FD_ZERO(&readset);
@@ -83,8 +112,11 @@ static int example_daemon(void *udata)
            and handle them accordingly if one wants to build a server using
            event-driven approach. */
 
-        /* wait for the data in the signal file descriptor */
-        result = select(maxfd + 1, &readset, NULL, NULL, NULL);
+        /* wait for the data in the signal file descriptor, the timeout
+           is shorter than the heartbeat timeout */
+        timeout.tv_sec = LOOP_TIMEOUT_MS / 1000;
+        timeout.tv_usec = (LOOP_TIMEOUT_MS % 1000) * 1000;
+        result = select(maxfd + 1, &readset, NULL, NULL, &timeout);
         if (result == -1)
         {
             syslog(LOG_ERR, "Fatal error during select() call.");
@@ -113,6 +145,8 @@ static int example_daemon(void *udata)
         }
     }
 
+    /* stop the watchdog and remove the heartbeat page */
+    dmn_heartbeat_close(heartbeat);
     /* close the signal file descriptor */
     close(sfd);
     /* remove the signal handlers */
@@ -133,7 +167,7 @@ int main(int argc, char **argv)
     pid_t pid = rundaemon(0, /* Daemon creation flags. */
                           example_daemon, NULL, /* Daemon body function and its argument. */
                           &exit_code, /* Pointer to a variable to receive daemon exit code */
-                          "/tmp/example.pid"); /* Full path to the PID-file (lock). */
+                          PID_FILE_PATH); /* Full path to the PID-file (lock). */
     switch (pid)
     {
         case -1: /* Low level error. See errno for details. */
@@ -1,5 +1,8 @@
 # Target name
-TARGETS = example_linux example_portable
+TARGETS = example_linux example_portable example_cpp example_coro dmnctl \
+	bench/bench_control bench/bench_pidlock bench/bench_spawn bench/bench_handoff \
+	bench/bench_echo bench/bench_signal bench/bench_zygote bench/bench_share bench/bench_prewarm \
+	bench/bench_usage
 
 # Project C sources
 SRC = $(filter-out  $(LEX_YACC_OUT_SRC),$(wildcard *.c */*.c)) $(LEX_YACC_OUT_SRC)
@@ -10,6 +13,9 @@ SRC = $(filter-out  $(LEX_YACC_OUT_SRC),$(wildcard *.c */*.c)) $(LEX_YACC_OUT_SR
 # Project C++ sources
 CXX_SRC =  $(wildcard *.cpp */*.cpp)
 
+# C++ sources which use the coroutine layer (daemonize_coro.hpp)
+CXX20_SRC = example_coro.cpp bench/bench_echo.cpp
+
 # Project C++ headers
 #CXX_HEADERS = $(wildcard *.hpp */*.hpp) $(HEADERS)
 
@@ -34,3 +40,6 @@ MKFILES = $(MAKEFILE_PATH) $(wildcard $(MAKEFILE_DIR)/*.mk)
 # Lex and Yacc generated sources
 LEX_YACC_OUT_SRC = $(YFILES:.y=.tab.c) $(LFILES:.l=.lex.c)
 LEX_YACC_OUT_HEADERS = $(YFILES:.y=.tab.h)
+
+# Build the C++20 sources with -std=c++20 (it overrides -std=c++11)
+$(foreach srcfile,$(CXX20_SRC),$(basename $(srcfile)).%) : CXXFLAGS += -std=c++20